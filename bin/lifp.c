@@ -1,9 +1,13 @@
+// This is for the CI compiler
+#define _POSIX_C_SOURCE 200809L
 #include "../lib/alloc.h"
 #include "../vendor/args/src/args.h"
 
 // NOLINTBEGIN - intentionally including .c files
 #include "../cmd/repl.c"
 #include "../cmd/run.c"
+#include "../cmd/compile.c"
+#include "../cmd/serve.c"
 // NOLINTEND
 
 #include <stddef.h>
@@ -21,6 +25,8 @@ void formatRootUsage(size_t size, char buffer[static size]) {
            "\n"
            "Commands:\n"
            "  run     file.lifp            run a file with lifp\n"
+           "  compile file.lifp            compile a file to a program image\n"
+           "  serve   socket               run files sent to a socket\n"
            "  repl                         start a REPL session\n"
            "  help    command              show help for command\n"
            "\n"
@@ -40,6 +46,12 @@ void formatRunUsage(size_t size, char buffer[static size]) {
            "Flags:\n"
            "  -f, --file-size         int    max size of source file (in KB)\n"
            "  -a, --ast-memory        int    max parsing memory size (in KB)\n"
+           "  -p, --pipeline                 parse ahead on a separate thread\n"
+           "  -n, --no-cache                 do not cache the parsed program\n"
+           "  -s, --snapshot          str    save global definitions on exit\n"
+           "  -r, --restore           str    restore global definitions on start\n"
+           "  -c, --connect           str    run on the lifp serve at socket\n"
+           "      --fork-server              then fork to run paths from stdin\n"
            "  -h, --help                     print this help and exit\n"
            "  -v, --version                  print version and exit\n"
            "\n"
@@ -47,13 +59,45 @@ void formatRunUsage(size_t size, char buffer[static size]) {
            NAME, RUN);
 }
 
+void formatServeUsage(size_t size, char buffer[static size]) {
+  snprintf(buffer, size,
+           "Usage:\n"
+           "  %s %s [flags] socket\n"
+           "\n"
+           "Flags:\n"
+           "  -p, --prelude           str    file to run before serving\n"
+           "  -f, --file-size         int    max size of source file (in KB)\n"
+           "  -a, --ast-memory        int    max parsing memory size (in KB)\n"
+           "  -h, --help                     print this help and exit\n"
+           "  -v, --version                  print version and exit\n"
+           "\n"
+           "Learn more about lifp at https://github.com/shikaan/lifp",
+           NAME, SERVE);
+}
+
+void formatCompileUsage(size_t size, char buffer[static size]) {
+  snprintf(buffer, size,
+           "Usage:\n"
+           "  %s %s [flags] file.lifp\n"
+           "\n"
+           "Flags:\n"
+           "  -o, --output            str    image path (default: file.lifpc)\n"
+           "  -f, --file-size         int    max size of source file (in KB)\n"
+           "  -a, --ast-memory        int    max parsing memory size (in KB)\n"
+           "  -h, --help                     print this help and exit\n"
+           "  -v, --version                  print version and exit\n"
+           "\n"
+           "Learn more about lifp at https://github.com/shikaan/lifp",
+           NAME, COMPILE);
+}
+
 void formatReplUsage(size_t size, char buffer[static size]) {
   snprintf(buffer, size,
            "Usage:\n"
            "  %s %s [flags]\n"
            "\n"
            "Flags:\n"
-           "  -o, --output-size       int    max length of the output buffer\n"
+           "  -o, --output-size       int    max length of error messages\n"
            "  -a, --ast-memory        int    max parsing memory size (in KB)\n"
            "  -h, --help                     print this help and exit\n"
            "  -v, --version                  print version and exit\n"
@@ -72,11 +116,60 @@ int runCallback(char *name, ArgParser *parser) {
   run_opts_t opts;
   opts.ast_memory = (size_t)ap_get_int_value(parser, "ast-memory") * KILOBYTE;
   opts.file_size = (size_t)ap_get_int_value(parser, "file-size") * KILOBYTE;
+  opts.pipeline = ap_found(parser, "pipeline");
+  opts.cache = !ap_found(parser, "no-cache");
+  opts.fork_server = ap_found(parser, "fork-server");
+  opts.snapshot = ap_found(parser, "snapshot")
+                      ? ap_get_str_value(parser, "snapshot")
+                      : nullptr;
+  opts.restore = ap_found(parser, "restore")
+                     ? ap_get_str_value(parser, "restore")
+                     : nullptr;
+  opts.connect = ap_found(parser, "connect")
+                     ? ap_get_str_value(parser, "connect")
+                     : nullptr;
   opts.filename = ap_get_arg_at_index(parser, 0);
 
+  if (opts.connect) {
+    return runRemote(opts);
+  }
   return run(opts);
 }
 
+int serveCallback(char *name, ArgParser *parser) {
+  int count = ap_count_args(parser);
+  if (count != 1) {
+    error("%s requires 1 argument", name);
+    return 1;
+  }
+
+  serve_opts_t opts;
+  opts.ast_memory = (size_t)ap_get_int_value(parser, "ast-memory") * KILOBYTE;
+  opts.file_size = (size_t)ap_get_int_value(parser, "file-size") * KILOBYTE;
+  opts.prelude = ap_found(parser, "prelude")
+                     ? ap_get_str_value(parser, "prelude")
+                     : nullptr;
+  opts.socket = ap_get_arg_at_index(parser, 0);
+
+  return serve(opts);
+}
+
+int compileCallback(char *name, ArgParser *parser) {
+  int count = ap_count_args(parser);
+  if (count != 1) {
+    error("%s requires 1 argument", name);
+    return 1;
+  }
+
+  compile_opts_t opts;
+  opts.ast_memory = (size_t)ap_get_int_value(parser, "ast-memory") * KILOBYTE;
+  opts.file_size = (size_t)ap_get_int_value(parser, "file-size") * KILOBYTE;
+  opts.output = ap_get_str_value(parser, "output");
+  opts.filename = ap_get_arg_at_index(parser, 0);
+
+  return compile(opts);
+}
+
 int replCallback(char *name, ArgParser *parser) {
   (void)name;
   repl_opts_t opts;
@@ -89,6 +182,8 @@ int replCallback(char *name, ArgParser *parser) {
 int main(int argc, char **argv) {
   ArgParser *root_parser = nullptr;
   ArgParser *run_parser = nullptr;
+  ArgParser *compile_parser = nullptr;
+  ArgParser *serve_parser = nullptr;
   ArgParser *repl_parser = nullptr;
 
   root_parser = ap_new_parser();
@@ -97,12 +192,16 @@ int main(int argc, char **argv) {
     goto error;
   }
 
-  char usage_help[512];
-  formatRootUsage(512, usage_help);
+  char usage_help[1024];
+  formatRootUsage(1024, usage_help);
   char version[512];
   formatVersion(512, version);
-  char run_help[512];
-  formatRunUsage(512, run_help);
+  char run_help[1024];
+  formatRunUsage(1024, run_help);
+  char compile_help[512];
+  formatCompileUsage(512, compile_help);
+  char serve_help[512];
+  formatServeUsage(512, serve_help);
   char repl_help[512];
   formatReplUsage(512, repl_help);
 
@@ -120,9 +219,45 @@ int main(int argc, char **argv) {
   ap_set_version(run_parser, version);
   ap_add_int_opt(run_parser, "file-size f", 1024);
   ap_add_int_opt(run_parser, "ast-memory a", 128);
+  ap_add_flag(run_parser, "pipeline p");
+  ap_add_flag(run_parser, "no-cache n");
+  ap_add_str_opt(run_parser, "snapshot s", "");
+  ap_add_str_opt(run_parser, "restore r", "");
+  ap_add_str_opt(run_parser, "connect c", "");
+  ap_add_flag(run_parser, "fork-server");
 
   ap_set_cmd_callback(run_parser, runCallback);
 
+  // COMPILE
+  compile_parser = ap_new_cmd(root_parser, COMPILE);
+  if (!compile_parser) {
+    error("unable to allocate memory");
+    goto error;
+  }
+
+  ap_set_helptext(compile_parser, compile_help);
+  ap_set_version(compile_parser, version);
+  ap_add_str_opt(compile_parser, "output o", "");
+  ap_add_int_opt(compile_parser, "file-size f", 1024);
+  ap_add_int_opt(compile_parser, "ast-memory a", 128);
+
+  ap_set_cmd_callback(compile_parser, compileCallback);
+
+  // SERVE
+  serve_parser = ap_new_cmd(root_parser, SERVE);
+  if (!serve_parser) {
+    error("unable to allocate memory");
+    goto error;
+  }
+
+  ap_set_helptext(serve_parser, serve_help);
+  ap_set_version(serve_parser, version);
+  ap_add_str_opt(serve_parser, "prelude p", "");
+  ap_add_int_opt(serve_parser, "file-size f", 1024);
+  ap_add_int_opt(serve_parser, "ast-memory a", 128);
+
+  ap_set_cmd_callback(serve_parser, serveCallback);
+
   // REPL
   repl_parser = ap_new_cmd(root_parser, REPL);
   if (!repl_parser) {
@@ -149,11 +284,15 @@ int main(int argc, char **argv) {
   }
 
   ap_free(repl_parser);
+  ap_free(serve_parser);
+  ap_free(compile_parser);
   ap_free(run_parser);
   return ap_get_cmd_exit_code(root_parser);
 
 error:
   ap_free(repl_parser);
+  ap_free(serve_parser);
+  ap_free(compile_parser);
   ap_free(run_parser);
   ap_free(root_parser);
   return 1;
@@ -0,0 +1,98 @@
+#include "../lifp/image.h"
+#include "../lifp/parse.h"
+
+#include "utils.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+const char COMPILE[] = "compile";
+
+// Appended to the source file name when no output is provided
+static constexpr char IMAGE_EXTENSION[] = "c";
+static constexpr size_t MAX_OUTPUT_PATH = 4096;
+
+typedef struct {
+  size_t ast_memory;
+  size_t file_size;
+  const char *filename;
+  const char *output;
+} compile_opts_t;
+
+static int compileStatements(const compile_opts_t *OPTIONS,
+                             image_writer_t *writer, arena_t *ast_arena,
+                             ssize_t file_length,
+                             const char file_buffer[static file_length],
+                             char statement_buffer[static file_length]) {
+  ssize_t file_offset = 0;
+
+  do {
+    arenaReset(ast_arena);
+
+    result_node_ref_t parsed = parseStatement(
+        ast_arena, file_length, statement_buffer, file_buffer, &file_offset);
+    if (parsed.code != RESULT_OK) {
+      printRunError(OPTIONS->filename, file_buffer, parsed.message,
+                    parsed.meta);
+      return 1;
+    }
+
+    if (parsed.value) {
+      result_void_t appended = imageWriterAppend(writer, parsed.value);
+      if (appended.code != RESULT_OK) {
+        error("%s", appended.message);
+        return 1;
+      }
+    }
+  } while (file_offset < file_length);
+
+  return 0;
+}
+
+int compile(const compile_opts_t OPTIONS) {
+  char output[MAX_OUTPUT_PATH];
+  if (OPTIONS.output && strlen(OPTIONS.output) > 0) {
+    snprintf(output, MAX_OUTPUT_PATH, "%s", OPTIONS.output);
+  } else {
+    snprintf(output, MAX_OUTPUT_PATH, "%s%s", OPTIONS.filename,
+             IMAGE_EXTENSION);
+  }
+
+  char *file_buffer = nullptr;
+  ssize_t file_length = 0;
+  if (readSource(OPTIONS.filename, OPTIONS.file_size, &file_buffer,
+                 &file_length) != 0) {
+    return 1;
+  }
+
+  char *statement_buffer;
+  tryCLI(allocSafe(OPTIONS.file_size), statement_buffer,
+         "cannot allocate file buffer");
+
+  arena_t *ast_arena = nullptr;
+  tryCLI(arenaCreate(OPTIONS.ast_memory), ast_arena,
+         "unable to allocate parser memory");
+
+  image_writer_t *writer = nullptr;
+  tryCLI(imageWriterCreate(), writer, "unable to allocate image memory");
+
+  int status = compileStatements(&OPTIONS, writer, ast_arena, file_length,
+                                 file_buffer, statement_buffer);
+
+  if (status == 0) {
+    result_void_t saved = imageWriterSave(writer, output, (size_t)file_length,
+                                          file_buffer);
+    if (saved.code != RESULT_OK) {
+      error("%s", saved.message);
+      status = 1;
+    }
+  }
+
+  imageWriterDestroy(&writer);
+  arenaDestroy(&ast_arena);
+  deallocSafe(&statement_buffer);
+  deallocSafe(&file_buffer);
+  return status;
+}
@@ -17,9 +17,6 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
-extern value_map_t *builtins;
-extern value_map_t *specials;
-
 const char REPL[] = "repl";
 
 typedef struct {
@@ -57,6 +54,7 @@ static void fillCompletions(environment_t *env) {
     }
   }
 
+  const value_map_t *builtins = env->machine->builtins;
   for (size_t i = 0; i < builtins->capacity; i++) {
     if (builtins->used[i]) {
       memset(completions[completions_count], 0, MAX_SYMBOL_LENGTH);
@@ -68,6 +66,7 @@ static void fillCompletions(environment_t *env) {
     }
   }
 
+  const value_map_t *specials = env->machine->specials;
   for (size_t i = 0; i < specials->capacity; i++) {
     if (specials->used[i]) {
       memset(completions[completions_count], 0, MAX_SYMBOL_LENGTH);
@@ -146,7 +145,6 @@ void help(void) {
          "https://github.com/shikaan/lifp\n");
 }
 
-static char format_buffer[1024] = {0};
 static constexpr char REPL_COMMAND_MORE[] = "?";
 void more(const char *input, environment_t *env) {
   if (strlen(input) <= 2) {
@@ -185,10 +183,9 @@ void more(const char *input, environment_t *env) {
 
   const value_t *value = environmentResolveSymbol(env, symbol);
   if (value) {
-    int offset = 0;
-    formatValue(value, 1024, format_buffer, &offset);
-    printf("%s :: (%s) ~> %s\n", symbol, formatValueType(value->type),
-           format_buffer);
+    printf("%s :: (%s) ~> ", symbol, formatValueType(value->type));
+    formatValueTo(value, formatFileSink(stdout));
+    printf("\n");
   } else {
     printf("Error: symbol '%s' not found. Use '?' to see all symbols in "
            "current environment.\n",
@@ -200,6 +197,7 @@ void more(const char *input, environment_t *env) {
   int _concat(offset_, __LINE__) = 0;                                          \
   formatErrorMessage((Result)->message, (Result)->meta, "repl", InputBuffer,   \
                      Size, OutputBuffer, &_concat(offset_, __LINE__));         \
+  vmFlush();                                                                   \
   fprintf(stdout, "%s\n", OutputBuffer);
 
 #define tryREPL(Action, ...)                                                   \
@@ -274,9 +272,10 @@ int repl(const repl_opts_t OPTIONS) {
 
     tryREPL(evaluate(ast, machine->global), result);
 
-    int buffer_offset = 0;
-    formatValue(result, (int)OPTIONS.output_size, buffer, &buffer_offset);
-    printf("~> %s\n", buffer);
+    vmFlush();
+    printf("~> ");
+    formatValueTo(result, formatFileSink(stdout));
+    printf("\n");
 
     fillCompletions(machine->global);
 
@@ -1,18 +1,28 @@
 #include "../lifp/evaluate.h"
 #include "../lifp/fmt.h"
+#include "../lifp/image.h"
 #include "../lifp/parse.h"
+#include "../lifp/snapshot.h"
 #include "../lifp/tokenize.h"
 #include "../lifp/virtual_machine.h"
 
+#include "../lib/hash.h"
 #include "../lib/profile.h"
 
 #include "utils.h"
 
+#include <errno.h>
 #include <fcntl.h> // open
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h> // sprint
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h> // mkdir
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 const char RUN[] = "run";
@@ -20,120 +30,557 @@ const char RUN[] = "run";
 typedef struct {
   size_t ast_memory;
   size_t file_size;
+  bool pipeline;
+  bool cache;
+  bool fork_server;
+  const char *connect;
+  const char *snapshot;
+  const char *restore;
   const char *filename;
 } run_opts_t;
 
-#define printError(Result, InputBuffer, Size, OutputBuffer)                    \
-  int _concat(offset_, __LINE__) = 0;                                          \
-  formatErrorMessage((Result)->message, (Result)->meta, OPTIONS.filename,      \
-                     InputBuffer, Size, OutputBuffer,                          \
-                     &_concat(offset_, __LINE__));                             \
-  fprintf(stdout, "%s\n", OutputBuffer);
+static constexpr size_t MAX_CACHE_PATH = 4096;
+
+// Amount of top-level statements the parser thread can be ahead of evaluation
+static constexpr size_t PIPELINE_SLOTS = 8;
+
+typedef struct {
+  arena_t *arena;
+  result_node_ref_t result;
+  bool last;
+} pipeline_slot_t;
+
+// Single-producer single-consumer ring of parsed statements. The parser thread
+// owns `tail` and the evaluator owns `head`; a slot is handed over by
+// publishing the new index with release semantics.
+typedef struct {
+  pipeline_slot_t slots[PIPELINE_SLOTS];
+  atomic_size_t head;
+  atomic_size_t tail;
+  atomic_bool cancelled;
+  ssize_t file_length;
+  const char *file_buffer;
+  char *statement_buffer;
+  image_writer_t *writer;
+} pipeline_t;
+
+static void printRunError(const char *filename, const char *file_buffer,
+                          message_t message, position_t position) {
+  char buffer[4096] = {0};
+  int offset = 0;
+  formatErrorMessage(message, position, filename, file_buffer, 4096, buffer,
+                     &offset);
+  vmFlush();
+  fprintf(stdout, "%s\n", buffer);
+}
 
 #define tryRun(Action, ...)                                                    \
   auto _concat(result, __LINE__) = Action;                                     \
   if (_concat(result, __LINE__).code != RESULT_OK) {                           \
-    char buffer[4096] = {0};                                                   \
-    printError(&_concat(result, __LINE__), file_buffer, 4096, buffer);         \
-    profileReport();                                                           \
+    printRunError(OPTIONS->filename, file_buffer,                              \
+                  _concat(result, __LINE__).message,                           \
+                  _concat(result, __LINE__).meta);                             \
     return 1;                                                                  \
   }                                                                            \
   __VA_OPT__(__VA_ARGS__ = _concat(result, __LINE__).value;)
 
-static void readStatement(ssize_t size, char line_buffer[static size],
-                          const char input_buffer[static size],
-                          ssize_t *offset) {
-  size_t line_buffer_offset = 0;
-  int depth = 0;
+// Records a parsed statement in the cache image. Caching is best-effort: when
+// the image cannot grow, the writer is dropped and the run carries on.
+static void cacheRecord(image_writer_t **writer, const node_t *node) {
+  if (!*writer || !node)
+    return;
+
+  result_void_t appended = imageWriterAppend(*writer, node);
+  if (appended.code != RESULT_OK)
+    imageWriterDestroy(writer);
+}
+
+static int runSequential(const run_opts_t *OPTIONS, environment_t *environment,
+                         arena_t *ast_arena, image_writer_t **writer,
+                         ssize_t file_length,
+                         const char file_buffer[static file_length],
+                         char statement_buffer[static file_length]) {
+  ssize_t file_offset = 0;
+
+  do {
+    arenaReset(ast_arena);
+
+    node_t *syntax_tree = nullptr;
+    tryRun(parseStatement(ast_arena, file_length, statement_buffer,
+                          file_buffer, &file_offset),
+           syntax_tree);
+    cacheRecord(writer, syntax_tree);
+
+    if (syntax_tree) {
+      value_t *result;
+      tryRun(evaluate(syntax_tree, environment), result);
+      valueDestroy(&result);
+    }
+  } while (file_offset < file_length);
+
+  return 0;
+}
 
-  for (; *offset < size; (*offset)++) {
-    const char current = input_buffer[(*offset)];
+// Spins for a while, then sleeps: waits on the other side of the pipeline are
+// usually short, but a slow evaluation should not burn a whole core.
+static void pipelineBackoff(size_t *spins) {
+  if ((*spins)++ < 64)
+    return;
 
-    // end of an atom statement
-    if (current == '\n' && depth == 0) {
-      (*offset)++;
-      return;
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = 50000};
+  nanosleep(&pause, nullptr);
+}
+
+static void *pipelineProduce(void *context) {
+  pipeline_t *self = context;
+  ssize_t file_offset = 0;
+
+  while (true) {
+    size_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+
+    size_t spins = 0;
+    while (tail - atomic_load_explicit(&self->head, memory_order_acquire) ==
+           PIPELINE_SLOTS) {
+      if (atomic_load_explicit(&self->cancelled, memory_order_relaxed))
+        return nullptr;
+      pipelineBackoff(&spins);
     }
 
-    line_buffer[line_buffer_offset++] = current;
+    pipeline_slot_t *slot = &self->slots[tail % PIPELINE_SLOTS];
+    arenaReset(slot->arena);
+    slot->result =
+        parseStatement(slot->arena, self->file_length, self->statement_buffer,
+                       self->file_buffer, &file_offset);
+    slot->last = slot->result.code != RESULT_OK ||
+                 file_offset >= self->file_length;
+    if (slot->result.code == RESULT_OK)
+      cacheRecord(&self->writer, slot->result.value);
 
-    // end of a list statement
-    if (current == RPAREN) {
-      if (depth == 1) {
-        (*offset)++;
-        return;
-      }
-      depth--;
+    atomic_store_explicit(&self->tail, tail + 1, memory_order_release);
+
+    if (slot->last)
+      return nullptr;
+  }
+}
+
+// Slots without an arena yet are skipped
+static void pipelineDestroyArenas(pipeline_t *self) {
+  for (size_t i = 0; i < PIPELINE_SLOTS; i++) {
+    arenaDestroy(&self->slots[i].arena);
+  }
+}
+
+static int runPipelined(const run_opts_t *OPTIONS, vm_t *machine,
+                        image_writer_t **writer, ssize_t file_length,
+                        const char file_buffer[static file_length],
+                        char statement_buffer[static file_length]) {
+  pipeline_t pipeline = {
+      .file_length = file_length,
+      .file_buffer = file_buffer,
+      .statement_buffer = statement_buffer,
+      .writer = *writer,
+  };
+  atomic_init(&pipeline.head, 0);
+  atomic_init(&pipeline.tail, 0);
+  atomic_init(&pipeline.cancelled, false);
+
+  for (size_t i = 0; i < PIPELINE_SLOTS; i++) {
+    result_ref_t created = arenaCreate(OPTIONS->ast_memory);
+    if (created.code != RESULT_OK) {
+      pipelineDestroyArenas(&pipeline);
+      error("unable to allocate interpreter memory");
+      return 1;
+    }
+    pipeline.slots[i].arena = created.value;
+  }
+
+  pthread_t producer;
+  if (pthread_create(&producer, nullptr, pipelineProduce, &pipeline) != 0) {
+    pipelineDestroyArenas(&pipeline);
+    error("unable to start parser thread");
+    return 1;
+  }
+
+  int status = 0;
+  for (size_t head = 0;; head++) {
+    size_t spins = 0;
+    while (atomic_load_explicit(&pipeline.tail, memory_order_acquire) == head) {
+      pipelineBackoff(&spins);
     }
 
-    if (current == LPAREN) {
-      depth++;
+    pipeline_slot_t *slot = &pipeline.slots[head % PIPELINE_SLOTS];
+    if (slot->result.code != RESULT_OK) {
+      printRunError(OPTIONS->filename, file_buffer, slot->result.message,
+                    slot->result.meta);
+      status = 1;
+      break;
     }
+
+    if (slot->result.value) {
+      result_value_ref_t result = evaluate(slot->result.value, machine->global);
+      if (result.code != RESULT_OK) {
+        printRunError(OPTIONS->filename, file_buffer, result.message,
+                      result.meta);
+        status = 1;
+        break;
+      }
+      valueDestroy(&result.value);
+    }
+
+    bool last = slot->last;
+    atomic_store_explicit(&pipeline.head, head + 1, memory_order_release);
+    if (last)
+      break;
   }
+
+  atomic_store_explicit(&pipeline.cancelled, true, memory_order_relaxed);
+  pthread_join(producer, nullptr);
+  *writer = pipeline.writer;
+
+  pipelineDestroyArenas(&pipeline);
+  return status;
 }
 
-int run(const run_opts_t OPTIONS) {
-  int file_descriptor = open(OPTIONS.filename, O_RDONLY, 0644);
+// Reads a source file in a freshly allocated buffer. Returns non-zero on error.
+static int readSource(const char *filename, size_t file_size,
+                      char **file_buffer, ssize_t *file_length) {
+  int file_descriptor = open(filename, O_RDONLY, 0644);
   if (file_descriptor < 0) {
-    error("cannot open '%s'", OPTIONS.filename);
+    error("cannot open '%s'", filename);
     return 1;
   }
 
-  char *file_buffer;
-  tryCLI(allocSafe(OPTIONS.file_size), file_buffer,
-         "cannot allocate file buffer");
+  tryCLI(allocSafe(file_size), *file_buffer, "cannot allocate file buffer");
 
-  ssize_t file_offset = 0;
-  ssize_t file_length = read(file_descriptor, file_buffer, OPTIONS.file_size);
-  if (file_length == 0) {
+  *file_length = read(file_descriptor, *file_buffer, file_size);
+  close(file_descriptor);
+  if (*file_length <= 0) {
     error("provided file is empty");
+    deallocSafe(file_buffer);
+    return 1;
+  }
+
+  return 0;
+}
+
+static bool isImage(const char *filename) {
+  int file_descriptor = open(filename, O_RDONLY, 0644);
+  if (file_descriptor < 0)
+    return false;
+
+  char magic[IMAGE_MAGIC_SIZE] = {};
+  ssize_t length = read(file_descriptor, magic, IMAGE_MAGIC_SIZE);
+  close(file_descriptor);
+  return length == IMAGE_MAGIC_SIZE && imageHasMagic(IMAGE_MAGIC_SIZE, magic);
+}
+
+static int runForms(const run_opts_t *OPTIONS, vm_t *machine,
+                    arena_t *ast_arena, const image_t *image) {
+  const char *file_buffer = image->source;
+
+  for (size_t i = 0; i < image->header->forms_count; i++) {
+    arenaReset(ast_arena);
+
+    node_t *syntax_tree = nullptr;
+    tryRun(imageLoadForm(image, ast_arena, i), syntax_tree);
+
+    value_t *result;
+    tryRun(evaluate(syntax_tree, machine->global), result);
+    valueDestroy(&result);
+  }
+
+  return 0;
+}
+
+// Restores the global environment saved by a previous run, if requested
+static int restoreSnapshot(const run_opts_t *OPTIONS, vm_t *machine) {
+  if (!OPTIONS->restore)
+    return 0;
+
+  result_void_t restored = snapshotRestore(machine, OPTIONS->restore);
+  if (restored.code != RESULT_OK) {
+    error("%s", restored.message);
+    return 1;
+  }
+  return 0;
+}
+
+static int saveSnapshot(const run_opts_t *OPTIONS, const vm_t *machine) {
+  if (!OPTIONS->snapshot)
+    return 0;
+
+  result_void_t saved = snapshotSave(machine, OPTIONS->snapshot);
+  if (saved.code != RESULT_OK) {
+    error("%s", saved.message);
+    return 1;
+  }
+  return 0;
+}
+
+// Runs a job in a forked child: the job starts from the heap of the parent,
+// shared copy-on-write, and whatever it defines, leaks or breaks stays there.
+static int runJob(const run_opts_t *OPTIONS, vm_t *machine,
+                  const char *filename) {
+  // Standard input carries the jobs: it must not be consumed by the job
+  if (!freopen("/dev/null", "r", stdin)) {
+    error("cannot detach standard input");
+    return 1;
+  }
+
+  char *file_buffer = nullptr;
+  ssize_t file_length = 0;
+  if (readSource(filename, OPTIONS->file_size, &file_buffer, &file_length) !=
+      0) {
     return 1;
   }
 
   char *statement_buffer;
-  tryCLI(allocSafe(OPTIONS.file_size), statement_buffer,
+  tryCLI(allocSafe(OPTIONS->file_size), statement_buffer,
          "cannot allocate file buffer");
+  arena_t *ast_arena = nullptr;
+  tryCLI(arenaCreate(OPTIONS->ast_memory), ast_arena,
+         "unable to allocate interpreter memory");
+
+  run_opts_t job_options = *OPTIONS;
+  job_options.filename = filename;
+  image_writer_t *writer = nullptr;
+  int status = runSequential(&job_options, machine->global, ast_arena, &writer,
+                             file_length, file_buffer, statement_buffer);
+
+  arenaDestroy(&ast_arena);
+  deallocSafe(&statement_buffer);
+  deallocSafe(&file_buffer);
+  return status;
+}
+
+// Fork server: once the file has run, every path read from standard input is
+// run by a child forked from the warmed up machine. Returns non-zero when any
+// job failed.
+static int runJobs(const run_opts_t *OPTIONS, vm_t *machine) {
+  if (!OPTIONS->fork_server)
+    return 0;
+
+  char *line = nullptr;
+  size_t line_size = 0;
+  int status = 0;
+
+  ssize_t length;
+  while ((length = getline(&line, &line_size, stdin)) > 0) {
+    if (line[length - 1] == '\n')
+      line[--length] = 0;
+    if (length == 0)
+      continue;
+
+    // Buffered output would otherwise be written by the child as well
+    vmFlush();
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t child = fork();
+    if (child < 0) {
+      error("cannot fork job '%s'", line);
+      status = 1;
+      continue;
+    }
+
+    if (child == 0) {
+      int job_status = runJob(OPTIONS, machine, line);
+      vmFlush();
+      fflush(stdout);
+      fflush(stderr);
+      _exit(job_status);
+    }
+
+    int child_status = 0;
+    while (waitpid(child, &child_status, 0) < 0) {
+      if (errno != EINTR) {
+        child_status = 1;
+        break;
+      }
+    }
+
+    if (WIFSIGNALED(child_status)) {
+      error("job '%s' terminated by signal %d", line, WTERMSIG(child_status));
+      status = 1;
+    } else if (WEXITSTATUS(child_status) != 0) {
+      status = 1;
+    }
+  }
+
+  free(line);
+  return status;
+}
 
+// Executes a program image, skipping tokenization and parsing altogether.
+static int runImage(const run_opts_t *OPTIONS, const image_t *image) {
   profileInit();
   arena_t *ast_arena = nullptr;
-  tryCLI(arenaCreate(OPTIONS.ast_memory), ast_arena,
+  tryCLI(arenaCreate(OPTIONS->ast_memory), ast_arena,
          "unable to allocate interpreter memory");
 
   vm_t *machine = nullptr;
   tryCLI(vmCreate(), machine, "unable to initialize virtual machine");
 
-  do {
-    memset(statement_buffer, 0, (size_t)file_length);
-    arenaReset(ast_arena);
-    readStatement(file_length, statement_buffer, file_buffer, &file_offset);
+  int status = restoreSnapshot(OPTIONS, machine);
+  if (status == 0)
+    status = runForms(OPTIONS, machine, ast_arena, image);
+  if (status == 0)
+    status = saveSnapshot(OPTIONS, machine);
+  if (status == 0)
+    status = runJobs(OPTIONS, machine);
 
-    if (strlen(statement_buffer) == 0)
-      continue;
+  profileReport();
 
-    token_list_t *tokens = nullptr;
-    tryRun(tokenize(ast_arena, statement_buffer), tokens);
+  vmDestroy(&machine);
+  arenaDestroy(&ast_arena);
+  return status;
+}
 
-    size_t line_offset = 0;
-    size_t depth = 0;
-    node_t *syntax_tree = nullptr;
-    tryRun(parse(ast_arena, tokens, &line_offset, &depth), syntax_tree);
+// Cached images live in $XDG_CACHE_HOME/lifp (or ~/.cache/lifp) and are named
+// after a hash of the interpreter version and of the source, so that neither
+// upgrading lifp nor editing the script can pick up a stale image.
+static bool cachePath(size_t size, const char source[static size],
+                      size_t path_size, char path[static path_size]) {
+  char directory[MAX_CACHE_PATH];
+  const char *cache_home = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
 
-    if (syntax_tree) {
-      value_t *result;
-      tryRun(evaluate(syntax_tree, machine->global), result);
-      valueDestroy(&result);
+  if (cache_home && strlen(cache_home) > 0) {
+    snprintf(directory, MAX_CACHE_PATH, "%s", cache_home);
+  } else if (home && strlen(home) > 0) {
+    snprintf(directory, MAX_CACHE_PATH, "%s/.cache", home);
+  } else {
+    return false;
+  }
+
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+    return false;
+
+  size_t length = strlen(directory);
+  snprintf(directory + length, MAX_CACHE_PATH - length, "/%s", NAME);
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST)
+    return false;
+
+  // Images are only read by the build writing them. Builds without a version
+  // or a commit, like local ones, are told apart by their executable.
+  const uint32_t format = IMAGE_FORMAT_VERSION;
+  uint64_t hash = hashBytes(HASH_SEED, sizeof(format), (const char *)&format);
+  hash = hashBytes(hash, strlen(VERSION), VERSION);
+  hash = hashBytes(hash, strlen(SHA), SHA);
+  if (strlen(VERSION) == 0 || strlen(SHA) == 0) {
+    struct stat executable;
+    if (stat("/proc/self/exe", &executable) == 0) {
+      hash = hashBytes(hash, sizeof(executable.st_mtim),
+                       (const char *)&executable.st_mtim);
+      hash = hashBytes(hash, sizeof(executable.st_size),
+                       (const char *)&executable.st_size);
+    } else {
+      const char build[] = __DATE__ " " __TIME__;
+      hash = hashBytes(hash, sizeof(build), build);
     }
-  } while (file_offset < file_length);
+  }
+  hash = hashBytes(hash, size, source);
+
+  int written =
+      snprintf(path, path_size, "%s/%016" PRIx64 ".lifpc", directory, hash);
+  return written > 0 && (size_t)written < path_size;
+}
+
+// Opens the cached image for the source, if any. The cached source is
+// compared in full to rule out hash collisions.
+static image_t *cacheOpen(const char *path, size_t size,
+                          const char source[static size]) {
+  result_ref_t opened = imageOpen(path);
+  if (opened.code != RESULT_OK)
+    return nullptr;
+
+  image_t *image = opened.value;
+  if (image->header->source_size != size ||
+      memcmp(image->source, source, size) != 0) {
+    imageClose(&image);
+    return nullptr;
+  }
+
+  return image;
+}
+
+int run(const run_opts_t OPTIONS) {
+  if (isImage(OPTIONS.filename)) {
+    result_ref_t opened = imageOpen(OPTIONS.filename);
+    if (opened.code != RESULT_OK) {
+      error("%s", opened.message);
+      return 1;
+    }
+
+    image_t *image = opened.value;
+    int status = runImage(&OPTIONS, image);
+    imageClose(&image);
+    return status;
+  }
+
+  char *file_buffer = nullptr;
+  ssize_t file_length = 0;
+  if (readSource(OPTIONS.filename, OPTIONS.file_size, &file_buffer,
+                 &file_length) != 0) {
+    return 1;
+  }
+
+  char cache_path[MAX_CACHE_PATH];
+  image_writer_t *writer = nullptr;
+  if (OPTIONS.cache && cachePath((size_t)file_length, file_buffer,
+                                 MAX_CACHE_PATH, cache_path)) {
+    image_t *image = cacheOpen(cache_path, (size_t)file_length, file_buffer);
+    if (image) {
+      int status = runImage(&OPTIONS, image);
+      imageClose(&image);
+      deallocSafe(&file_buffer);
+      return status;
+    }
+
+    result_ref_t created = imageWriterCreate();
+    if (created.code == RESULT_OK)
+      writer = created.value;
+  }
+
+  char *statement_buffer;
+  tryCLI(allocSafe(OPTIONS.file_size), statement_buffer,
+         "cannot allocate file buffer");
+
+  profileInit();
+  vm_t *machine = nullptr;
+  tryCLI(vmCreate(), machine, "unable to initialize virtual machine");
+
+  int status = restoreSnapshot(&OPTIONS, machine);
+  if (status == 0 && OPTIONS.pipeline) {
+    status = runPipelined(&OPTIONS, machine, &writer, file_length, file_buffer,
+                          statement_buffer);
+  } else if (status == 0) {
+    arena_t *ast_arena = nullptr;
+    tryCLI(arenaCreate(OPTIONS.ast_memory), ast_arena,
+           "unable to allocate interpreter memory");
+    status = runSequential(&OPTIONS, machine->global, ast_arena, &writer,
+                           file_length, file_buffer, statement_buffer);
+    arenaDestroy(&ast_arena);
+  }
+
+  if (status == 0)
+    status = saveSnapshot(&OPTIONS, machine);
+  if (status == 0)
+    status = runJobs(&OPTIONS, machine);
 
   profileReport();
 
+  // Only complete runs are cached: a failed one may not have parsed it all
+  if (writer && status == 0) {
+    imageWriterSave(writer, cache_path, (size_t)file_length, file_buffer);
+  }
+  imageWriterDestroy(&writer);
+
   deallocSafe(&statement_buffer);
   deallocSafe(&file_buffer);
 
   vmDestroy(&machine);
-  arenaDestroy(&ast_arena);
-  return 0;
+  return status;
 }
 
-#undef tryCLI
-#undef tryREPL
+#undef tryRun
@@ -0,0 +1,389 @@
+#include "../lifp/virtual_machine.h"
+
+#include "utils.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const char SERVE[] = "serve";
+
+typedef struct {
+  size_t ast_memory;
+  size_t file_size;
+  const char *prelude;
+  const char *socket;
+} serve_opts_t;
+
+static constexpr uint32_t SERVE_PROTOCOL_VERSION = 1;
+static constexpr size_t MAX_REQUEST_FILENAME = 4096;
+// Standard input, output, and error of the client
+static constexpr size_t REQUEST_DESCRIPTORS = 3;
+
+// Sent by the client along with its standard streams, and followed by the
+// file name and the source to run. The server answers with the exit status.
+typedef struct {
+  uint32_t version;
+  uint32_t filename_size;
+  uint64_t source_size;
+} serve_request_t;
+
+typedef union {
+  struct cmsghdr header;
+  char buffer[CMSG_SPACE(sizeof(int) * REQUEST_DESCRIPTORS)];
+} serve_control_t;
+
+static volatile sig_atomic_t serving = 1;
+
+static void stopServing(int signal_number) {
+  (void)signal_number;
+  serving = 0;
+}
+
+static bool sendAll(int socket_descriptor, size_t size, const void *data) {
+  const char *cursor = data;
+  while (size > 0) {
+    ssize_t written = write(socket_descriptor, cursor, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    cursor += written;
+    size -= (size_t)written;
+  }
+  return true;
+}
+
+static bool receiveAll(int socket_descriptor, size_t size, void *data) {
+  char *cursor = data;
+  while (size > 0) {
+    ssize_t received = read(socket_descriptor, cursor, size);
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received <= 0)
+      return false;
+    cursor += received;
+    size -= (size_t)received;
+  }
+  return true;
+}
+
+static bool socketAddress(const char *path, struct sockaddr_un *address) {
+  if (strlen(path) >= sizeof(address->sun_path)) {
+    error("socket path '%s' is too long", path);
+    return false;
+  }
+
+  memset(address, 0, sizeof(struct sockaddr_un));
+  address->sun_family = AF_UNIX;
+  snprintf(address->sun_path, sizeof(address->sun_path), "%s", path);
+  return true;
+}
+
+// Closes the descriptors of every header, which are leaked otherwise when the
+// message is rejected
+static void closeReceived(struct msghdr *message) {
+  for (struct cmsghdr *header = CMSG_FIRSTHDR(message); header;
+       header = CMSG_NXTHDR(message, header)) {
+    if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+      continue;
+
+    const size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; i++) {
+      int descriptor = -1;
+      memcpy(&descriptor, CMSG_DATA(header) + sizeof(int) * i, sizeof(int));
+      close(descriptor);
+    }
+  }
+}
+
+static bool receiveRequest(int connection, serve_request_t *request,
+                           int descriptors[static REQUEST_DESCRIPTORS]) {
+  struct iovec vector = {.iov_base = request,
+                         .iov_len = sizeof(serve_request_t)};
+  serve_control_t control = {};
+  struct msghdr message = {
+      .msg_iov = &vector,
+      .msg_iovlen = 1,
+      .msg_control = control.buffer,
+      .msg_controllen = sizeof(control.buffer),
+  };
+
+  ssize_t received = recvmsg(connection, &message, 0);
+  if (received <= 0)
+    return false;
+
+  // Descriptors that did not fit are closed by the kernel, not the others
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  if ((message.msg_flags & MSG_CTRUNC) || !header ||
+      header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+      header->cmsg_len != CMSG_LEN(sizeof(int) * REQUEST_DESCRIPTORS) ||
+      CMSG_NXTHDR(&message, header)) {
+    closeReceived(&message);
+    return false;
+  }
+  memcpy(descriptors, CMSG_DATA(header), sizeof(int) * REQUEST_DESCRIPTORS);
+
+  // The descriptors travel with the first byte, the rest may come later
+  size_t remaining = sizeof(serve_request_t) - (size_t)received;
+  return receiveAll(connection, remaining, (char *)request + received);
+}
+
+static void closeDescriptors(int descriptors[static REQUEST_DESCRIPTORS]) {
+  for (size_t i = 0; i < REQUEST_DESCRIPTORS; i++) {
+    if (descriptors[i] >= 0)
+      close(descriptors[i]);
+    descriptors[i] = -1;
+  }
+}
+
+// Evaluates the request with the standard streams of the client. Definitions
+// land in a child of the global environment, which is dropped afterwards so
+// that requests do not leak into each other.
+static int32_t serveRequest(const serve_opts_t *OPTIONS, vm_t *machine,
+                            arena_t *ast_arena, char *file_buffer,
+                            char *statement_buffer, int connection,
+                            int descriptors[static REQUEST_DESCRIPTORS]) {
+  serve_request_t request = {};
+  if (!receiveRequest(connection, &request, descriptors))
+    return 1;
+
+  if (request.version != SERVE_PROTOCOL_VERSION ||
+      request.filename_size >= MAX_REQUEST_FILENAME ||
+      request.source_size == 0 || request.source_size > OPTIONS->file_size) {
+    return 1;
+  }
+
+  char filename[MAX_REQUEST_FILENAME] = {};
+  if (!receiveAll(connection, request.filename_size, filename) ||
+      !receiveAll(connection, request.source_size, file_buffer)) {
+    return 1;
+  }
+  file_buffer[request.source_size] = 0;
+
+  environment_t *environment = nullptr;
+  result_environment_ref_t created = environmentCreate(machine->global);
+  if (created.code != RESULT_OK)
+    return 1;
+  environment = created.value;
+
+  vmFlush();
+  fflush(stdout);
+  fflush(stderr);
+  int saved[REQUEST_DESCRIPTORS] = {dup(STDIN_FILENO), dup(STDOUT_FILENO),
+                                    dup(STDERR_FILENO)};
+  for (size_t i = 0; i < REQUEST_DESCRIPTORS; i++) {
+    dup2(descriptors[i], (int)i);
+  }
+
+  const run_opts_t run_options = {
+      .ast_memory = OPTIONS->ast_memory,
+      .file_size = OPTIONS->file_size,
+      .filename = filename,
+  };
+  image_writer_t *writer = nullptr;
+  int status = runSequential(&run_options, environment, ast_arena, &writer,
+                             (ssize_t)request.source_size, file_buffer,
+                             statement_buffer);
+  // Tasks spawned by the script might still be reading its definitions
+  vmWait(machine);
+  environmentForceDestroy(&environment);
+
+  vmFlush();
+  fflush(stdout);
+  fflush(stderr);
+  for (size_t i = 0; i < REQUEST_DESCRIPTORS; i++) {
+    dup2(saved[i], (int)i);
+  }
+  closeDescriptors(saved);
+
+  return status;
+}
+
+static int runPrelude(const serve_opts_t *OPTIONS, vm_t *machine,
+                      arena_t *ast_arena, char *statement_buffer) {
+  if (!OPTIONS->prelude)
+    return 0;
+
+  char *file_buffer = nullptr;
+  ssize_t file_length = 0;
+  if (readSource(OPTIONS->prelude, OPTIONS->file_size, &file_buffer,
+                 &file_length) != 0) {
+    return 1;
+  }
+
+  const run_opts_t run_options = {
+      .ast_memory = OPTIONS->ast_memory,
+      .file_size = OPTIONS->file_size,
+      .filename = OPTIONS->prelude,
+  };
+  image_writer_t *writer = nullptr;
+  int status = runSequential(&run_options, machine->global, ast_arena, &writer,
+                             file_length, file_buffer, statement_buffer);
+  deallocSafe(&file_buffer);
+  return status;
+}
+
+static int listenOn(const char *path) {
+  struct sockaddr_un address;
+  if (!socketAddress(path, &address))
+    return -1;
+
+  // Leftovers of a previous server are replaced, anything else is kept
+  struct stat info;
+  if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+    unlink(path);
+  }
+
+  int socket_descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket_descriptor < 0) {
+    error("cannot create socket");
+    return -1;
+  }
+
+  if (bind(socket_descriptor, (const struct sockaddr *)&address,
+           sizeof(struct sockaddr_un)) != 0 ||
+      listen(socket_descriptor, SOMAXCONN) != 0) {
+    error("cannot listen on '%s'", path);
+    close(socket_descriptor);
+    return -1;
+  }
+
+  return socket_descriptor;
+}
+
+int serve(const serve_opts_t OPTIONS) {
+  char *file_buffer = nullptr;
+  tryCLI(allocSafe(OPTIONS.file_size + 1), file_buffer,
+         "cannot allocate file buffer");
+  char *statement_buffer = nullptr;
+  tryCLI(allocSafe(OPTIONS.file_size), statement_buffer,
+         "cannot allocate file buffer");
+  arena_t *ast_arena = nullptr;
+  tryCLI(arenaCreate(OPTIONS.ast_memory), ast_arena,
+         "unable to allocate interpreter memory");
+  vm_t *machine = nullptr;
+  tryCLI(vmCreate(), machine, "unable to initialize virtual machine");
+
+  int status = runPrelude(&OPTIONS, machine, ast_arena, statement_buffer);
+  int socket_descriptor = -1;
+  if (status == 0) {
+    socket_descriptor = listenOn(OPTIONS.socket);
+    status = socket_descriptor < 0;
+  }
+
+  // No SA_RESTART: a signal must interrupt accept to stop the server
+  struct sigaction stop = {.sa_handler = stopServing};
+  sigemptyset(&stop.sa_mask);
+  sigaction(SIGINT, &stop, nullptr);
+  sigaction(SIGTERM, &stop, nullptr);
+  // Clients going away must not take the server down with them
+  signal(SIGPIPE, SIG_IGN);
+
+  while (status == 0 && serving) {
+    int connection = accept(socket_descriptor, nullptr, nullptr);
+    if (connection < 0)
+      continue;
+
+    int descriptors[REQUEST_DESCRIPTORS] = {-1, -1, -1};
+    int32_t response = serveRequest(&OPTIONS, machine, ast_arena, file_buffer,
+                                    statement_buffer, connection, descriptors);
+    sendAll(connection, sizeof(int32_t), &response);
+    closeDescriptors(descriptors);
+    close(connection);
+  }
+
+  if (socket_descriptor >= 0) {
+    close(socket_descriptor);
+    unlink(OPTIONS.socket);
+  }
+
+  vmDestroy(&machine);
+  arenaDestroy(&ast_arena);
+  deallocSafe(&statement_buffer);
+  deallocSafe(&file_buffer);
+  return status;
+}
+
+// Thin client: sends the script to a `lifp serve` instance, which runs it with
+// the standard streams of this process and reports back the exit status.
+int runRemote(const run_opts_t OPTIONS) {
+  struct sockaddr_un address;
+  if (!socketAddress(OPTIONS.connect, &address))
+    return 1;
+
+  size_t filename_size = strlen(OPTIONS.filename);
+  if (filename_size >= MAX_REQUEST_FILENAME) {
+    error("file name '%s' is too long", OPTIONS.filename);
+    return 1;
+  }
+
+  char *file_buffer = nullptr;
+  ssize_t file_length = 0;
+  if (readSource(OPTIONS.filename, OPTIONS.file_size, &file_buffer,
+                 &file_length) != 0) {
+    return 1;
+  }
+
+  int socket_descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket_descriptor < 0 ||
+      connect(socket_descriptor, (const struct sockaddr *)&address,
+              sizeof(struct sockaddr_un)) != 0) {
+    error("cannot connect to '%s'", OPTIONS.connect);
+    if (socket_descriptor >= 0)
+      close(socket_descriptor);
+    deallocSafe(&file_buffer);
+    return 1;
+  }
+
+  serve_request_t request = {
+      .version = SERVE_PROTOCOL_VERSION,
+      .filename_size = (uint32_t)filename_size,
+      .source_size = (uint64_t)file_length,
+  };
+  int descriptors[REQUEST_DESCRIPTORS] = {STDIN_FILENO, STDOUT_FILENO,
+                                          STDERR_FILENO};
+
+  struct iovec vector = {.iov_base = &request,
+                         .iov_len = sizeof(serve_request_t)};
+  serve_control_t control = {};
+  struct msghdr message = {
+      .msg_iov = &vector,
+      .msg_iovlen = 1,
+      .msg_control = control.buffer,
+      .msg_controllen = sizeof(control.buffer),
+  };
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(descriptors));
+  memcpy(CMSG_DATA(header), descriptors, sizeof(descriptors));
+
+  fflush(stdout);
+  fflush(stderr);
+  ssize_t sent = sendmsg(socket_descriptor, &message, 0);
+  int32_t response = 1;
+  bool completed =
+      sent > 0 &&
+      sendAll(socket_descriptor, sizeof(serve_request_t) - (size_t)sent,
+              (const char *)&request + sent) &&
+      sendAll(socket_descriptor, filename_size, OPTIONS.filename) &&
+      sendAll(socket_descriptor, (size_t)file_length, file_buffer) &&
+      receiveAll(socket_descriptor, sizeof(int32_t), &response);
+
+  close(socket_descriptor);
+  deallocSafe(&file_buffer);
+
+  if (!completed) {
+    error("connection to '%s' was interrupted", OPTIONS.connect);
+    return 1;
+  }
+  return response;
+}
@@ -40,7 +40,7 @@ COMMON_CFLAGS := -std=c23 \
 	-Wno-ignored-qualifiers \
 	-Wno-aggregate-return
 
-LDFLAGS = -lm
+LDFLAGS = -lm -pthread
 
 # Platform-specific flags
 ifeq ($(UNAME_S),Darwin)
@@ -1,6 +1,7 @@
 #include "arena.h"
 #include "alloc.h"
 #include "result.h"
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,8 +35,8 @@ result_ref_t arenaCreate(size_t size) {
   arena->size = size;
   arena->offset = 0;
 #ifdef DEBUG
-  static int id = 0;
-  arena->id = id++;
+  static atomic_int id = 0;
+  arena->id = atomic_fetch_add(&id, 1);
 #endif
 
   arenaProfileStart(arena);
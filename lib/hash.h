@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr uint64_t HASH_SEED = 14695981039346656037U;
+
+// FNV-1a. Hashes can be chained by passing the result of a previous call as
+// seed of the next one.
+static inline uint64_t hashBytes(uint64_t seed, size_t len,
+                                 const char key[static len]) {
+  uint64_t hash = seed;
+  const uint64_t prime = 1099511628211U;
+
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint64_t)(unsigned char)key[i];
+    hash *= prime;
+  }
+
+  return hash;
+}
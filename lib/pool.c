@@ -0,0 +1,753 @@
+#define _POSIX_C_SOURCE 200809L
+#include "pool.h"
+#include "alloc.h"
+#include "result.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static constexpr size_t INITIAL_DEQUE_CAPACITY = 64;
+static constexpr size_t INITIAL_POLLED_CAPACITY = 16;
+
+// Worker running on the current thread, if any
+static thread_local const pool_worker_t *current_worker = nullptr;
+// Pool whose jobs run on the current thread: workers, spares, and waiters
+static thread_local pool_t *current_pool = nullptr;
+
+static bool dequePush(pool_deque_t *self, pool_job_t job) {
+  pthread_mutex_lock(&self->lock);
+
+  if (self->count == self->capacity) {
+    size_t capacity =
+        self->capacity ? self->capacity * 2 : INITIAL_DEQUE_CAPACITY;
+    result_ref_t allocation = allocSafe(sizeof(pool_job_t) * capacity);
+    if (allocation.code != RESULT_OK) {
+      pthread_mutex_unlock(&self->lock);
+      return false;
+    }
+
+    pool_job_t *jobs = allocation.value;
+    for (size_t i = 0; i < self->count; i++) {
+      jobs[i] = self->jobs[(self->head + i) % self->capacity];
+    }
+    deallocSafe(&self->jobs);
+    self->jobs = jobs;
+    self->capacity = capacity;
+    self->head = 0;
+  }
+
+  self->jobs[(self->head + self->count) % self->capacity] = job;
+  self->count++;
+  pthread_mutex_unlock(&self->lock);
+  return true;
+}
+
+// The owner takes its newest job, which is the most likely to be in cache
+static bool dequePopBack(pool_deque_t *self, pool_job_t *job) {
+  pthread_mutex_lock(&self->lock);
+  bool found = self->count > 0;
+  if (found) {
+    self->count--;
+    *job = self->jobs[(self->head + self->count) % self->capacity];
+  }
+  pthread_mutex_unlock(&self->lock);
+  return found;
+}
+
+// Thieves take the oldest job, which usually stands for the most work
+static bool dequePopFront(pool_deque_t *self, pool_job_t *job) {
+  pthread_mutex_lock(&self->lock);
+  bool found = self->count > 0;
+  if (found) {
+    *job = self->jobs[self->head];
+    self->head = (self->head + 1) % self->capacity;
+    self->count--;
+  }
+  pthread_mutex_unlock(&self->lock);
+  return found;
+}
+
+static bool poolTake(pool_t *self, pool_job_t *job) {
+  if (atomic_load(&self->queued) == 0)
+    return false;
+
+  const size_t running = atomic_load(&self->running);
+  size_t own = running;
+  if (current_worker && current_worker->pool == self) {
+    own = current_worker->index;
+    if (dequePopBack(&self->deques[own], job)) {
+      atomic_fetch_sub(&self->queued, 1);
+      return true;
+    }
+  }
+
+  size_t start = own < running ? own + 1 : atomic_load(&self->next);
+  for (size_t i = 0; i < running; i++) {
+    size_t victim = (start + i) % running;
+    if (victim != own && dequePopFront(&self->deques[victim], job)) {
+      atomic_fetch_sub(&self->queued, 1);
+      return true;
+    }
+  }
+
+  // Due timers are shared by all the threads, including the waiting ones
+  if (dequePopFront(&self->deques[self->workers_count], job)) {
+    atomic_fetch_sub(&self->queued, 1);
+    return true;
+  }
+
+  return false;
+}
+
+static void poolRun(pool_t *self, pool_job_t job) {
+  job.task(job.argument);
+
+  // A completed group can be released by its waiter right away, hence its
+  // parent is read first
+  bool completed = false;
+  for (pool_group_t *group = job.group; group;) {
+    pool_group_t *parent = group->parent;
+    completed = atomic_fetch_sub(&group->pending, 1) == 1 || completed;
+    group = parent;
+  }
+
+  if (completed) {
+    pthread_mutex_lock(&self->lock);
+    pthread_cond_broadcast(&self->wake);
+    pthread_mutex_unlock(&self->lock);
+  }
+}
+
+static void poolPend(pool_group_t *group) {
+  for (; group; group = group->parent) {
+    atomic_fetch_add(&group->pending, 1);
+  }
+}
+
+static void *poolWorker(void *argument) {
+  const pool_worker_t *worker = argument;
+  pool_t *self = worker->pool;
+  current_worker = worker;
+  current_pool = self;
+
+  while (true) {
+    pool_job_t job;
+    if (poolTake(self, &job)) {
+      poolRun(self, job);
+      continue;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    while (!atomic_load(&self->stopping) && atomic_load(&self->queued) == 0) {
+      pthread_cond_wait(&self->wake, &self->lock);
+    }
+    const bool stopping = atomic_load(&self->stopping);
+    pthread_mutex_unlock(&self->lock);
+
+    if (stopping)
+      return nullptr;
+  }
+}
+
+// Spare workers own no deque: they steal like waiting threads do, and stop
+// once idle and outnumbering the blocked threads
+static void *poolSpare(void *argument) {
+  pool_t *self = argument;
+  current_pool = self;
+
+  while (true) {
+    pool_job_t job;
+    if (poolTake(self, &job)) {
+      poolRun(self, job);
+      continue;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    while (!atomic_load(&self->stopping) && atomic_load(&self->queued) == 0 &&
+           atomic_load(&self->spares) <= atomic_load(&self->blocked)) {
+      pthread_cond_wait(&self->wake, &self->lock);
+    }
+    if (atomic_load(&self->stopping) ||
+        (atomic_load(&self->queued) == 0 &&
+         atomic_load(&self->spares) > atomic_load(&self->blocked))) {
+      atomic_fetch_sub(&self->spares, 1);
+      pthread_cond_broadcast(&self->wake);
+      pthread_mutex_unlock(&self->lock);
+      return nullptr;
+    }
+    pthread_mutex_unlock(&self->lock);
+  }
+}
+
+// Starts the workers in the current process. A child process forked from a
+// process with an idle pool inherits no thread and unlocked primitives, which
+// are initialized again before starting new workers.
+static bool poolStart(pool_t *self) {
+  const int pid = getpid();
+  const int started_pid = atomic_load(&self->started_pid);
+  if (started_pid == pid)
+    return atomic_load(&self->running) > 0;
+
+  if (started_pid != 0) {
+    pthread_mutex_init(&self->lock, nullptr);
+    pthread_cond_init(&self->wake, nullptr);
+    for (size_t i = 0; i <= self->workers_count; i++) {
+      pthread_mutex_init(&self->deques[i].lock, nullptr);
+    }
+  }
+
+  pthread_mutex_lock(&self->lock);
+  if (atomic_load(&self->started_pid) != pid) {
+    atomic_store(&self->running, 0);
+    atomic_store(&self->blocked, 0);
+    atomic_store(&self->spares, 0);
+    for (size_t i = 0; i < self->workers_count; i++) {
+      pool_worker_t *worker = &self->workers[i];
+      worker->pool = self;
+      worker->index = i;
+      if (pthread_create(&worker->thread, nullptr, poolWorker, worker) != 0)
+        break;
+      atomic_fetch_add(&self->running, 1);
+    }
+    atomic_store(&self->started_pid, pid);
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  return atomic_load(&self->running) > 0;
+}
+
+// Wakes the reactor thread up, so that it polls new watches or stops. A full
+// pipe already has a wake up pending.
+static void poolInterrupt(pool_t *self) {
+  const char byte = 0;
+  while (write(self->reactor.wake[1], &byte, 1) < 0 && errno == EINTR) {
+  }
+}
+
+result_ref_t poolCreate(size_t workers) {
+  pool_t *pool = nullptr;
+  try(result_ref_t, allocSafe(sizeof(pool_t)), pool);
+  pool->workers_count = workers;
+
+  tryCatch(result_ref_t, allocSafe(sizeof(pool_worker_t) * (workers + 1)),
+           deallocSafe(&pool), pool->workers);
+  tryCatch(
+      result_ref_t, allocSafe(sizeof(pool_deque_t) * (workers + 1)),
+      {
+        deallocSafe(&pool->workers);
+        deallocSafe(&pool);
+      },
+      pool->deques);
+
+  for (size_t i = 0; i <= workers; i++) {
+    pthread_mutex_init(&pool->deques[i].lock, nullptr);
+  }
+  pthread_mutex_init(&pool->lock, nullptr);
+  pthread_cond_init(&pool->wake, nullptr);
+  pthread_mutex_init(&pool->wheel.lock, nullptr);
+  pthread_cond_init(&pool->wheel.wake, nullptr);
+  pthread_mutex_init(&pool->reactor.lock, nullptr);
+  pool->reactor.wake[0] = -1;
+  pool->reactor.wake[1] = -1;
+
+  return ok(result_ref_t, pool);
+}
+
+void poolDestroy(pool_t **self) {
+  if (!self || !*self)
+    return;
+
+  pool_t *pool = *self;
+  if (atomic_load(&pool->started_pid) == getpid()) {
+    pthread_mutex_lock(&pool->lock);
+    atomic_store(&pool->stopping, true);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < atomic_load(&pool->running); i++) {
+      pthread_join(pool->workers[i].thread, nullptr);
+    }
+
+    // Spares are detached, and announce that they stopped instead
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->spares) > 0) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  if (atomic_load(&pool->wheel.started_pid) == getpid()) {
+    pthread_mutex_lock(&pool->wheel.lock);
+    atomic_store(&pool->stopping, true);
+    pthread_cond_signal(&pool->wheel.wake);
+    pthread_mutex_unlock(&pool->wheel.lock);
+    pthread_join(pool->wheel.thread, nullptr);
+  }
+
+  pool_reactor_t *reactor = &pool->reactor;
+  if (atomic_load(&reactor->started_pid) == getpid()) {
+    atomic_store(&pool->stopping, true);
+    poolInterrupt(pool);
+    pthread_join(reactor->thread, nullptr);
+  }
+
+  while (reactor->watches) {
+    pool_watch_t *watch = reactor->watches;
+    reactor->watches = watch->next;
+    deallocSafe(&watch);
+  }
+  for (size_t i = 0; i < 2; i++) {
+    if (reactor->wake[i] >= 0)
+      close(reactor->wake[i]);
+  }
+  deallocSafe(&reactor->polled);
+  deallocSafe(&reactor->polling);
+
+  for (size_t i = 0; i < POOL_WHEEL_SLOTS; i++) {
+    while (pool->wheel.slots[i]) {
+      pool_timer_t *timer = pool->wheel.slots[i];
+      pool->wheel.slots[i] = timer->next;
+      deallocSafe(&timer);
+    }
+  }
+
+  for (size_t i = 0; i <= pool->workers_count; i++) {
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    deallocSafe(&pool->deques[i].jobs);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->wheel.lock);
+  pthread_cond_destroy(&pool->wheel.wake);
+  pthread_mutex_destroy(&pool->reactor.lock);
+
+  deallocSafe(&pool->deques);
+  deallocSafe(&pool->workers);
+  deallocSafe(self);
+}
+
+static void poolEnqueue(pool_t *self, pool_job_t job) {
+  if (!poolStart(self)) {
+    poolRun(self, job);
+    return;
+  }
+
+  size_t index = current_worker && current_worker->pool == self
+                     ? current_worker->index
+                     : atomic_fetch_add(&self->next, 1) %
+                           atomic_load(&self->running);
+
+  // Counted before being visible, so that no worker goes to sleep with a job
+  // left in a deque
+  atomic_fetch_add(&self->queued, 1);
+  if (!dequePush(&self->deques[index], job)) {
+    atomic_fetch_sub(&self->queued, 1);
+    poolRun(self, job);
+    return;
+  }
+
+  pthread_mutex_lock(&self->lock);
+  pthread_cond_signal(&self->wake);
+  pthread_mutex_unlock(&self->lock);
+}
+
+void poolSubmit(pool_t *self, pool_group_t *group, pool_task_t task,
+                void *argument) {
+  poolPend(group);
+  poolEnqueue(self, (pool_job_t){
+                        .task = task,
+                        .argument = argument,
+                        .group = group,
+                    });
+}
+
+static uint64_t poolNow(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+// Moves a due job to the deque shared by all threads. Its group is already
+// pending, so it is pushed directly rather than submitted.
+static void poolRelease(pool_t *self, pool_job_t job) {
+  atomic_fetch_add(&self->queued, 1);
+  if (!dequePush(&self->deques[self->workers_count], job)) {
+    atomic_fetch_sub(&self->queued, 1);
+    poolRun(self, job);
+  }
+}
+
+static void poolWakeAll(pool_t *self) {
+  pthread_mutex_lock(&self->lock);
+  pthread_cond_broadcast(&self->wake);
+  pthread_mutex_unlock(&self->lock);
+}
+
+static void *poolTimer(void *argument) {
+  pool_t *self = argument;
+  pool_wheel_t *wheel = &self->wheel;
+
+  pthread_mutex_lock(&wheel->lock);
+  while (!atomic_load(&self->stopping)) {
+    const uint64_t now = poolNow();
+
+    // Slots are visited once per tick elapsed since the last visit, and at
+    // most once per revolution after a long sleep
+    pool_timer_t *due = nullptr;
+    for (size_t i = 0; i < POOL_WHEEL_SLOTS && wheel->tick <= now; i++) {
+      pool_timer_t **link = &wheel->slots[wheel->tick % POOL_WHEEL_SLOTS];
+      while (*link) {
+        pool_timer_t *timer = *link;
+        if (timer->deadline > now) {
+          link = &timer->next;
+          continue;
+        }
+        *link = timer->next;
+        timer->next = due;
+        due = timer;
+        wheel->count--;
+      }
+      wheel->tick++;
+    }
+    if (wheel->tick <= now)
+      wheel->tick = now + 1;
+
+    if (due) {
+      pthread_mutex_unlock(&wheel->lock);
+      while (due) {
+        pool_timer_t *timer = due;
+        due = timer->next;
+        poolRelease(self, timer->job);
+        deallocSafe(&timer);
+      }
+      poolWakeAll(self);
+      pthread_mutex_lock(&wheel->lock);
+      continue;
+    }
+
+    if (wheel->count == 0) {
+      pthread_cond_wait(&wheel->wake, &wheel->lock);
+      continue;
+    }
+
+    // Sleeps until the next slot holding a timer, which might be due in a
+    // later round, in which case the slot is just visited again
+    uint64_t next = wheel->tick;
+    while (!wheel->slots[next % POOL_WHEEL_SLOTS] &&
+           next < wheel->tick + POOL_WHEEL_SLOTS) {
+      next++;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    const uint64_t delay = next - now;
+    deadline.tv_sec += (time_t)(delay / 1000);
+    deadline.tv_nsec += (long)(delay % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&wheel->wake, &wheel->lock, &deadline);
+  }
+  pthread_mutex_unlock(&wheel->lock);
+
+  return nullptr;
+}
+
+// Starts the timer thread in the current process, like poolStart does for
+// the workers
+static bool poolStartTimer(pool_t *self) {
+  const int pid = getpid();
+  const int started_pid = atomic_load(&self->wheel.started_pid);
+  if (started_pid == pid)
+    return true;
+
+  if (started_pid != 0) {
+    pthread_mutex_init(&self->wheel.lock, nullptr);
+    pthread_cond_init(&self->wheel.wake, nullptr);
+  }
+
+  pthread_mutex_lock(&self->wheel.lock);
+  bool started = atomic_load(&self->wheel.started_pid) == pid;
+  if (!started) {
+    started =
+        pthread_create(&self->wheel.thread, nullptr, poolTimer, self) == 0;
+    if (started)
+      atomic_store(&self->wheel.started_pid, pid);
+  }
+  pthread_mutex_unlock(&self->wheel.lock);
+
+  return started;
+}
+
+void poolSchedule(pool_t *self, pool_group_t *group, uint64_t delay,
+                  pool_task_t task, void *argument) {
+  pool_job_t job = {.task = task, .argument = argument, .group = group};
+  poolPend(group);
+
+  // Workers are started as well, so that the deque of due timers is ready
+  poolStart(self);
+  if (delay == 0 || !poolStartTimer(self)) {
+    poolEnqueue(self, job);
+    return;
+  }
+
+  result_ref_t allocation = allocSafe(sizeof(pool_timer_t));
+  if (allocation.code != RESULT_OK) {
+    poolEnqueue(self, job);
+    return;
+  }
+
+  pool_timer_t *timer = allocation.value;
+  timer->job = job;
+
+  pool_wheel_t *wheel = &self->wheel;
+  pthread_mutex_lock(&wheel->lock);
+  const uint64_t now = poolNow();
+  if (wheel->count == 0)
+    wheel->tick = now;
+
+  timer->deadline = now + delay;
+  pool_timer_t **slot = &wheel->slots[timer->deadline % POOL_WHEEL_SLOTS];
+  timer->next = *slot;
+  *slot = timer;
+  wheel->count++;
+
+  pthread_cond_signal(&wheel->wake);
+  pthread_mutex_unlock(&wheel->lock);
+}
+
+static void *poolReactor(void *argument) {
+  pool_t *self = argument;
+  pool_reactor_t *reactor = &self->reactor;
+
+  while (!atomic_load(&self->stopping)) {
+    pthread_mutex_lock(&reactor->lock);
+    if (reactor->count + 1 > reactor->capacity) {
+      const size_t capacity = reactor->capacity * 2 > reactor->count + 1
+                                  ? reactor->capacity * 2
+                                  : reactor->count + 1;
+      result_ref_t polled = allocSafe(sizeof(struct pollfd) * capacity);
+      result_ref_t polling = allocSafe(sizeof(pool_watch_t *) * capacity);
+      if (polled.code == RESULT_OK && polling.code == RESULT_OK) {
+        deallocSafe(&reactor->polled);
+        deallocSafe(&reactor->polling);
+        reactor->polled = polled.value;
+        reactor->polling = polling.value;
+        reactor->capacity = capacity;
+      } else {
+        // Watches not fitting are polled once others are released
+        deallocSafe(&polled.value);
+        deallocSafe(&polling.value);
+      }
+    }
+
+    reactor->polled[0] =
+        (struct pollfd){.fd = reactor->wake[0], .events = POLLIN};
+    nfds_t count = 1;
+    for (pool_watch_t *watch = reactor->watches;
+         watch && count < reactor->capacity; watch = watch->next) {
+      reactor->polled[count] =
+          (struct pollfd){.fd = watch->fd, .events = watch->events};
+      reactor->polling[count - 1] = watch;
+      count++;
+    }
+    pthread_mutex_unlock(&reactor->lock);
+
+    if (poll(reactor->polled, count, -1) < 0)
+      continue;
+
+    if (reactor->polled[0].revents) {
+      char bytes[64];
+      while (read(reactor->wake[0], bytes, sizeof(bytes)) > 0) {
+      }
+    }
+
+    bool any = false;
+    for (nfds_t i = 1; i < count; i++) {
+      if (reactor->polled[i].revents) {
+        reactor->polling[i - 1]->ready = true;
+        any = true;
+      }
+    }
+    if (!any)
+      continue;
+
+    // Only this thread removes watches, so the polled ones are still listed
+    pool_watch_t *ready = nullptr;
+    pthread_mutex_lock(&reactor->lock);
+    pool_watch_t **link = &reactor->watches;
+    while (*link) {
+      pool_watch_t *watch = *link;
+      if (!watch->ready) {
+        link = &watch->next;
+        continue;
+      }
+      *link = watch->next;
+      watch->next = ready;
+      ready = watch;
+      reactor->count--;
+    }
+    pthread_mutex_unlock(&reactor->lock);
+
+    while (ready) {
+      pool_watch_t *watch = ready;
+      ready = watch->next;
+      poolRelease(self, watch->job);
+      deallocSafe(&watch);
+    }
+    poolWakeAll(self);
+  }
+
+  return nullptr;
+}
+
+// Starts the reactor thread in the current process, like poolStart does for
+// the workers. A child process gets a pipe of its own, as waking up the
+// reactor thread of its parent would be of no use.
+static bool poolStartReactor(pool_t *self) {
+  pool_reactor_t *reactor = &self->reactor;
+  const int pid = getpid();
+  const int started_pid = atomic_load(&reactor->started_pid);
+  if (started_pid == pid)
+    return true;
+
+  if (started_pid != 0) {
+    pthread_mutex_init(&reactor->lock, nullptr);
+  }
+
+  pthread_mutex_lock(&reactor->lock);
+  bool started = atomic_load(&reactor->started_pid) == pid;
+  if (!started && reactor->capacity == 0) {
+    result_ref_t polled =
+        allocSafe(sizeof(struct pollfd) * INITIAL_POLLED_CAPACITY);
+    result_ref_t polling =
+        allocSafe(sizeof(pool_watch_t *) * INITIAL_POLLED_CAPACITY);
+    if (polled.code == RESULT_OK && polling.code == RESULT_OK) {
+      reactor->polled = polled.value;
+      reactor->polling = polling.value;
+      reactor->capacity = INITIAL_POLLED_CAPACITY;
+    } else {
+      deallocSafe(&polled.value);
+      deallocSafe(&polling.value);
+    }
+  }
+
+  if (!started && reactor->capacity > 0) {
+    for (size_t i = 0; i < 2; i++) {
+      if (reactor->wake[i] >= 0)
+        close(reactor->wake[i]);
+      reactor->wake[i] = -1;
+    }
+
+    if (pipe(reactor->wake) == 0) {
+      for (size_t i = 0; i < 2; i++) {
+        fcntl(reactor->wake[i], F_SETFL, O_NONBLOCK);
+        fcntl(reactor->wake[i], F_SETFD, FD_CLOEXEC);
+      }
+      started =
+          pthread_create(&reactor->thread, nullptr, poolReactor, self) == 0;
+    }
+    if (started)
+      atomic_store(&reactor->started_pid, pid);
+  }
+  pthread_mutex_unlock(&reactor->lock);
+
+  return started;
+}
+
+void poolWatch(pool_t *self, pool_group_t *group, int fd, short events,
+               pool_task_t task, void *argument) {
+  pool_job_t job = {.task = task, .argument = argument, .group = group};
+  poolPend(group);
+
+  // Workers are started as well, so that the deque of ready jobs is ready
+  poolStart(self);
+  if (!poolStartReactor(self)) {
+    poolEnqueue(self, job);
+    return;
+  }
+
+  result_ref_t allocation = allocSafe(sizeof(pool_watch_t));
+  if (allocation.code != RESULT_OK) {
+    poolEnqueue(self, job);
+    return;
+  }
+
+  pool_watch_t *watch = allocation.value;
+  watch->job = job;
+  watch->fd = fd;
+  watch->events = events;
+
+  pool_reactor_t *reactor = &self->reactor;
+  pthread_mutex_lock(&reactor->lock);
+  watch->next = reactor->watches;
+  reactor->watches = watch;
+  reactor->count++;
+  pthread_mutex_unlock(&reactor->lock);
+
+  poolInterrupt(self);
+}
+
+void poolWait(pool_t *self, pool_group_t *group) {
+  pool_t *previous_pool = current_pool;
+  current_pool = self;
+
+  while (atomic_load(&group->pending) > 0) {
+    pool_job_t job;
+    if (poolTake(self, &job)) {
+      poolRun(self, job);
+      continue;
+    }
+
+    pthread_mutex_lock(&self->lock);
+    while (atomic_load(&group->pending) > 0 &&
+           atomic_load(&self->queued) == 0) {
+      pthread_cond_wait(&self->wake, &self->lock);
+    }
+    pthread_mutex_unlock(&self->lock);
+  }
+
+  current_pool = previous_pool;
+}
+
+pool_t *poolBlock(void) {
+  pool_t *self = current_pool;
+  if (!self || atomic_load(&self->started_pid) != getpid())
+    return nullptr;
+
+  pthread_mutex_lock(&self->lock);
+  const size_t blocked = atomic_fetch_add(&self->blocked, 1) + 1;
+  if (!atomic_load(&self->stopping) && atomic_load(&self->spares) < blocked) {
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    // Without a spare, the thread blocks as it would have anyway
+    if (pthread_create(&thread, &attributes, poolSpare, self) == 0) {
+      atomic_fetch_add(&self->spares, 1);
+    }
+    pthread_attr_destroy(&attributes);
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  return self;
+}
+
+void poolUnblock(pool_t *self) {
+  if (!self)
+    return;
+
+  pthread_mutex_lock(&self->lock);
+  atomic_fetch_sub(&self->blocked, 1);
+  pthread_cond_broadcast(&self->wake);
+  pthread_mutex_unlock(&self->lock);
+}
+
+size_t poolConcurrency(const pool_t *self) { return self->workers_count + 1; }
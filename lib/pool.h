@@ -0,0 +1,253 @@
+// Pool (v0.0.1)
+// ---
+//
+// Work-stealing thread pool.
+//
+// Every worker owns a deque of jobs: it pushes and pops jobs at the back of
+// its own deque and, when it runs out of work, steals from the front of the
+// deque of another worker. Jobs are submitted as part of a group, and the
+// thread waiting for a group runs queued jobs instead of blocking, so groups
+// can be waited on from within jobs (e.g., nested parallel loops).
+//
+// Jobs can also be scheduled after a delay. Delayed jobs are parked on a
+// timer wheel, driven by a single timer thread, and queued once due: no worker
+// is blocked while they wait. Likewise, jobs can wait for a file descriptor to
+// be ready: a single reactor thread polls all the watched descriptors, and
+// queues their jobs once they can be read or written without blocking.
+//
+// Jobs blocking their thread on something other than the pool (e.g., a
+// channel) can say so: a spare worker runs queued jobs meanwhile, so that the
+// jobs they are waiting for are not starved, and stops once it is not needed.
+//
+// Worker threads are started on the first submission, and started again in
+// a child process that inherits an idle pool through fork.
+//
+// ```c
+// result_ref_t result = poolCreate(4);
+// if (result.ok) {
+//     pool_t *pool = result.value;
+//
+//     pool_group_t group = {};
+//     for (size_t i = 0; i < count; i++) {
+//         poolSubmit(pool, &group, square, &numbers[i]);
+//     }
+//     poolWait(pool, &group);
+//
+//     poolDestroy(&pool);
+// }
+// ```
+
+#pragma once
+
+#include "alloc.h"
+#include "result.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Slots of the timer wheel, one per millisecond. Delays longer than a
+// revolution stay in their slot for more rounds.
+static constexpr size_t POOL_WHEEL_SLOTS = 256;
+
+typedef void (*pool_task_t)(void *);
+
+/**
+ * Set of jobs waited on together. Zero-initialize before the first use.
+ * A group can be nested in a parent group, which is pending as long as any
+ * job of its children is.
+ * @name pool_group_t
+ */
+typedef struct pool_group_t {
+  atomic_size_t pending; // Jobs submitted and not yet completed
+  struct pool_group_t *parent;
+} pool_group_t;
+
+typedef struct {
+  pool_task_t task;
+  void *argument;
+  pool_group_t *group;
+} pool_job_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  size_t head;     // Index of the oldest job, taken by thieves
+  size_t count;    // Amount of queued jobs
+  size_t capacity; // Size of the ring of jobs
+  pool_job_t *jobs;
+} pool_deque_t;
+
+typedef struct pool_timer_t {
+  pool_job_t job;
+  uint64_t deadline; // Tick the job is due at
+  struct pool_timer_t *next;
+} pool_timer_t;
+
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;   // Signals new timers and the destruction of the pool
+  pool_timer_t *slots[POOL_WHEEL_SLOTS];
+  uint64_t tick;         // Next tick to be processed
+  size_t count;          // Timers in all the slots
+  atomic_int started_pid; // Process the timer thread was started in
+} pool_wheel_t;
+
+typedef struct pool_watch_t {
+  pool_job_t job;
+  int fd;
+  short events; // POLLIN, POLLOUT, or both
+  bool ready;   // Set by the reactor thread once polled
+  struct pool_watch_t *next;
+} pool_watch_t;
+
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  int wake[2];            // Pipe interrupting poll on new watches
+  pool_watch_t *watches;
+  size_t count;           // Watches in the list
+  struct pollfd *polled;  // Descriptors polled by the reactor thread
+  pool_watch_t **polling; // Watch of every polled descriptor but the pipe
+  size_t capacity;        // Size of polled and polling
+  atomic_int started_pid; // Process the reactor thread was started in
+} pool_reactor_t;
+
+typedef struct pool_t pool_t;
+
+typedef struct {
+  pthread_t thread;
+  pool_t *pool;
+  size_t index; // Index of the deque owned by the worker
+} pool_worker_t;
+
+/**
+ * Thread pool structure.
+ * @name pool_t
+ */
+typedef struct pool_t {
+  size_t workers_count;   // Workers requested at creation
+  atomic_size_t running;  // Workers actually started
+  pool_worker_t *workers;
+  pool_deque_t *deques;   // One per worker, plus one for due jobs
+  atomic_size_t queued;   // Jobs in all the deques
+  atomic_size_t next;     // Round robin for submissions from other threads
+  atomic_bool stopping;   // Set when the pool is destroyed
+  atomic_int started_pid; // Process the workers were started in
+  atomic_size_t blocked;  // Threads of the pool blocked outside of it
+  atomic_size_t spares;   // Workers started in place of blocked threads
+  pthread_mutex_t lock;   // Guards starting, sleeping and waking up
+  pthread_cond_t wake;    // Signals new jobs and completed groups
+  pool_wheel_t wheel;     // Jobs scheduled after a delay
+  pool_reactor_t reactor; // Jobs waiting for file descriptors
+} pool_t;
+
+/**
+ * Create a thread pool. No thread is started until a job is submitted.
+ * @name poolCreate
+ * @param {size_t} workers - Number of worker threads
+ * @returns {result_ref_t} Result containing the pool on success, or error on
+ * allocation failure
+ * @example
+ *   result_ref_t result = poolCreate(4);
+ */
+result_ref_t poolCreate(size_t workers);
+
+/**
+ * Stop the workers and free the pool. Queued jobs must have been waited on.
+ * @name poolDestroy
+ * @param {pool_t**} pool - Pointer to the pool, set to null
+ * @example
+ *   poolDestroy(&pool);
+ */
+void poolDestroy(pool_t **);
+
+/**
+ * Queue a job in the pool. When the job cannot be queued (e.g., on allocation
+ * failure) it runs right away on the calling thread.
+ * @name poolSubmit
+ * @param {pool_t*} pool - The pool
+ * @param {pool_group_t*} group - Group the job belongs to
+ * @param {pool_task_t} task - Function to run
+ * @param {void*} argument - Argument passed to the function
+ * @example
+ *   poolSubmit(pool, &group, square, &numbers[i]);
+ */
+void poolSubmit(pool_t *, pool_group_t *, pool_task_t, void *);
+
+/**
+ * Queue a job in the pool once a delay has elapsed. The job counts as pending
+ * in its group from the moment it is scheduled. When the timer thread cannot
+ * be started, the job is queued right away.
+ * @name poolSchedule
+ * @param {pool_t*} pool - The pool
+ * @param {pool_group_t*} group - Group the job belongs to
+ * @param {uint64_t} delay - Milliseconds before the job is queued
+ * @param {pool_task_t} task - Function to run
+ * @param {void*} argument - Argument passed to the function
+ * @example
+ *   poolSchedule(pool, &group, 100, ping, &socket);
+ */
+void poolSchedule(pool_t *, pool_group_t *, uint64_t delay, pool_task_t,
+                  void *);
+
+/**
+ * Queue a job in the pool once a file descriptor is ready. The job counts as
+ * pending in its group from the moment it is watched, and runs once: jobs
+ * reading or writing in several steps watch the descriptor again. When the
+ * reactor thread cannot be started, the job is queued right away.
+ * @name poolWatch
+ * @param {pool_t*} pool - The pool
+ * @param {pool_group_t*} group - Group the job belongs to
+ * @param {int} fd - The file descriptor, ready on errors and hang ups too
+ * @param {short} events - POLLIN to wait for input, POLLOUT for output
+ * @param {pool_task_t} task - Function to run
+ * @param {void*} argument - Argument passed to the function
+ * @example
+ *   poolWatch(pool, &group, fd, POLLIN, readChunk, &stream);
+ */
+void poolWatch(pool_t *, pool_group_t *, int fd, short events, pool_task_t,
+               void *);
+
+/**
+ * Wait for all the jobs of a group, running queued jobs meanwhile.
+ * @name poolWait
+ * @param {pool_t*} pool - The pool
+ * @param {pool_group_t*} group - The group to wait for
+ * @example
+ *   poolWait(pool, &group);
+ */
+void poolWait(pool_t *, pool_group_t *);
+
+/**
+ * Mark the current thread as blocked until poolUnblock. When the thread runs
+ * jobs of a pool, as a worker or while waiting for a group, a spare worker is
+ * started unless enough of them are idle already.
+ * @name poolBlock
+ * @returns {pool_t*} The pool of the thread, or null if it runs no jobs
+ * @example
+ *   pool_t *pool = poolBlock();
+ *   while (!queuePop(queue, &number)) { ... }
+ *   poolUnblock(pool);
+ */
+pool_t *poolBlock(void);
+
+/**
+ * Mark the current thread as running again. Spare workers exceeding the
+ * blocked threads stop once idle.
+ * @name poolUnblock
+ * @param {pool_t*} pool - The pool returned by poolBlock, possibly null
+ * @example
+ *   poolUnblock(pool);
+ */
+void poolUnblock(pool_t *);
+
+/**
+ * Number of threads running jobs while a group is waited on: the workers and
+ * the waiting thread. Useful to size chunks of parallel loops.
+ * @name poolConcurrency
+ * @param {const pool_t*} pool - The pool
+ * @returns {size_t} The number of threads
+ */
+size_t poolConcurrency(const pool_t *);
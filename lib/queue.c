@@ -0,0 +1,100 @@
+#include "queue.h"
+#include "alloc.h"
+#include "result.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+result_ref_t queueCreate(size_t capacity, size_t element_size) {
+  queue_t *queue = nullptr;
+  try(result_ref_t, allocSafe(sizeof(queue_t)), queue);
+  queue->capacity = capacity > 0 ? capacity : 1;
+  queue->element_size = element_size;
+
+  tryCatch(result_ref_t,
+           allocSafe(sizeof(queue_slot_t) * queue->capacity),
+           deallocSafe(&queue), queue->slots);
+  tryCatch(
+      result_ref_t, allocSafe(element_size * queue->capacity),
+      {
+        deallocSafe(&queue->slots);
+        deallocSafe(&queue);
+      },
+      queue->data);
+
+  // A slot at index i can be written first at position i
+  for (size_t i = 0; i < queue->capacity; i++) {
+    atomic_init(&queue->slots[i].sequence, i);
+  }
+
+  return ok(result_ref_t, queue);
+}
+
+void queueDestroy(queue_t **self) {
+  if (!self || !*self)
+    return;
+
+  deallocSafe(&(*self)->slots);
+  deallocSafe(&(*self)->data);
+  deallocSafe(self);
+}
+
+bool queuePush(queue_t *self, const void *element) {
+  size_t position = atomic_load_explicit(&self->tail, memory_order_relaxed);
+  size_t slot;
+
+  while (true) {
+    slot = position % self->capacity;
+    const size_t sequence =
+        atomic_load_explicit(&self->slots[slot].sequence, memory_order_acquire);
+    const intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &self->tail, &position, position + 1, memory_order_relaxed,
+              memory_order_relaxed))
+        break;
+    } else if (difference < 0) {
+      // The slot still holds the element of the previous round
+      return false;
+    } else {
+      position = atomic_load_explicit(&self->tail, memory_order_relaxed);
+    }
+  }
+
+  memcpy(self->data + slot * self->element_size, element, self->element_size);
+  atomic_store_explicit(&self->slots[slot].sequence, position + 1,
+                        memory_order_release);
+  return true;
+}
+
+bool queuePop(queue_t *self, void *element) {
+  size_t position = atomic_load_explicit(&self->head, memory_order_relaxed);
+  size_t slot;
+
+  while (true) {
+    slot = position % self->capacity;
+    const size_t sequence =
+        atomic_load_explicit(&self->slots[slot].sequence, memory_order_acquire);
+    const intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+    if (difference == 0) {
+      if (atomic_compare_exchange_weak_explicit(
+              &self->head, &position, position + 1, memory_order_relaxed,
+              memory_order_relaxed))
+        break;
+    } else if (difference < 0) {
+      // The slot has not been written in this round yet
+      return false;
+    } else {
+      position = atomic_load_explicit(&self->head, memory_order_relaxed);
+    }
+  }
+
+  memcpy(element, self->data + slot * self->element_size, self->element_size);
+  // The slot can be written again one round later
+  atomic_store_explicit(&self->slots[slot].sequence, position + self->capacity,
+                        memory_order_release);
+  return true;
+}
@@ -0,0 +1,96 @@
+// Queue (v0.0.1)
+// ---
+//
+// Bounded multi-producer multi-consumer lock-free queue of fixed-size
+// elements.
+//
+// Every slot carries a sequence number telling whether it is ready to be
+// written or read at a given position: producers and consumers claim
+// positions with a compare-and-swap on the tail and the head respectively,
+// and never wait on each other. Operations fail instead of blocking when the
+// queue is full or empty.
+//
+// ```c
+// result_ref_t result = queueCreate(64, sizeof(int));
+// if (result.ok) {
+//     queue_t *queue = result.value;
+//
+//     int number = 42;
+//     queuePush(queue, &number);
+//     queuePop(queue, &number);
+//
+//     queueDestroy(&queue);
+// }
+// ```
+
+#pragma once
+
+#include "alloc.h"
+#include "result.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Keeps positions written by producers and consumers on separate cache lines
+static constexpr size_t QUEUE_CACHE_LINE = 64;
+
+typedef struct {
+  atomic_size_t sequence; // Position the slot can be written or read at
+} queue_slot_t;
+
+/**
+ * Lock-free queue structure.
+ * @name queue_t
+ */
+typedef struct {
+  atomic_size_t head; // Next position to be read
+  char head_padding[QUEUE_CACHE_LINE - sizeof(atomic_size_t)];
+  atomic_size_t tail; // Next position to be written
+  char tail_padding[QUEUE_CACHE_LINE - sizeof(atomic_size_t)];
+  size_t capacity;
+  size_t element_size;
+  queue_slot_t *slots;
+  char *data;
+} queue_t;
+
+/**
+ * Create a queue holding up to capacity elements.
+ * @name queueCreate
+ * @param {size_t} capacity - Maximum number of queued elements, at least 1
+ * @param {size_t} element_size - Size in bytes of each element
+ * @returns {result_ref_t} Result containing the queue on success, or error on
+ * allocation failure
+ * @example
+ *   result_ref_t result = queueCreate(64, sizeof(int));
+ */
+result_ref_t queueCreate(size_t capacity, size_t element_size);
+
+/**
+ * Free a queue. Elements still queued are discarded.
+ * @name queueDestroy
+ * @param {queue_t**} queue - Pointer to the queue, set to null
+ * @example
+ *   queueDestroy(&queue);
+ */
+void queueDestroy(queue_t **);
+
+/**
+ * Copy an element at the back of the queue.
+ * @name queuePush
+ * @param {queue_t*} queue - The queue
+ * @param {const void*} element - Element of element_size bytes
+ * @returns {bool} False if the queue is full
+ * @example
+ *   if (!queuePush(queue, &number)) { ... }
+ */
+bool queuePush(queue_t *, const void *);
+
+/**
+ * Move the element at the front of the queue out of it.
+ * @name queuePop
+ * @param {queue_t*} queue - The queue
+ * @param {void*} element - Destination of element_size bytes
+ * @returns {bool} False if the queue is empty
+ * @example
+ *   if (queuePop(queue, &number)) { ... }
+ */
+bool queuePop(queue_t *, void *);
@@ -0,0 +1,79 @@
+#include "writer.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+void writerInit(writer_t *self, FILE *stream, writer_flush_t flush) {
+  self->stream = stream;
+  self->flush = flush;
+  self->count = 0;
+  pthread_mutex_init(&self->lock, nullptr);
+}
+
+void writerDeinit(writer_t *self) {
+  writerFlush(self);
+  pthread_mutex_destroy(&self->lock);
+}
+
+// Must be called with the lock held
+static void writerDrain(writer_t *self) {
+  if (self->count > 0) {
+    fwrite(self->data, 1, self->count, self->stream);
+    self->count = 0;
+  }
+  fflush(self->stream);
+}
+
+// Must be called with the lock held
+static void writerAppend(writer_t *self, const char *bytes, size_t count) {
+  if (self->count + count > WRITER_CAPACITY) {
+    writerDrain(self);
+  }
+
+  // Bytes not fitting in the buffer skip it
+  if (count > WRITER_CAPACITY) {
+    fwrite(bytes, 1, count, self->stream);
+    return;
+  }
+
+  memcpy(self->data + self->count, bytes, count);
+  self->count += count;
+}
+
+// Must be called with the lock held
+static void writerSettle(writer_t *self, bool new_line) {
+  switch (self->flush) {
+  case WRITER_FLUSH_WRITE:
+    writerDrain(self);
+    break;
+  case WRITER_FLUSH_LINE:
+    if (new_line)
+      writerDrain(self);
+    break;
+  case WRITER_FLUSH_FULL:
+  default:
+    break;
+  }
+}
+
+void writerWrite(writer_t *self, const char *bytes, size_t count) {
+  pthread_mutex_lock(&self->lock);
+  writerAppend(self, bytes, count);
+  writerSettle(self, memchr(bytes, '\n', count) != nullptr);
+  pthread_mutex_unlock(&self->lock);
+}
+
+void writerWriteLine(writer_t *self, const char *bytes, size_t count) {
+  pthread_mutex_lock(&self->lock);
+  writerAppend(self, bytes, count);
+  writerAppend(self, "\n", 1);
+  writerSettle(self, true);
+  pthread_mutex_unlock(&self->lock);
+}
+
+void writerFlush(writer_t *self) {
+  pthread_mutex_lock(&self->lock);
+  writerDrain(self);
+  pthread_mutex_unlock(&self->lock);
+}
@@ -0,0 +1,98 @@
+// Writer (v0.0.1)
+// ---
+//
+// Buffered writer over a stdio stream, which threads can share.
+//
+// Bytes are collected in a buffer owned by the writer and handed to the
+// stream in bulk, followed by a flush of the stream: when the buffer is full,
+// on new lines for streams read interactively, after every write for streams
+// meant to be unbuffered (e.g., standard error), or on demand.
+//
+// ```c
+// writer_t writer;
+// writerInit(&writer, stdout, WRITER_FLUSH_LINE);
+//
+// writerWrite(&writer, "hello", 5);
+// writerWrite(&writer, "\n", 1); // flushes the line
+//
+// writerDeinit(&writer);
+// ```
+
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+static constexpr size_t WRITER_CAPACITY = 8192;
+
+typedef enum {
+  WRITER_FLUSH_FULL,  // When the buffer is full
+  WRITER_FLUSH_LINE,  // Also when a new line is written
+  WRITER_FLUSH_WRITE, // After every write
+} writer_flush_t;
+
+/**
+ * Buffered writer structure. Initialize with writerInit before the first use.
+ * @name writer_t
+ */
+typedef struct {
+  FILE *stream;
+  writer_flush_t flush;
+  pthread_mutex_t lock;
+  size_t count; // Bytes buffered
+  char data[WRITER_CAPACITY];
+} writer_t;
+
+/**
+ * Initialize a writer over a stream.
+ * @name writerInit
+ * @param {writer_t*} writer - The writer
+ * @param {FILE*} stream - The stream written to
+ * @param {writer_flush_t} flush - When buffered bytes are flushed
+ * @example
+ *   writerInit(&writer, stdout, WRITER_FLUSH_FULL);
+ */
+void writerInit(writer_t *, FILE *, writer_flush_t);
+
+/**
+ * Flush the buffered bytes and release the resources of a writer. The stream
+ * is not closed.
+ * @name writerDeinit
+ * @param {writer_t*} writer - The writer
+ * @example
+ *   writerDeinit(&writer);
+ */
+void writerDeinit(writer_t *);
+
+/**
+ * Buffer bytes, flushing them according to the policy of the writer. Bytes
+ * written in one call are never interleaved with bytes of other threads.
+ * @name writerWrite
+ * @param {writer_t*} writer - The writer
+ * @param {const char*} bytes - The bytes to write
+ * @param {size_t} count - Number of bytes
+ * @example
+ *   writerWrite(&writer, "hello", 5);
+ */
+void writerWrite(writer_t *, const char *, size_t);
+
+/**
+ * Buffer bytes followed by a new line, like writerWrite.
+ * @name writerWriteLine
+ * @param {writer_t*} writer - The writer
+ * @param {const char*} bytes - The bytes to write before the new line
+ * @param {size_t} count - Number of bytes
+ * @example
+ *   writerWriteLine(&writer, "hello", 5);
+ */
+void writerWriteLine(writer_t *, const char *, size_t);
+
+/**
+ * Hand the buffered bytes to the stream, and flush the stream.
+ * @name writerFlush
+ * @param {writer_t*} writer - The writer
+ * @example
+ *   writerFlush(&writer);
+ */
+void writerFlush(writer_t *);
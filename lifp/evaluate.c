@@ -1,5 +1,6 @@
 #include "evaluate.h"
 #include "error.h"
+#include "fmt.h"
 #include "node.h"
 #include "position.h"
 #include "value.h"
@@ -37,6 +38,80 @@ result_value_ref_t invokeClosure(value_t *closure_value,
   return result;
 }
 
+// Arguments of typed builtins are read in place when they are literals or
+// symbols bound to numbers, and evaluated and unboxed otherwise.
+static result_void_position_t evaluateNumber(const char *name, node_t *node,
+                                             environment_t *environment,
+                                             number_t *number) {
+  if (node->type == NODE_TYPE_NUMBER) {
+    *number = node->value.number;
+    return ok(result_void_position_t);
+  }
+
+  if (node->type == NODE_TYPE_SYMBOL) {
+    bool locked = false;
+    const value_t *value =
+        environmentAcquireSymbol(environment, node->value.symbol, &locked);
+    const bool is_number = value && value->type == VALUE_TYPE_NUMBER;
+    if (is_number) {
+      *number = value->as.number;
+    }
+    environmentReleaseSymbol(environment, locked);
+
+    if (is_number) {
+      return ok(result_void_position_t);
+    }
+  }
+
+  value_t *value = nullptr;
+  try(result_void_position_t, evaluate(node, environment), value);
+
+  if (value->type != VALUE_TYPE_NUMBER) {
+    const value_type_t type = value->type;
+    valueDestroy(&value);
+    throw(result_void_position_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          node->position, "%s requires a number. Got %s.", name,
+          formatValueType(type));
+  }
+
+  *number = value->as.number;
+  valueDestroy(&value);
+  return ok(result_void_position_t);
+}
+
+static result_value_ref_t invokeTyped(native_t builtin, const node_list_t *list,
+                                      environment_t *environment,
+                                      position_t position) {
+  size_t arity = builtin.kind == BUILTIN_KIND_UNARY ? 1 : 2;
+  if (list->count - 1 != arity) {
+    throw(result_value_ref_t, ERROR_CODE_TYPE_UNEXPECTED_ARITY, position,
+          "%s requires %zu argument%s. Got %zu", builtin.name, arity,
+          arity == 1 ? "" : "s", list->count - 1);
+  }
+
+  number_t arguments[2] = {0};
+  for (size_t i = 0; i < arity; i++) {
+    try(result_value_ref_t, evaluateNumber(builtin.name, &list->data[i + 1],
+                                           environment, &arguments[i]));
+  }
+
+  number_t result = 0;
+  switch (builtin.kind) {
+  case BUILTIN_KIND_UNARY:
+    result = builtin.unary(arguments[0]);
+    break;
+  case BUILTIN_KIND_BINARY:
+    result = builtin.binary(arguments[0], arguments[1]);
+    break;
+  case BUILTIN_KIND_GENERIC:
+  default:
+    unreachable();
+  }
+
+  return valueCreate(VALUE_TYPE_NUMBER, (value_as_t){.number = result},
+                     position);
+}
+
 result_value_ref_t evaluate(node_t *node, environment_t *environment) {
   trampoline_t trampoline;
   position_t position = node->position;
@@ -59,16 +134,22 @@ result_value_ref_t evaluate(node_t *node, environment_t *environment) {
     }
 
     case NODE_TYPE_STRING: {
+      const size_t length = strlen(node->value.string);
+      char *string = nullptr;
+      tryWithMeta(result_value_ref_t, allocSafe(length + 1), position, string);
+      memcpy(string, node->value.string, length + 1);
       return valueCreate(VALUE_TYPE_STRING,
-                         (value_as_t){.string = strdup(node->value.string)},
+                         (value_as_t){.string = string, .length = length},
                          position);
     }
 
     case NODE_TYPE_SYMBOL: {
+      bool locked = false;
       const value_t *value =
-          environmentResolveSymbol(environment, node->value.symbol);
+          environmentAcquireSymbol(environment, node->value.symbol, &locked);
 
       if (!value) {
+        environmentReleaseSymbol(environment, locked);
         throw(result_value_ref_t, ERROR_CODE_REFERENCE_SYMBOL_NOT_FOUND,
               position,
               "Symbol '%s' cannot be found in the current environment",
@@ -76,7 +157,8 @@ result_value_ref_t evaluate(node_t *node, environment_t *environment) {
       }
 
       value_t *copy;
-      try(result_value_ref_t, valueDeepCopy(value), copy);
+      tryFinally(result_value_ref_t, valueDeepCopy(value),
+                 environmentReleaseSymbol(environment, locked), copy);
       copy->position = position;
       return ok(result_value_ref_t, copy);
     }
@@ -97,7 +179,13 @@ result_value_ref_t evaluate(node_t *node, environment_t *environment) {
 
       switch (scratch->type) {
       case VALUE_TYPE_BUILTIN: {
-        builtin_t builtin = scratch->as.builtin;
+        if (scratch->as.builtin.kind != BUILTIN_KIND_GENERIC) {
+          native_t native = scratch->as.builtin;
+          valueDestroy(&scratch);
+          return invokeTyped(native, &list, environment, position);
+        }
+
+        builtin_t builtin = scratch->as.builtin.generic;
         value_array_t *values;
         tryCatchWithMeta(result_value_ref_t, valueArrayCreate(list.count - 1),
                          valueDestroy(&scratch), first_node.position, values);
@@ -169,6 +257,9 @@ result_value_ref_t evaluate(node_t *node, environment_t *environment) {
       case VALUE_TYPE_NIL:
       case VALUE_TYPE_LIST:
       case VALUE_TYPE_STRING:
+      case VALUE_TYPE_FUTURE:
+      case VALUE_TYPE_CHANNEL:
+      case VALUE_TYPE_BUILDER:
       case VALUE_TYPE_NUMBER: {
         value_array_t *array;
         tryWithMeta(result_value_ref_t, valueArrayCreate(list.count),
@@ -45,44 +45,94 @@ static void formatCurrentLine(position_t caret, const char *input_buffer,
   deallocSafe(&copy);
 }
 
-static void formatNode(const node_t *node, int size, char buffer[static size],
-                       int *offset) {
+void formatErrorMessage(message_t message, position_t position,
+                        const char *file_name, const char *input_buffer,
+                        int size, char output_buffer[static size],
+                        int *offset) {
+  append(size, output_buffer, offset, "Error: %s", message);
+
+  formatCurrentLine(position, input_buffer, size, output_buffer, offset);
+  append(size, output_buffer, offset, "  at %s:%lu:%lu", file_name,
+         position.line, position.column);
+}
+
+// Formatted text is collected in chunks before reaching the sink
+static constexpr size_t FORMAT_CHUNK_SIZE = 512;
+
+typedef struct {
+  format_sink_t sink;
+  size_t count;
+  char data[FORMAT_CHUNK_SIZE];
+} format_stream_t;
+
+static void streamFlush(format_stream_t *self) {
+  if (self->count > 0) {
+    self->sink.write(self->sink.context, self->data, self->count);
+    self->count = 0;
+  }
+}
+
+static void streamWrite(format_stream_t *self, const char *bytes,
+                        size_t count) {
+  if (self->count + count > FORMAT_CHUNK_SIZE) {
+    streamFlush(self);
+  }
+
+  // Text not fitting in a chunk skips it
+  if (count > FORMAT_CHUNK_SIZE) {
+    self->sink.write(self->sink.context, bytes, count);
+    return;
+  }
+
+  memcpy(self->data + self->count, bytes, count);
+  self->count += count;
+}
+
+static void streamText(format_stream_t *self, const char *text) {
+  streamWrite(self, text, strlen(text));
+}
+
+static void streamNumber(format_stream_t *self, number_t number) {
+  char buffer[32];
+  const int length = snprintf(buffer, sizeof(buffer), "%g", number);
+  streamWrite(self, buffer, ensurePositive(length));
+}
+
+static void streamNode(format_stream_t *self, const node_t *node) {
   switch (node->type) {
   case NODE_TYPE_BOOLEAN: {
-    append(size, buffer, offset, "%s", node->value.boolean ? "true" : "false");
+    streamText(self, node->value.boolean ? "true" : "false");
     return;
   }
   case NODE_TYPE_NIL: {
-    append(size, buffer, offset, "nil");
+    streamText(self, "nil");
     return;
   }
   case NODE_TYPE_NUMBER: {
-    append(size, buffer, offset, "%g", node->value.number);
+    streamNumber(self, node->value.number);
     return;
   }
   case NODE_TYPE_SYMBOL: {
-    append(size, buffer, offset, "%s", node->value.symbol);
+    streamText(self, node->value.symbol);
     return;
   }
   case NODE_TYPE_STRING: {
-    append(size, buffer, offset, "\"%s\"", node->value.string);
+    streamText(self, "\"");
+    streamText(self, node->value.string);
+    streamText(self, "\"");
     return;
   }
   case NODE_TYPE_LIST: {
-    append(size, buffer, offset, "(");
+    streamText(self, "(");
     node_list_t list = node->value.list;
 
-    if (list.count > 0) {
-      for (size_t i = 0; i < list.count - 1; i++) {
-        node_t sub_node = listGet(node_t, &list, i);
-        formatNode(&sub_node, size, buffer, offset);
-        append(size, buffer, offset, " ");
-      }
-
-      node_t sub_node = listGet(node_t, &list, list.count - 1);
-      formatNode(&sub_node, size, buffer, offset);
+    for (size_t i = 0; i < list.count; i++) {
+      if (i > 0)
+        streamText(self, " ");
+      node_t sub_node = listGet(node_t, &list, i);
+      streamNode(self, &sub_node);
     }
-    append(size, buffer, offset, ")");
+    streamText(self, ")");
     return;
   }
   default:
@@ -90,83 +140,121 @@ static void formatNode(const node_t *node, int size, char buffer[static size],
   }
 }
 
-void formatErrorMessage(message_t message, position_t position,
-                        const char *file_name, const char *input_buffer,
-                        int size, char output_buffer[static size],
-                        int *offset) {
-  append(size, output_buffer, offset, "Error: %s", message);
-
-  formatCurrentLine(position, input_buffer, size, output_buffer, offset);
-  append(size, output_buffer, offset, "  at %s:%lu:%lu", file_name,
-         position.line, position.column);
-}
-
-void formatValue(const value_t *value, int size,
-                 char output_buffer[static size], int *offset) {
+static void streamValue(format_stream_t *self, const value_t *value) {
   switch (value->type) {
   case VALUE_TYPE_BOOLEAN: {
-    append(size, output_buffer, offset, "%s",
-           value->as.boolean ? "true" : "false");
+    streamText(self, value->as.boolean ? "true" : "false");
     return;
   }
   case VALUE_TYPE_NIL: {
-    append(size, output_buffer, offset, "nil");
+    streamText(self, "nil");
     return;
   }
   case VALUE_TYPE_NUMBER: {
-    append(size, output_buffer, offset, "%g", value->as.number);
+    streamNumber(self, value->as.number);
     return;
   }
   case VALUE_TYPE_BUILTIN: {
-    append(size, output_buffer, offset, "#<builtin>");
+    streamText(self, "#<builtin>");
     return;
   }
   case VALUE_TYPE_SPECIAL: {
-    append(size, output_buffer, offset, "#<special>");
+    streamText(self, "#<special>");
+    return;
+  }
+  case VALUE_TYPE_FUTURE: {
+    streamText(self, "#<future>");
+    return;
+  }
+  case VALUE_TYPE_CHANNEL: {
+    streamText(self, "#<channel>");
+    return;
+  }
+  case VALUE_TYPE_BUILDER: {
+    streamText(self, "#<builder>");
     return;
   }
   case VALUE_TYPE_STRING: {
-    append(size, output_buffer, offset, "\"%s\"", value->as.string);
+    streamText(self, "\"");
+    streamWrite(self, value->as.string, value->as.length);
+    streamText(self, "\"");
     return;
   }
   case VALUE_TYPE_LIST: {
-    append(size, output_buffer, offset, "(");
+    streamText(self, "(");
     value_array_t *list = value->as.list;
 
-    if (list->count > 0) {
-      for (size_t i = 0; i < list->count - 1; i++) {
-        value_t sub_value = listGet(value_t, list, i);
-        formatValue(&sub_value, size, output_buffer, offset);
-        append(size, output_buffer, offset, " ");
-      }
-
-      value_t sub_value = listGet(value_t, list, list->count - 1);
-      formatValue(&sub_value, size, output_buffer, offset);
+    for (size_t i = 0; i < list->count; i++) {
+      if (i > 0)
+        streamText(self, " ");
+      value_t sub_value = listGet(value_t, list, i);
+      streamValue(self, &sub_value);
     }
-    append(size, output_buffer, offset, ")");
+    streamText(self, ")");
     return;
   }
-  case VALUE_TYPE_CLOSURE:
-    append(size, output_buffer, offset, "(fn (");
+  case VALUE_TYPE_CLOSURE: {
+    streamText(self, "(fn (");
     arguments_t *arguments = value->as.closure.arguments;
 
-    if (arguments->count > 0) {
-      for (size_t i = 0; i < arguments->count - 1; i++) {
-        string_t sub_node = arguments->data[i];
-        append(size, output_buffer, offset, "%s ", sub_node);
-      }
-
-      string_t sub_node = arguments->data[arguments->count - 1];
-      append(size, output_buffer, offset, "%s", sub_node);
+    for (size_t i = 0; i < arguments->count; i++) {
+      if (i > 0)
+        streamText(self, " ");
+      streamText(self, arguments->data[i]);
     }
-    append(size, output_buffer, offset, ") ");
+    streamText(self, ") ");
 
-    formatNode(value->as.closure.form, size, output_buffer, offset);
-    append(size, output_buffer, offset, ")");
+    streamNode(self, value->as.closure.form);
+    streamText(self, ")");
+    return;
+  }
   default:
   }
 }
 
+void formatValueTo(const value_t *value, format_sink_t sink) {
+  format_stream_t stream = {.sink = sink, .count = 0};
+  streamValue(&stream, value);
+  streamFlush(&stream);
+}
+
+static void fileWrite(void *context, const char *bytes, size_t count) {
+  fwrite(bytes, 1, count, (FILE *)context);
+}
+
+format_sink_t formatFileSink(FILE *stream) {
+  return (format_sink_t){.write = fileWrite, .context = stream};
+}
+
+typedef struct {
+  int size;
+  char *buffer;
+  int *offset;
+} format_buffer_t;
+
+// Like snprintf, the offset grows past the size by the truncated length
+static void bufferWrite(void *context, const char *bytes, size_t count) {
+  format_buffer_t *self = context;
+  if (self->size > *self->offset) {
+    const size_t room = (size_t)(self->size - *self->offset - 1);
+    const size_t copied = count < room ? count : room;
+    memcpy(self->buffer + *self->offset, bytes, copied);
+    self->buffer[*self->offset + (int)copied] = 0;
+  }
+  *self->offset += (int)count;
+}
+
+void formatValue(const value_t *value, int size,
+                 char output_buffer[static size], int *offset) {
+  format_buffer_t buffer = {
+      .size = size,
+      .buffer = output_buffer,
+      .offset = offset,
+  };
+  formatValueTo(value,
+                (format_sink_t){.write = bufferWrite, .context = &buffer});
+}
+
 const char *formatValueType(value_type_t type) {
   switch (type) {
   case VALUE_TYPE_BOOLEAN:
@@ -185,6 +273,12 @@ const char *formatValueType(value_type_t type) {
     return "list";
   case VALUE_TYPE_STRING:
     return "string";
+  case VALUE_TYPE_FUTURE:
+    return "future";
+  case VALUE_TYPE_CHANNEL:
+    return "channel";
+  case VALUE_TYPE_BUILDER:
+    return "builder";
   default:
     unreachable();
   }
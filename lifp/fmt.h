@@ -2,11 +2,24 @@
 
 #include "position.h"
 #include "value.h"
+#include <stddef.h>
+#include <stdio.h>
+
+// Destination of formatted text, which receives it in chunks
+typedef struct {
+  void (*write)(void *context, const char *bytes, size_t count);
+  void *context;
+} format_sink_t;
 
 void formatErrorMessage(message_t, position_t, const char *, const char *,
                         int size, char output_buffer[static size], int *);
 
+// Formats into a buffer, truncating the text that does not fit
 void formatValue(const value_t *, int size, char output_buffer[static size],
                  int *);
 
+// Formats values of any size, in linear time
+void formatValueTo(const value_t *, format_sink_t);
+format_sink_t formatFileSink(FILE *);
+
 const char *formatValueType(value_type_t);
@@ -0,0 +1,359 @@
+#define _POSIX_C_SOURCE 200809L
+#include "image.h"
+#include "../lib/alloc.h"
+#include "../lib/list.h"
+#include "node.h"
+#include "position.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr size_t INITIAL_BUFFER_SIZE = 256;
+
+bool imageHasMagic(size_t size, const char buffer[static size]) {
+  return size >= IMAGE_MAGIC_SIZE &&
+         memcmp(buffer, IMAGE_MAGIC, IMAGE_MAGIC_SIZE) == 0;
+}
+
+static result_void_t bufferReserve(image_buffer_t *self, size_t size) {
+  if (self->size + size <= self->capacity)
+    return ok(result_void_t);
+
+  size_t capacity = self->capacity ? self->capacity : INITIAL_BUFFER_SIZE;
+  while (capacity < self->size + size) {
+    capacity *= 2;
+  }
+
+  byte_t *data = nullptr;
+  try(result_void_t, allocSafe(capacity), data);
+  if (self->data) {
+    memcpy(data, self->data, self->size);
+  }
+  deallocSafe(&self->data);
+
+  self->data = data;
+  self->capacity = capacity;
+  return ok(result_void_t);
+}
+
+static result_void_t bufferAppend(image_buffer_t *self, size_t size,
+                                  const void *data) {
+  try(result_void_t, bufferReserve(self, size));
+  memcpy(self->data + self->size, data, size);
+  self->size += size;
+  return ok(result_void_t);
+}
+
+result_ref_t imageWriterCreate(void) {
+  image_writer_t *writer = nullptr;
+  try(result_ref_t, allocSafe(sizeof(image_writer_t)), writer);
+  return ok(result_ref_t, writer);
+}
+
+void imageWriterDestroy(image_writer_t **self) {
+  if (!self || !*self)
+    return;
+
+  deallocSafe(&(*self)->forms.data);
+  deallocSafe(&(*self)->nodes.data);
+  deallocSafe(&(*self)->strings.data);
+  deallocSafe(self);
+}
+
+static result_void_t writeString(image_writer_t *self, const char *string,
+                                 uint64_t *offset) {
+  *offset = self->strings.size;
+  return bufferAppend(&self->strings, strlen(string) + 1, string);
+}
+
+// Children of a list are reserved as a contiguous run of records before
+// descending, so a list only needs to store its first child and the count.
+static result_void_t writeNode(image_writer_t *self, size_t index,
+                               const node_t *node) {
+  image_node_t record = {
+      .type = (uint32_t)node->type,
+      .line = node->position.line,
+      .column = node->position.column,
+  };
+
+  switch (node->type) {
+  case NODE_TYPE_LIST: {
+    const size_t count = node->value.list.count;
+    const size_t first = self->nodes.size / sizeof(image_node_t);
+    try(result_void_t, bufferReserve(&self->nodes, count * sizeof(image_node_t)));
+    self->nodes.size += count * sizeof(image_node_t);
+
+    record.count = (uint32_t)count;
+    record.as.offset = first;
+    for (size_t i = 0; i < count; i++) {
+      node_t child = listGet(node_t, &node->value.list, i);
+      try(result_void_t, writeNode(self, first + i, &child));
+    }
+    break;
+  }
+  case NODE_TYPE_SYMBOL:
+    try(result_void_t, writeString(self, node->value.symbol, &record.as.offset));
+    break;
+  case NODE_TYPE_STRING:
+    try(result_void_t, writeString(self, node->value.string, &record.as.offset));
+    break;
+  case NODE_TYPE_NUMBER:
+    record.as.number = node->value.number;
+    break;
+  case NODE_TYPE_BOOLEAN:
+    record.as.boolean = node->value.boolean;
+    break;
+  case NODE_TYPE_NIL:
+  default:
+    break;
+  }
+
+  memcpy(self->nodes.data + (index * sizeof(image_node_t)), &record,
+         sizeof(image_node_t));
+  return ok(result_void_t);
+}
+
+result_void_t imageWriterAppend(image_writer_t *self, const node_t *node) {
+  assert(self);
+  assert(node);
+
+  const uint64_t root = self->nodes.size / sizeof(image_node_t);
+  try(result_void_t, bufferReserve(&self->nodes, sizeof(image_node_t)));
+  self->nodes.size += sizeof(image_node_t);
+
+  try(result_void_t, writeNode(self, root, node));
+  return bufferAppend(&self->forms, sizeof(uint64_t), &root);
+}
+
+static bool writeSection(FILE *file, size_t size, const void *data) {
+  return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+result_void_t imageWriterSave(const image_writer_t *self, const char *path,
+                              size_t size, const char source[static size]) {
+  image_header_t header = {
+      .version = IMAGE_FORMAT_VERSION,
+      .forms_count = self->forms.size / sizeof(uint64_t),
+      .nodes_count = self->nodes.size / sizeof(image_node_t),
+      .strings_size = self->strings.size,
+      .source_size = size,
+  };
+  memcpy(header.magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE);
+
+  char temporary[PATH_MAX];
+  snprintf(temporary, PATH_MAX, "%s.XXXXXX", path);
+  int file_descriptor = mkstemp(temporary);
+  if (file_descriptor < 0) {
+    throw(result_void_t, IMAGE_ERROR_IO, nullptr, "Cannot write image '%s'",
+          path);
+  }
+  fchmod(file_descriptor, 0644);
+
+  FILE *file = fdopen(file_descriptor, "wb");
+  if (!file) {
+    close(file_descriptor);
+    unlink(temporary);
+    throw(result_void_t, IMAGE_ERROR_IO, nullptr, "Cannot write image '%s'",
+          path);
+  }
+
+  const char terminator = 0;
+  bool written = writeSection(file, sizeof(image_header_t), &header) &&
+                 writeSection(file, self->forms.size, self->forms.data) &&
+                 writeSection(file, self->nodes.size, self->nodes.data) &&
+                 writeSection(file, self->strings.size, self->strings.data) &&
+                 writeSection(file, size, source) &&
+                 writeSection(file, 1, &terminator);
+
+  if (fclose(file) != 0 || !written || rename(temporary, path) != 0) {
+    unlink(temporary);
+    throw(result_void_t, IMAGE_ERROR_IO, nullptr, "Cannot write image '%s'",
+          path);
+  }
+
+  return ok(result_void_t);
+}
+
+static result_void_t validate(image_t *self) {
+  if (self->size < sizeof(image_header_t) ||
+      !imageHasMagic(self->size, (const char *)self->data)) {
+    throw(result_void_t, IMAGE_ERROR_INVALID, nullptr, "Not a lifp image");
+  }
+
+  const image_header_t *header = (const void *)self->data;
+  if (header->version != IMAGE_FORMAT_VERSION) {
+    throw(result_void_t, IMAGE_ERROR_INVALID, nullptr,
+          "Unsupported image version %u, expected %u", header->version,
+          IMAGE_FORMAT_VERSION);
+  }
+
+  size_t available = self->size - sizeof(image_header_t);
+  if (header->forms_count > available / sizeof(uint64_t) ||
+      header->nodes_count > available / sizeof(image_node_t)) {
+    throw(result_void_t, IMAGE_ERROR_INVALID, nullptr, "Truncated image");
+  }
+
+  size_t sections = (header->forms_count * sizeof(uint64_t)) +
+                    (header->nodes_count * sizeof(image_node_t));
+  if (sections > available ||
+      header->strings_size > available - sections ||
+      header->source_size >= available - sections - header->strings_size) {
+    throw(result_void_t, IMAGE_ERROR_INVALID, nullptr, "Truncated image");
+  }
+
+  byte_t *cursor = self->data + sizeof(image_header_t);
+  self->header = header;
+  self->forms = (const void *)cursor;
+  cursor += header->forms_count * sizeof(uint64_t);
+  self->nodes = (const void *)cursor;
+  cursor += header->nodes_count * sizeof(image_node_t);
+  self->strings = (char *)cursor;
+  cursor += header->strings_size;
+  self->source = (char *)cursor;
+
+  if ((header->strings_size > 0 &&
+       self->strings[header->strings_size - 1] != 0) ||
+      self->source[header->source_size] != 0) {
+    throw(result_void_t, IMAGE_ERROR_INVALID, nullptr, "Corrupted image");
+  }
+
+  for (size_t i = 0; i < header->forms_count; i++) {
+    if (self->forms[i] >= header->nodes_count) {
+      throw(result_void_t, IMAGE_ERROR_INVALID, nullptr, "Corrupted image");
+    }
+  }
+
+  // Children always come after their parent, which also rules out cycles
+  for (size_t i = 0; i < header->nodes_count; i++) {
+    const image_node_t *record = &self->nodes[i];
+    bool valid = true;
+
+    switch ((node_type_t)record->type) {
+    case NODE_TYPE_LIST:
+      valid = record->count == 0 ||
+              (record->as.offset > i &&
+               record->as.offset <= header->nodes_count - record->count);
+      break;
+    case NODE_TYPE_SYMBOL:
+    case NODE_TYPE_STRING:
+      valid = record->as.offset < header->strings_size;
+      break;
+    case NODE_TYPE_NUMBER:
+    case NODE_TYPE_BOOLEAN:
+    case NODE_TYPE_NIL:
+      break;
+    default:
+      valid = false;
+    }
+
+    if (!valid) {
+      throw(result_void_t, IMAGE_ERROR_INVALID, nullptr, "Corrupted image");
+    }
+  }
+
+  return ok(result_void_t);
+}
+
+result_ref_t imageOpen(const char *path) {
+  int file_descriptor = open(path, O_RDONLY);
+  if (file_descriptor < 0) {
+    throw(result_ref_t, IMAGE_ERROR_IO, nullptr, "Cannot open image '%s'",
+          path);
+  }
+
+  struct stat info;
+  if (fstat(file_descriptor, &info) != 0 || info.st_size <= 0) {
+    close(file_descriptor);
+    throw(result_ref_t, IMAGE_ERROR_INVALID, nullptr, "Not a lifp image");
+  }
+
+  const size_t size = (size_t)info.st_size;
+  // Private writable mapping: loaded nodes hold non-const string pointers, but
+  // nothing ever writes through them, so no page is actually copied.
+  void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    file_descriptor, 0);
+  close(file_descriptor);
+  if (data == MAP_FAILED) {
+    throw(result_ref_t, IMAGE_ERROR_IO, nullptr, "Cannot map image '%s'",
+          path);
+  }
+
+  image_t *image = nullptr;
+  tryCatch(result_ref_t, allocSafe(sizeof(image_t)), munmap(data, size),
+           image);
+  image->size = size;
+  image->data = data;
+
+  tryCatch(result_ref_t, validate(image), imageClose(&image));
+  return ok(result_ref_t, image);
+}
+
+void imageClose(image_t **self) {
+  if (!self || !*self)
+    return;
+
+  munmap((*self)->data, (*self)->size);
+  deallocSafe(self);
+}
+
+static result_void_t loadNode(const image_t *self, arena_t *arena,
+                              uint64_t index, node_t *node) {
+  const image_node_t *record = &self->nodes[index];
+  node->type = (node_type_t)record->type;
+  node->position.line = record->line;
+  node->position.column = record->column;
+
+  switch (node->type) {
+  case NODE_TYPE_LIST: {
+    node_list_t *list = nullptr;
+    try(result_void_t, listCreate(node_t, arena, record->count), list);
+    memcpy(&node->value.list, list, sizeof(node_list_t));
+
+    for (size_t i = 0; i < record->count; i++) {
+      try(result_void_t, loadNode(self, arena, record->as.offset + i,
+                                  &node->value.list.data[i]));
+    }
+    node->value.list.count = record->count;
+    break;
+  }
+  case NODE_TYPE_SYMBOL:
+    node->value.symbol = &self->strings[record->as.offset];
+    break;
+  case NODE_TYPE_STRING:
+    node->value.string = &self->strings[record->as.offset];
+    break;
+  case NODE_TYPE_NUMBER:
+    node->value.number = record->as.number;
+    break;
+  case NODE_TYPE_BOOLEAN:
+    node->value.boolean = record->as.boolean != 0;
+    break;
+  case NODE_TYPE_NIL:
+  default:
+    node->value.nil = nullptr;
+    break;
+  }
+
+  return ok(result_void_t);
+}
+
+result_node_ref_t imageLoadForm(const image_t *self, arena_t *arena,
+                                size_t index) {
+  assert(index < self->header->forms_count);
+  const uint64_t root = self->forms[index];
+  const image_node_t *record = &self->nodes[root];
+  position_t position = {.line = record->line, .column = record->column};
+
+  node_t *node = nullptr;
+  tryWithMeta(result_node_ref_t, nodeCreate(arena, NODE_TYPE_NIL), position,
+              node);
+  tryWithMeta(result_node_ref_t, loadNode(self, arena, root, node), position);
+  return ok(result_node_ref_t, node);
+}
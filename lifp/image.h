@@ -0,0 +1,129 @@
+// Program images are the parsed form of a lifp source file, serialized so
+// that they can be memory-mapped and executed without tokenizing or parsing.
+//
+// All references inside an image are indices or offsets, so the mapping can
+// live at any address. Strings and symbols are NUL-terminated in a string
+// table and loaded nodes point straight into the mapping.
+
+#pragma once
+
+#include "../lib/arena.h"
+#include "../lib/result.h"
+#include "node.h"
+#include "parse.h"
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr uint32_t IMAGE_FORMAT_VERSION = 1;
+constexpr size_t IMAGE_MAGIC_SIZE = 4;
+constexpr char IMAGE_MAGIC[IMAGE_MAGIC_SIZE] = {0x7f, 'L', 'F', 'P'};
+
+typedef enum {
+  IMAGE_ERROR_ALLOCATION = ARENA_ERROR_OUT_OF_SPACE,
+  IMAGE_ERROR_IO,
+  IMAGE_ERROR_INVALID,
+} image_error_t;
+
+typedef struct {
+  char magic[IMAGE_MAGIC_SIZE];
+  uint32_t version;
+  uint64_t forms_count;
+  uint64_t nodes_count;
+  uint64_t strings_size;
+  uint64_t source_size;
+} image_header_t;
+
+typedef struct {
+  uint32_t type;
+  uint32_t count;
+  uint64_t line;
+  uint64_t column;
+  union {
+    number_t number;
+    uint64_t offset;
+    uint64_t boolean;
+  } as;
+} image_node_t;
+
+typedef struct image_t {
+  size_t size;
+  byte_t *data;
+  const image_header_t *header;
+  const uint64_t *forms;
+  const image_node_t *nodes;
+  char *strings;
+  char *source;
+} image_t;
+
+typedef struct {
+  size_t size;
+  size_t capacity;
+  byte_t *data;
+} image_buffer_t;
+
+typedef struct {
+  image_buffer_t forms;
+  image_buffer_t nodes;
+  image_buffer_t strings;
+} image_writer_t;
+
+/**
+ * Checks whether a buffer starts with the image magic number.
+ * @name imageHasMagic
+ * @param {size_t} size - Size of the buffer
+ * @param {const char*} buffer - The buffer to check
+ * @returns {bool} True if the buffer looks like a program image
+ */
+bool imageHasMagic(size_t size, const char buffer[static size]);
+
+/**
+ * Memory-maps and validates a program image.
+ * @name imageOpen
+ * @param {const char*} path - Path of the image file
+ * @returns {result_ref_t} The image on success, or an IO/format error
+ * @example
+ *   image_t *image = nullptr;
+ *   try(result_void_t, imageOpen("script.lifpc"), image);
+ *   // ...
+ *   imageClose(&image);
+ */
+result_ref_t imageOpen(const char *path);
+
+/**
+ * Materializes a top-level form of the image in the given arena. Strings and
+ * symbols are not copied: they reference the mapping.
+ * @name imageLoadForm
+ * @param {const image_t*} image - The image to load from
+ * @param {arena_t*} arena - The arena hosting the nodes
+ * @param {size_t} index - Index of the top-level form
+ * @returns {result_node_ref_t} The syntax tree of the form
+ */
+result_node_ref_t imageLoadForm(const image_t *, arena_t *, size_t);
+
+void imageClose(image_t **);
+
+result_ref_t imageWriterCreate(void);
+
+/**
+ * Serializes a top-level form at the end of the image.
+ * @name imageWriterAppend
+ * @param {image_writer_t*} writer - The writer to append to
+ * @param {const node_t*} node - The syntax tree of the form
+ * @returns {result_void_t} Success, or allocation error
+ */
+result_void_t imageWriterAppend(image_writer_t *, const node_t *);
+
+/**
+ * Writes the image to disk. The file is written aside and renamed in place, so
+ * readers never observe a partially written image.
+ * @name imageWriterSave
+ * @param {image_writer_t*} writer - The writer holding the forms
+ * @param {const char*} path - Destination path
+ * @param {size_t} size - Size of the source
+ * @param {const char*} source - Source the forms come from, kept for errors
+ * @returns {result_void_t} Success, or IO error
+ */
+result_void_t imageWriterSave(const image_writer_t *, const char *path,
+                              size_t size, const char source[static size]);
+
+void imageWriterDestroy(image_writer_t **);
@@ -0,0 +1,196 @@
+#include "lifp.h"
+#include "../lib/alloc.h"
+#include "error.h"
+#include "evaluate.h"
+#include "fmt.h"
+#include "image.h"
+#include "parse.h"
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+result_value_ref_t lifpEvaluate(vm_t *machine, arena_t *arena, size_t size,
+                                const char source[static size]) {
+  char *statement_buffer = nullptr;
+  tryWithMeta(result_value_ref_t, allocSafe(size + 1), (position_t){},
+              statement_buffer);
+
+  value_t *last = nullptr;
+  ssize_t offset = 0;
+  while (offset < (ssize_t)size) {
+    arenaReset(arena);
+
+    node_t *syntax_tree = nullptr;
+    tryCatch(result_value_ref_t,
+             parseStatement(arena, (ssize_t)size, statement_buffer, source,
+                            &offset),
+             {
+               valueDestroy(&last);
+               deallocSafe(&statement_buffer);
+             },
+             syntax_tree);
+    if (!syntax_tree)
+      continue;
+
+    valueDestroy(&last);
+    tryCatch(result_value_ref_t, evaluate(syntax_tree, machine->global),
+             deallocSafe(&statement_buffer), last);
+  }
+
+  deallocSafe(&statement_buffer);
+  if (!last)
+    return lifpNil();
+  return ok(result_value_ref_t, last);
+}
+
+result_value_ref_t lifpEvaluateImage(vm_t *machine, arena_t *arena,
+                                     const image_t *image) {
+  value_t *last = nullptr;
+
+  for (size_t i = 0; i < image->header->forms_count; i++) {
+    arenaReset(arena);
+
+    node_t *syntax_tree = nullptr;
+    tryCatch(result_value_ref_t, imageLoadForm(image, arena, i),
+             valueDestroy(&last), syntax_tree);
+
+    valueDestroy(&last);
+    try(result_value_ref_t, evaluate(syntax_tree, machine->global), last);
+  }
+
+  if (!last)
+    return lifpNil();
+  return ok(result_value_ref_t, last);
+}
+
+static result_void_t registerNative(vm_t *machine, const char *name,
+                                    native_t native) {
+  native.name = name;
+  value_t value = {.type = VALUE_TYPE_BUILTIN, .as.builtin = native};
+  return valueMapSet(machine->builtins, name, &value);
+}
+
+result_void_t lifpRegister(vm_t *machine, const char *name, builtin_t builtin) {
+  return registerNative(
+      machine, name,
+      (native_t){.kind = BUILTIN_KIND_GENERIC, .generic = builtin});
+}
+
+result_void_t lifpRegisterUnary(vm_t *machine, const char *name,
+                                builtin_unary_t builtin) {
+  return registerNative(
+      machine, name, (native_t){.kind = BUILTIN_KIND_UNARY, .unary = builtin});
+}
+
+result_void_t lifpRegisterBinary(vm_t *machine, const char *name,
+                                 builtin_binary_t builtin) {
+  return registerNative(
+      machine, name,
+      (native_t){.kind = BUILTIN_KIND_BINARY, .binary = builtin});
+}
+
+result_void_t lifpDefine(vm_t *machine, const char *name,
+                         const value_t *value) {
+  return environmentRegisterSymbol(machine->global, name, value);
+}
+
+const value_t *lifpLookup(const vm_t *machine, const char *name) {
+  return environmentResolveSymbol(machine->global, name);
+}
+
+static result_value_ref_t callNative(native_t native,
+                                     const value_array_t *arguments,
+                                     position_t position) {
+  if (native.kind == BUILTIN_KIND_GENERIC)
+    return native.generic(arguments, position);
+
+  size_t arity = native.kind == BUILTIN_KIND_UNARY ? 1 : 2;
+  if (arguments->count != arity) {
+    throw(result_value_ref_t, ERROR_CODE_TYPE_UNEXPECTED_ARITY, position,
+          "%s requires %zu argument%s. Got %zu", native.name, arity,
+          arity == 1 ? "" : "s", arguments->count);
+  }
+
+  for (size_t i = 0; i < arity; i++) {
+    if (arguments->data[i].type != VALUE_TYPE_NUMBER) {
+      throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+            arguments->data[i].position, "%s requires a number. Got %s.",
+            native.name, formatValueType(arguments->data[i].type));
+    }
+  }
+
+  number_t result = native.kind == BUILTIN_KIND_UNARY
+                        ? native.unary(arguments->data[0].as.number)
+                        : native.binary(arguments->data[0].as.number,
+                                        arguments->data[1].as.number);
+  return lifpNumber(result);
+}
+
+result_value_ref_t lifpCall(const value_t *function, value_array_t *arguments) {
+  switch (function->type) {
+  case VALUE_TYPE_CLOSURE: {
+    value_t closure = *function;
+    return invokeClosure(&closure, arguments);
+  }
+  case VALUE_TYPE_BUILTIN:
+    return callNative(function->as.builtin, arguments, function->position);
+  case VALUE_TYPE_BOOLEAN:
+  case VALUE_TYPE_NUMBER:
+  case VALUE_TYPE_NIL:
+  case VALUE_TYPE_LIST:
+  case VALUE_TYPE_SPECIAL:
+  case VALUE_TYPE_STRING:
+  case VALUE_TYPE_FUTURE:
+  case VALUE_TYPE_CHANNEL:
+  case VALUE_TYPE_BUILDER:
+  default:
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          function->position, "Only functions and builtins can be called.");
+  }
+}
+
+result_value_ref_t lifpNumber(number_t number) {
+  return valueCreate(VALUE_TYPE_NUMBER, (value_as_t){.number = number},
+                     (position_t){});
+}
+
+result_value_ref_t lifpBoolean(bool boolean) {
+  return valueCreate(VALUE_TYPE_BOOLEAN, (value_as_t){.boolean = boolean},
+                     (position_t){});
+}
+
+result_value_ref_t lifpNil(void) {
+  return valueCreate(VALUE_TYPE_NIL, (value_as_t){}, (position_t){});
+}
+
+result_value_ref_t lifpString(const char *string) {
+  const size_t length = strlen(string);
+  char *copy = strdup(string);
+  if (!copy) {
+    throw(result_value_ref_t, ERROR_CODE_ALLOCATION, (position_t){},
+          "Unable to allocate string.");
+  }
+
+  result_value_ref_t result = valueCreate(
+      VALUE_TYPE_STRING, (value_as_t){.string = copy, .length = length},
+      (position_t){});
+  if (result.code != RESULT_OK)
+    deallocSafe(&copy);
+  return result;
+}
+
+result_value_ref_t lifpList(size_t count) {
+  value_array_t *list = nullptr;
+  tryWithMeta(result_value_ref_t, valueArrayCreate(count), (position_t){},
+              list);
+
+  for (size_t i = 0; i < count; i++) {
+    list->data[i].type = VALUE_TYPE_NIL;
+  }
+
+  result_value_ref_t result =
+      valueCreate(VALUE_TYPE_LIST, (value_as_t){.list = list}, (position_t){});
+  if (result.code != RESULT_OK)
+    valueArrayDestroy(&list);
+  return result;
+}
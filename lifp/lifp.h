@@ -0,0 +1,159 @@
+// Embedding interface of lifp, shipped with liblifp.a and liblifp.so.
+//
+// A host creates one or more machines with vmCreate, evaluates source strings
+// or compiled images in them, registers its own builtins and exchanges values
+// directly, without formatting them as text. Values returned by the functions
+// below are owned by the caller and released with valueDestroy.
+//
+// Strings are read up to as.length: slices of long strings are views into
+// them, and are not terminated.
+//
+// A machine must only be used by one thread at a time, but independent
+// machines can run in parallel.
+//
+//   vm_t *machine = nullptr;
+//   try(result_void_t, vmCreate(), machine);
+//   try(result_void_t, lifpRegister(machine, "host:now", hostNow));
+//
+//   const char source[] = "(def! square (fn (x) (* x x)))";
+//   value_t *result = nullptr;
+//   try(result_void_t, lifpEvaluate(machine, arena, sizeof(source), source),
+//       result);
+//   valueDestroy(&result);
+//
+//   value_t *argument = nullptr;
+//   try(result_void_t, lifpNumber(4), argument);
+//   value_array_t arguments = {.count = 1, .data = argument};
+//   try(result_void_t,
+//       lifpCall(lifpLookup(machine, "square"), &arguments), result);
+//   // result->as.number == 16
+//
+//   valueDestroy(&result);
+//   valueDestroy(&argument);
+//   vmDestroy(&machine);
+
+#pragma once
+
+#include "../lib/arena.h"
+#include "../lib/result.h"
+#include "value.h"
+#include "virtual_machine.h"
+#include <stddef.h>
+
+// Images are opened with image.h, which the host includes when using them
+typedef struct image_t image_t;
+
+/**
+ * Evaluates every top-level statement of a source string in the global
+ * environment of the machine.
+ * @name lifpEvaluate
+ * @param {vm_t*} machine - The machine to evaluate in
+ * @param {arena_t*} arena - Scratch memory for syntax trees, reset for each
+ * statement
+ * @param {size_t} size - Size of the source
+ * @param {const char*} source - The source to evaluate
+ * @returns {result_value_ref_t} Value of the last statement (nil for empty
+ * sources), or the first error with its position
+ * @example
+ *   value_t *value = nullptr;
+ *   try(result_void_t, lifpEvaluate(machine, arena, 7, "(+ 1 2)"), value);
+ */
+result_value_ref_t lifpEvaluate(vm_t *, arena_t *, size_t size,
+                                const char source[static size]);
+
+/**
+ * Evaluates every form of a compiled image in the global environment of the
+ * machine, skipping tokenization and parsing.
+ * @name lifpEvaluateImage
+ * @param {vm_t*} machine - The machine to evaluate in
+ * @param {arena_t*} arena - Scratch memory for syntax trees, reset for each
+ * form
+ * @param {const image_t*} image - Image opened with imageOpen
+ * @returns {result_value_ref_t} Value of the last form, or the first error
+ * @example
+ *   image_t *image = nullptr;
+ *   try(result_void_t, imageOpen("prelude.lifpc"), image);
+ *   try(result_void_t, lifpEvaluateImage(machine, arena, image), value);
+ */
+result_value_ref_t lifpEvaluateImage(vm_t *, arena_t *, const image_t *);
+
+/**
+ * Registers a native function, callable from lifp code like any builtin.
+ * Registering an existing name replaces the previous builtin.
+ * @name lifpRegister
+ * @param {vm_t*} machine - The machine to extend
+ * @param {const char*} name - Symbol the builtin is bound to
+ * @param {builtin_t} builtin - The native implementation
+ * @returns {result_void_t} Success, or error on an empty name
+ * @example
+ *   try(result_void_t, lifpRegister(machine, "host:now", hostNow));
+ */
+result_void_t lifpRegister(vm_t *, const char *name, builtin_t);
+
+/**
+ * Registers a native function taking and returning numbers. Typed builtins
+ * are called with unboxed arguments, without allocating an argument list, and
+ * suit small functions on hot paths.
+ * @name lifpRegisterUnary, lifpRegisterBinary
+ * @param {vm_t*} machine - The machine to extend
+ * @param {const char*} name - Symbol the builtin is bound to, also reported
+ * by its errors: it must outlive the machine
+ * @param {builtin_unary_t|builtin_binary_t} builtin - The native
+ * implementation
+ * @returns {result_void_t} Success, or error on an empty name
+ * @example
+ *   static number_t hypotenuse(number_t a, number_t b) { return hypot(a, b); }
+ *   try(result_void_t, lifpRegisterBinary(machine, "host:hypot", hypotenuse));
+ */
+result_void_t lifpRegisterUnary(vm_t *, const char *name, builtin_unary_t);
+result_void_t lifpRegisterBinary(vm_t *, const char *name, builtin_binary_t);
+
+/**
+ * Binds a copy of a host value to a symbol of the global environment, like
+ * def! does.
+ * @name lifpDefine
+ * @param {vm_t*} machine - The machine to define the symbol in
+ * @param {const char*} name - The symbol
+ * @param {const value_t*} value - The value, copied into the machine
+ * @returns {result_void_t} Success, or error if the symbol is already defined
+ * @example
+ *   try(result_void_t, lifpDefine(machine, "limit", limit));
+ */
+result_void_t lifpDefine(vm_t *, const char *name, const value_t *);
+
+/**
+ * Resolves a symbol in the global environment of the machine.
+ * @name lifpLookup
+ * @param {const vm_t*} machine - The machine to look into
+ * @param {const char*} name - The symbol
+ * @returns {const value_t*} The value owned by the machine, or nullptr
+ * @example
+ *   const value_t *square = lifpLookup(machine, "square");
+ */
+const value_t *lifpLookup(const vm_t *, const char *name);
+
+/**
+ * Calls a function or a builtin with values provided by the host.
+ * @name lifpCall
+ * @param {const value_t*} function - A closure or a builtin
+ * @param {value_array_t*} arguments - Arguments of the call, left untouched
+ * @returns {result_value_ref_t} The returned value, or error
+ * @example
+ *   try(result_void_t, lifpCall(square, &arguments), result);
+ */
+result_value_ref_t lifpCall(const value_t *, value_array_t *);
+
+/**
+ * Creates values to pass to a machine. Strings are copied, lists are created
+ * with the given amount of nil elements.
+ * @name lifpNumber, lifpBoolean, lifpNil, lifpString, lifpList
+ * @returns {result_value_ref_t} The new value, or allocation error
+ * @example
+ *   value_t *value = nullptr;
+ *   try(result_void_t, lifpString("hello"), value);
+ */
+result_value_ref_t lifpNumber(number_t);
+result_value_ref_t lifpBoolean(bool);
+result_value_ref_t lifpNil(void);
+result_value_ref_t lifpString(const char *);
+result_value_ref_t lifpList(size_t count);
@@ -3,6 +3,7 @@
 #include "error.h"
 #include "node.h"
 #include "token.h"
+#include "tokenize.h"
 #include <assert.h>
 #include <stddef.h>
 #include <string.h>
@@ -143,3 +144,53 @@ result_node_ref_t parse(arena_t *arena, const token_list_t *tokens,
 
   return parseAtom(arena, first_token);
 }
+
+static void readStatement(ssize_t size, char line_buffer[static size],
+                          const char input_buffer[static size],
+                          ssize_t *offset) {
+  size_t line_buffer_offset = 0;
+  int depth = 0;
+
+  for (; *offset < size; (*offset)++) {
+    const char current = input_buffer[(*offset)];
+
+    // end of an atom statement
+    if (current == '\n' && depth == 0) {
+      (*offset)++;
+      return;
+    }
+
+    line_buffer[line_buffer_offset++] = current;
+
+    // end of a list statement
+    if (current == RPAREN) {
+      if (depth == 1) {
+        (*offset)++;
+        return;
+      }
+      depth--;
+    }
+
+    if (current == LPAREN) {
+      depth++;
+    }
+  }
+}
+
+result_node_ref_t parseStatement(arena_t *arena, ssize_t size,
+                                 char statement_buffer[static size],
+                                 const char file_buffer[static size],
+                                 ssize_t *offset) {
+  memset(statement_buffer, 0, (size_t)size);
+  readStatement(size, statement_buffer, file_buffer, offset);
+
+  if (strlen(statement_buffer) == 0)
+    return ok(result_node_ref_t, nullptr);
+
+  token_list_t *tokens = nullptr;
+  try(result_node_ref_t, tokenize(arena, statement_buffer), tokens);
+
+  size_t line_offset = 0;
+  size_t depth = 0;
+  return parse(arena, tokens, &line_offset, &depth);
+}
@@ -7,6 +7,7 @@
 #include "token.h"
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
 constexpr size_t MAX_SYMBOL_LENGTH = 32;
 
@@ -16,3 +17,11 @@ constexpr char NIL[] = "nil";
 
 typedef Result(node_t *, position_t) result_node_ref_t;
 result_node_ref_t parse(arena_t *, const token_list_t *, size_t *, size_t *);
+
+// Reads the next top-level statement of a source buffer, starting at offset,
+// and parses it in the given arena. The statement buffer must hold at least
+// size bytes. Returns a null node for blank statements.
+result_node_ref_t parseStatement(arena_t *, ssize_t size,
+                                 char statement_buffer[static size],
+                                 const char source[static size],
+                                 ssize_t *offset);
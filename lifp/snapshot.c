@@ -0,0 +1,565 @@
+#define _POSIX_C_SOURCE 200809L
+#include "snapshot.h"
+#include "../lib/alloc.h"
+#include "node.h"
+#include "value.h"
+#include "virtual_machine.h"
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr uint64_t NO_PARENT = UINT64_MAX;
+static constexpr size_t INITIAL_ENVIRONMENTS = 8;
+
+typedef struct {
+  uint8_t magic[SNAPSHOT_MAGIC_SIZE];
+  uint32_t version;
+} snapshot_header_t;
+
+typedef struct {
+  size_t count;
+  size_t capacity;
+  environment_t **data;
+} environments_t;
+
+typedef struct {
+  FILE *file;
+  const vm_t *machine;
+  environments_t environments;
+} snapshot_writer_t;
+
+typedef struct {
+  size_t size;
+  size_t offset;
+  const byte_t *data;
+  const vm_t *machine;
+  environments_t environments;
+} snapshot_reader_t;
+
+static result_void_t environmentsPush(environments_t *self,
+                                      environment_t *environment) {
+  if (self->count == self->capacity) {
+    size_t capacity = self->capacity ? self->capacity * 2 : INITIAL_ENVIRONMENTS;
+    environment_t **data = nullptr;
+    try(result_void_t, allocSafe(sizeof(environment_t *) * capacity), data);
+    if (self->data) {
+      memcpy(data, self->data, sizeof(environment_t *) * self->count);
+    }
+    deallocSafe(&self->data);
+    self->data = data;
+    self->capacity = capacity;
+  }
+
+  self->data[self->count++] = environment;
+  return ok(result_void_t);
+}
+
+// Environments are few compared to values, a linear scan is good enough
+static result_void_t environmentIndex(environments_t *self,
+                                      environment_t *environment,
+                                      uint64_t *index) {
+  for (size_t i = 0; i < self->count; i++) {
+    if (self->data[i] == environment) {
+      *index = i;
+      return ok(result_void_t);
+    }
+  }
+
+  *index = self->count;
+  return environmentsPush(self, environment);
+}
+
+static result_void_t writeBytes(snapshot_writer_t *self, size_t size,
+                                const void *data) {
+  if (size > 0 && fwrite(data, 1, size, self->file) != size) {
+    throw(result_void_t, SNAPSHOT_ERROR_IO, nullptr, "Cannot write snapshot");
+  }
+  return ok(result_void_t);
+}
+
+static result_void_t writeInteger(snapshot_writer_t *self, uint64_t integer) {
+  return writeBytes(self, sizeof(uint64_t), &integer);
+}
+
+static result_void_t writeSizedString(snapshot_writer_t *self,
+                                      const char *string, size_t length) {
+  try(result_void_t, writeInteger(self, length));
+  return writeBytes(self, length, string);
+}
+
+static result_void_t writeString(snapshot_writer_t *self, const char *string) {
+  return writeSizedString(self, string, strlen(string));
+}
+
+static result_void_t writeNode(snapshot_writer_t *self, const node_t *node) {
+  try(result_void_t, writeInteger(self, node->type));
+  try(result_void_t, writeInteger(self, node->position.line));
+  try(result_void_t, writeInteger(self, node->position.column));
+
+  switch (node->type) {
+  case NODE_TYPE_LIST:
+    try(result_void_t, writeInteger(self, node->value.list.count));
+    for (size_t i = 0; i < node->value.list.count; i++) {
+      try(result_void_t, writeNode(self, &node->value.list.data[i]));
+    }
+    return ok(result_void_t);
+  case NODE_TYPE_SYMBOL:
+    return writeString(self, node->value.symbol);
+  case NODE_TYPE_STRING:
+    return writeString(self, node->value.string);
+  case NODE_TYPE_NUMBER:
+    return writeBytes(self, sizeof(number_t), &node->value.number);
+  case NODE_TYPE_BOOLEAN:
+    return writeInteger(self, node->value.boolean);
+  case NODE_TYPE_NIL:
+  default:
+    return ok(result_void_t);
+  }
+}
+
+// Builtins and specials are stored by the name they are registered with
+static const char *functionName(const value_map_t *map, const value_t *value) {
+  for (size_t i = 0; i < map->capacity; i++) {
+    if (!map->used[i])
+      continue;
+
+    const value_t *candidate = &map->data[i];
+    if ((value->type == VALUE_TYPE_BUILTIN &&
+         candidate->as.builtin.kind == value->as.builtin.kind &&
+         candidate->as.builtin.generic == value->as.builtin.generic) ||
+        (value->type == VALUE_TYPE_SPECIAL &&
+         candidate->as.special == value->as.special)) {
+      return map->keys[i];
+    }
+  }
+  return nullptr;
+}
+
+static result_void_t writeValue(snapshot_writer_t *self, const value_t *value) {
+  try(result_void_t, writeInteger(self, value->type));
+  try(result_void_t, writeInteger(self, value->position.line));
+  try(result_void_t, writeInteger(self, value->position.column));
+
+  switch (value->type) {
+  case VALUE_TYPE_BOOLEAN:
+    return writeInteger(self, value->as.boolean);
+  case VALUE_TYPE_NUMBER:
+    return writeBytes(self, sizeof(number_t), &value->as.number);
+  case VALUE_TYPE_STRING:
+    return writeSizedString(self, value->as.string, value->as.length);
+  case VALUE_TYPE_LIST:
+    try(result_void_t, writeInteger(self, value->as.list->count));
+    for (size_t i = 0; i < value->as.list->count; i++) {
+      try(result_void_t, writeValue(self, &value->as.list->data[i]));
+    }
+    return ok(result_void_t);
+  case VALUE_TYPE_BUILTIN:
+  case VALUE_TYPE_SPECIAL: {
+    const char *name = functionName(
+        value->type == VALUE_TYPE_BUILTIN ? self->machine->builtins
+                                          : self->machine->specials,
+        value);
+    if (!name) {
+      throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+            "Cannot snapshot an unregistered function");
+    }
+    return writeString(self, name);
+  }
+  case VALUE_TYPE_CLOSURE: {
+    const closure_t *closure = &value->as.closure;
+    uint64_t index = 0;
+    try(result_void_t, environmentIndex(&self->environments,
+                                        closure->environment, &index));
+    try(result_void_t, writeInteger(self, index));
+    try(result_void_t, writeInteger(self, closure->arguments->count));
+    for (size_t i = 0; i < closure->arguments->count; i++) {
+      try(result_void_t, writeString(self, closure->arguments->data[i]));
+    }
+    return writeNode(self, closure->form);
+  }
+  case VALUE_TYPE_FUTURE:
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Cannot snapshot a future");
+  case VALUE_TYPE_CHANNEL:
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Cannot snapshot a channel");
+  case VALUE_TYPE_BUILDER:
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Cannot snapshot a string builder");
+  case VALUE_TYPE_NIL:
+  default:
+    return ok(result_void_t);
+  }
+}
+
+static result_void_t writeEnvironment(snapshot_writer_t *self,
+                                      environment_t *environment) {
+  uint64_t parent = NO_PARENT;
+  if (environment->parent) {
+    try(result_void_t, environmentIndex(&self->environments,
+                                        environment->parent, &parent));
+  }
+  try(result_void_t, writeInteger(self, parent));
+
+  const value_map_t *values = &environment->values;
+  uint64_t count = 0;
+  for (size_t i = 0; i < values->capacity; i++) {
+    count += values->used[i];
+  }
+  try(result_void_t, writeInteger(self, count));
+
+  for (size_t i = 0; i < values->capacity; i++) {
+    if (!values->used[i])
+      continue;
+    try(result_void_t, writeString(self, values->keys[i]));
+    try(result_void_t, writeValue(self, &values->data[i]));
+  }
+
+  return ok(result_void_t);
+}
+
+static result_void_t writeSnapshot(snapshot_writer_t *self,
+                                   environment_t *global) {
+  snapshot_header_t header = {.version = SNAPSHOT_FORMAT_VERSION};
+  memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+  try(result_void_t, writeBytes(self, sizeof(snapshot_header_t), &header));
+  try(result_void_t, environmentsPush(&self->environments, global));
+
+  // Writing an environment can discover new ones, which are appended and
+  // written in turn: the reader meets references in the very same order
+  for (size_t i = 0; i < self->environments.count; i++) {
+    try(result_void_t,
+        writeEnvironment(self, self->environments.data[i]));
+  }
+
+  return ok(result_void_t);
+}
+
+result_void_t snapshotSave(const vm_t *machine, const char *path) {
+  assert(machine);
+
+  char temporary[PATH_MAX];
+  snprintf(temporary, PATH_MAX, "%s.XXXXXX", path);
+  int file_descriptor = mkstemp(temporary);
+  if (file_descriptor < 0) {
+    throw(result_void_t, SNAPSHOT_ERROR_IO, nullptr,
+          "Cannot write snapshot '%s'", path);
+  }
+  fchmod(file_descriptor, 0644);
+
+  snapshot_writer_t writer = {.file = fdopen(file_descriptor, "wb"),
+                              .machine = machine};
+  if (!writer.file) {
+    close(file_descriptor);
+    unlink(temporary);
+    throw(result_void_t, SNAPSHOT_ERROR_IO, nullptr,
+          "Cannot write snapshot '%s'", path);
+  }
+
+  result_void_t written = writeSnapshot(&writer, machine->global);
+  deallocSafe(&writer.environments.data);
+
+  if (fclose(writer.file) != 0 || written.code != RESULT_OK ||
+      rename(temporary, path) != 0) {
+    unlink(temporary);
+    if (written.code != RESULT_OK)
+      return written;
+    throw(result_void_t, SNAPSHOT_ERROR_IO, nullptr,
+          "Cannot write snapshot '%s'", path);
+  }
+
+  return ok(result_void_t);
+}
+
+static result_void_t readBytes(snapshot_reader_t *self, size_t size,
+                               void *data) {
+  if (size > self->size - self->offset) {
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Truncated snapshot");
+  }
+  memcpy(data, self->data + self->offset, size);
+  self->offset += size;
+  return ok(result_void_t);
+}
+
+static result_void_t readInteger(snapshot_reader_t *self, uint64_t *integer) {
+  return readBytes(self, sizeof(uint64_t), integer);
+}
+
+static result_void_t readSizedString(snapshot_reader_t *self, char **string,
+                                     size_t *length) {
+  uint64_t size = 0;
+  try(result_void_t, readInteger(self, &size));
+  if (size > self->size - self->offset) {
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Truncated snapshot");
+  }
+
+  *length = (size_t)size;
+  try(result_void_t, allocSafe(*length + 1), *string);
+  return readBytes(self, *length, *string);
+}
+
+static result_void_t readString(snapshot_reader_t *self, char **string) {
+  size_t length = 0;
+  return readSizedString(self, string, &length);
+}
+
+// Counts are checked against the remaining bytes before allocating, so that a
+// corrupted count cannot trigger a huge allocation
+static result_void_t readCount(snapshot_reader_t *self, size_t item_size,
+                               size_t *count) {
+  uint64_t value = 0;
+  try(result_void_t, readInteger(self, &value));
+  if (value > (self->size - self->offset) / item_size) {
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Corrupted snapshot");
+  }
+  *count = value;
+  return ok(result_void_t);
+}
+
+static result_void_t readPosition(snapshot_reader_t *self,
+                                  position_t *position) {
+  uint64_t line = 0;
+  uint64_t column = 0;
+  try(result_void_t, readInteger(self, &line));
+  try(result_void_t, readInteger(self, &column));
+  position->line = line;
+  position->column = column;
+  return ok(result_void_t);
+}
+
+static result_void_t readNode(snapshot_reader_t *self, node_t *node) {
+  uint64_t type = 0;
+  try(result_void_t, readInteger(self, &type));
+  try(result_void_t, readPosition(self, &node->position));
+  node->type = (node_type_t)type;
+
+  switch (node->type) {
+  case NODE_TYPE_LIST: {
+    size_t count = 0;
+    try(result_void_t, readCount(self, sizeof(uint64_t), &count));
+    node->value.list.arena = nullptr;
+    node->value.list.item_size = sizeof(node_t);
+    node->value.list.capacity = count;
+    try(result_void_t, allocSafe(sizeof(node_t) * count),
+        node->value.list.data);
+    for (size_t i = 0; i < count; i++) {
+      try(result_void_t, readNode(self, &node->value.list.data[i]));
+      node->value.list.count++;
+    }
+    return ok(result_void_t);
+  }
+  case NODE_TYPE_SYMBOL:
+    return readString(self, &node->value.symbol);
+  case NODE_TYPE_STRING:
+    return readString(self, &node->value.string);
+  case NODE_TYPE_NUMBER:
+    return readBytes(self, sizeof(number_t), &node->value.number);
+  case NODE_TYPE_BOOLEAN: {
+    uint64_t boolean = 0;
+    try(result_void_t, readInteger(self, &boolean));
+    node->value.boolean = boolean != 0;
+    return ok(result_void_t);
+  }
+  case NODE_TYPE_NIL:
+    node->value.nil = nullptr;
+    return ok(result_void_t);
+  default:
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Corrupted snapshot");
+  }
+}
+
+// Environments are created on first reference. Since the writer assigned
+// indices in that same order, a reference is either known or the next one.
+static result_void_t environmentAt(snapshot_reader_t *self, uint64_t index,
+                                   environment_t **environment) {
+  if (index < self->environments.count) {
+    *environment = self->environments.data[index];
+    return ok(result_void_t);
+  }
+
+  if (index != self->environments.count) {
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Corrupted snapshot");
+  }
+
+  // References are counted while restoring, starting from zero
+  try(result_void_t, environmentCreate(nullptr), *environment);
+  (*environment)->refcount = 0;
+  (*environment)->machine = self->machine;
+  return environmentsPush(&self->environments, *environment);
+}
+
+static result_void_t readFunction(snapshot_reader_t *self,
+                                  const value_map_t *map, value_t *value) {
+  char *name = nullptr;
+  try(result_void_t, readString(self, &name));
+  const value_t *function = valueMapGet(map, name);
+  deallocSafe(&name);
+  if (!function) {
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Unknown function in snapshot");
+  }
+
+  value->as = function->as;
+  return ok(result_void_t);
+}
+
+static result_void_t readValue(snapshot_reader_t *self, value_t *value) {
+  uint64_t type = 0;
+  try(result_void_t, readInteger(self, &type));
+  try(result_void_t, readPosition(self, &value->position));
+  value->type = (value_type_t)type;
+
+  switch (value->type) {
+  case VALUE_TYPE_BOOLEAN: {
+    uint64_t boolean = 0;
+    try(result_void_t, readInteger(self, &boolean));
+    value->as.boolean = boolean != 0;
+    return ok(result_void_t);
+  }
+  case VALUE_TYPE_NUMBER:
+    return readBytes(self, sizeof(number_t), &value->as.number);
+  case VALUE_TYPE_STRING:
+    return readSizedString(self, &value->as.string, &value->as.length);
+  case VALUE_TYPE_NIL:
+    value->as.nil = nullptr;
+    return ok(result_void_t);
+  case VALUE_TYPE_LIST: {
+    size_t count = 0;
+    try(result_void_t, readCount(self, sizeof(uint64_t), &count));
+    try(result_void_t, valueArrayCreate(count), value->as.list);
+    for (size_t i = 0; i < count; i++) {
+      try(result_void_t, readValue(self, &value->as.list->data[i]));
+    }
+    return ok(result_void_t);
+  }
+  case VALUE_TYPE_BUILTIN:
+    return readFunction(self, self->machine->builtins, value);
+  case VALUE_TYPE_SPECIAL:
+    return readFunction(self, self->machine->specials, value);
+  case VALUE_TYPE_CLOSURE: {
+    closure_t *closure = &value->as.closure;
+    uint64_t index = 0;
+    try(result_void_t, readInteger(self, &index));
+    try(result_void_t, environmentAt(self, index, &closure->environment));
+    closure->environment->refcount++;
+
+    size_t count = 0;
+    try(result_void_t, readCount(self, sizeof(uint64_t), &count));
+    try(result_void_t, argumentsCreate(count), closure->arguments);
+    for (size_t i = 0; i < count; i++) {
+      try(result_void_t, readString(self, &closure->arguments->data[i]));
+    }
+
+    try(result_void_t, allocSafe(sizeof(node_t)), closure->form);
+    return readNode(self, closure->form);
+  }
+  case VALUE_TYPE_FUTURE:
+  case VALUE_TYPE_CHANNEL:
+  case VALUE_TYPE_BUILDER:
+  default:
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Corrupted snapshot");
+  }
+}
+
+static result_void_t readEnvironment(snapshot_reader_t *self,
+                                     environment_t *environment) {
+  uint64_t parent = 0;
+  try(result_void_t, readInteger(self, &parent));
+  if (parent != NO_PARENT) {
+    try(result_void_t, environmentAt(self, parent, &environment->parent));
+    environment->parent->refcount++;
+    environment->tasks.parent = &environment->parent->tasks;
+  }
+
+  size_t count = 0;
+  try(result_void_t, readCount(self, sizeof(uint64_t), &count));
+  for (size_t i = 0; i < count; i++) {
+    char *key = nullptr;
+    value_t value = {};
+    try(result_void_t, readString(self, &key));
+    // Values read in part are destroyed as far as they were read
+    tryCatch(result_void_t, readValue(self, &value), {
+      deallocSafe(&key);
+      valueDestroyInner(&value);
+    });
+    tryCatch(result_void_t, valueMapSet(&environment->values, key, &value), {
+      deallocSafe(&key);
+      valueDestroyInner(&value);
+    });
+    deallocSafe(&key);
+  }
+
+  return ok(result_void_t);
+}
+
+static result_void_t readSnapshot(snapshot_reader_t *self,
+                                  environment_t *global) {
+  snapshot_header_t header = {};
+  try(result_void_t, readBytes(self, sizeof(snapshot_header_t), &header));
+  if (memcmp(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0) {
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Not a lifp snapshot");
+  }
+  if (header.version != SNAPSHOT_FORMAT_VERSION) {
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Unsupported snapshot version %u, expected %u", header.version,
+          SNAPSHOT_FORMAT_VERSION);
+  }
+
+  try(result_void_t, environmentsPush(&self->environments, global));
+  for (size_t i = 0; i < self->environments.count; i++) {
+    try(result_void_t, readEnvironment(self, self->environments.data[i]));
+  }
+
+  if (self->offset != self->size) {
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Corrupted snapshot");
+  }
+
+  return ok(result_void_t);
+}
+
+result_void_t snapshotRestore(vm_t *machine, const char *path) {
+  assert(machine);
+
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    throw(result_void_t, SNAPSHOT_ERROR_IO, nullptr,
+          "Cannot open snapshot '%s'", path);
+  }
+
+  struct stat info;
+  if (fstat(fileno(file), &info) != 0 || info.st_size <= 0) {
+    fclose(file);
+    throw(result_void_t, SNAPSHOT_ERROR_INVALID, nullptr,
+          "Not a lifp snapshot");
+  }
+
+  const size_t size = (size_t)info.st_size;
+  byte_t *data = nullptr;
+  tryCatch(result_void_t, allocSafe(size), fclose(file), data);
+  const size_t length = fread(data, 1, size, file);
+  fclose(file);
+  if (length != size) {
+    deallocSafe(&data);
+    throw(result_void_t, SNAPSHOT_ERROR_IO, nullptr,
+          "Cannot read snapshot '%s'", path);
+  }
+
+  snapshot_reader_t reader = {.size = size, .data = data, .machine = machine};
+  result_void_t restored = readSnapshot(&reader, machine->global);
+  deallocSafe(&reader.environments.data);
+  deallocSafe(&data);
+  return restored;
+}
@@ -0,0 +1,51 @@
+// Snapshots serialize the global environment of a virtual machine, so that a
+// prelude defining many symbols can be restored without evaluating it again.
+//
+// Values are written depth-first. Environments captured by closures are written
+// once and referenced by index, in the order they are first met. Builtins and
+// special forms are referenced by name, since their addresses change from one
+// execution to the next.
+
+#pragma once
+
+#include "../lib/arena.h"
+#include "../lib/result.h"
+#include "virtual_machine.h"
+#include <stddef.h>
+#include <stdint.h>
+
+constexpr uint32_t SNAPSHOT_FORMAT_VERSION = 1;
+constexpr size_t SNAPSHOT_MAGIC_SIZE = 4;
+constexpr char SNAPSHOT_MAGIC[SNAPSHOT_MAGIC_SIZE] = {0x7f, 'L', 'F', 'S'};
+
+typedef enum {
+  SNAPSHOT_ERROR_ALLOCATION = ARENA_ERROR_OUT_OF_SPACE,
+  SNAPSHOT_ERROR_IO,
+  SNAPSHOT_ERROR_INVALID,
+} snapshot_error_t;
+
+/**
+ * Writes the global environment of the machine to disk. The file is written
+ * aside and renamed in place, so readers never observe a partial snapshot.
+ * @name snapshotSave
+ * @param {const vm_t*} machine - The machine to snapshot
+ * @param {const char*} path - Destination path
+ * @returns {result_void_t} Success, or IO error
+ * @example
+ *   // after evaluating the prelude
+ *   try(result_void_t, snapshotSave(machine, "prelude.lifps"));
+ */
+result_void_t snapshotSave(const vm_t *, const char *path);
+
+/**
+ * Restores a snapshot in the global environment of a freshly created machine.
+ * @name snapshotRestore
+ * @param {vm_t*} machine - The machine to restore into
+ * @param {const char*} path - Path of the snapshot
+ * @returns {result_void_t} Success, or IO/format error
+ * @example
+ *   vm_t *machine = nullptr;
+ *   try(result_void_t, vmCreate(), machine);
+ *   try(result_void_t, snapshotRestore(machine, "prelude.lifps"));
+ */
+result_void_t snapshotRestore(vm_t *, const char *path);
@@ -99,7 +99,13 @@ result_value_ref_t function(const node_array_t *nodes,
             "%s requires a binding list of symbols.", FUNCTION);
     }
 
-    if (environmentResolveSymbol(environment, argument.value.symbol)) {
+    bool locked = false;
+    const bool shadows =
+        environmentAcquireSymbol(environment, argument.value.symbol,
+                                 &locked) != nullptr;
+    environmentReleaseSymbol(environment, locked);
+
+    if (shadows) {
       argumentsDestroy(&closure_arguments);
       throw(result_value_ref_t, ERROR_CODE_REFERENCE_SYMBOL_SHADOWED,
             argument.position, "Identifier '%s' shadows a value",
@@ -174,7 +180,7 @@ result_value_ref_t let(const node_array_t *nodes, environment_t *environment,
     node_t couple = listGet(node_t, &couples.value.list, i);
 
     if (couple.type != NODE_TYPE_LIST || couple.value.list.count != 2) {
-      environmentForceDestroy(&local_env);
+      environmentLeave(&local_env);
 
       throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, couple.position,
             "%s requires a list of symbol-form assignments.", LET);
@@ -182,14 +188,14 @@ result_value_ref_t let(const node_array_t *nodes, environment_t *environment,
 
     node_t symbol = listGet(node_t, &couple.value.list, 0);
     if (symbol.type != NODE_TYPE_SYMBOL) {
-      environmentForceDestroy(&local_env);
+      environmentLeave(&local_env);
 
       throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, symbol.position,
             "%s requires a list of symbol-form assignments.", LET);
     }
 
     if (strchr(symbol.value.symbol, NAMESPACE_DELIMITER) != nullptr) {
-      environmentForceDestroy(&local_env);
+      environmentLeave(&local_env);
 
       throw(result_value_ref_t, ERROR_CODE_SYNTAX_UNEXPECTED_TOKEN,
             first.position,
@@ -200,14 +206,14 @@ result_value_ref_t let(const node_array_t *nodes, environment_t *environment,
     node_t body = listGet(node_t, &couple.value.list, 1);
     value_t *intermediate = nullptr;
     tryCatch(result_value_ref_t, evaluate(&body, local_env),
-             environmentForceDestroy(&local_env), intermediate);
+             environmentLeave(&local_env), intermediate);
     position_t position = intermediate->position;
 
     tryCatchWithMeta(
         result_value_ref_t,
         environmentRegisterSymbol(local_env, symbol.value.symbol, intermediate),
         {
-          environmentForceDestroy(&local_env);
+          environmentLeave(&local_env);
           valueDestroy(&intermediate);
         },
         position);
@@ -216,7 +222,7 @@ result_value_ref_t let(const node_array_t *nodes, environment_t *environment,
 
   value_t *evaluated = nullptr;
   tryCatch(result_value_ref_t, evaluate(&nodes->data[2], local_env),
-           environmentForceDestroy(&local_env), evaluated);
+           environmentLeave(&local_env), evaluated);
 
   if (evaluated->type == VALUE_TYPE_CLOSURE) {
     environment_t *env = evaluated->as.closure.environment;
@@ -225,7 +231,7 @@ result_value_ref_t let(const node_array_t *nodes, environment_t *environment,
       if (env == local_env) {
         position_t position = evaluated->position;
         valueDestroy(&evaluated);
-        environmentForceDestroy(&local_env);
+        environmentLeave(&local_env);
         throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, position,
               "Cannot return pointer to ephemeral environment.");
       }
@@ -233,7 +239,7 @@ result_value_ref_t let(const node_array_t *nodes, environment_t *environment,
     }
   }
 
-  environmentForceDestroy(&local_env);
+  environmentLeave(&local_env);
 
   trampoline->should_continue = false;
   return ok(result_value_ref_t, evaluated);
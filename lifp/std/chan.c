@@ -0,0 +1,263 @@
+// Channels for lifp. Channels are bounded queues passing values between tasks
+// running in parallel, e.g., between the stages of a pipeline. Any number of
+// tasks can send to and receive from the same channel.
+//
+// ```lisp
+// (def! numbers (chan:make 16))
+// (def! producer
+//   (flow:spawn (fn () (list:each (fn (i) (chan:send! numbers i))
+//                                 (list:times (fn (i) i) 100)))))
+// (list:reduce (fn (sum i) (+ sum (chan:recv! numbers)))
+//              0 (list:times (fn (i) i) 100)) ; returns 4950
+// ```
+//
+// A task blocked on a channel holds its thread, and another thread is started
+// meanwhile to run the other tasks. Tasks still blocked when the program ends
+// are waited for forever: every value sent must be received.
+// ___HEADER_END___
+
+#include "../../lib/pool.h"
+#include "../../lib/queue.h"
+#include "../../lib/result.h"
+#include "../error.h"
+#include "../fmt.h"
+#include "../value.h"
+#include "../virtual_machine.h"
+#include <math.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
+
+static constexpr long CHAN_MAX_BACKOFF = 1000000L; // nanoseconds
+
+typedef struct {
+  long backoff;  // Nanoseconds of the next pause
+  bool blocking; // Set once the thread is marked as blocked
+  pool_t *pool;  // Pool running a spare worker meanwhile, if any
+} chan_wait_t;
+
+// Blocked operations back off exponentially up to a millisecond. They do not
+// run queued tasks meanwhile: a task run on top of a blocked receiver could
+// block in turn on a send that only that receiver can unblock. The pool runs
+// them on a spare worker instead, once the operation is about to sleep.
+static void chanWait(chan_wait_t *wait) {
+  if (wait->backoff == 0) {
+    sched_yield();
+    wait->backoff = 1000;
+    return;
+  }
+
+  if (!wait->blocking) {
+    wait->pool = poolBlock();
+    wait->blocking = true;
+  }
+
+  struct timespec pause = {.tv_sec = 0, .tv_nsec = wait->backoff};
+  nanosleep(&pause, nullptr);
+  wait->backoff = wait->backoff * 2 < CHAN_MAX_BACKOFF ? wait->backoff * 2
+                                                       : CHAN_MAX_BACKOFF;
+}
+
+/**
+ * Creates a channel holding up to a given number of values.
+ * @name chan:make
+ * @param {number} capacity - Values the channel holds before sends block.
+ * @returns {channel} A new, empty channel.
+ * @example
+ *   (chan:make 16) ; returns a channel
+ */
+const char *CHAN_MAKE = "chan:make";
+result_value_ref_t chanMake(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 1) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 1 argument. Got %zu", CHAN_MAKE, arguments->count);
+  }
+
+  value_t capacity_value = listGet(value_t, arguments, 0);
+  if (capacity_value.type != VALUE_TYPE_NUMBER) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          capacity_value.position, "%s requires a number. Got %s.", CHAN_MAKE,
+          formatValueType(capacity_value.type));
+  }
+
+  long capacity = lround(capacity_value.as.number);
+  if (capacity < 1) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR,
+          capacity_value.position, "%s requires a positive capacity.",
+          CHAN_MAKE);
+  }
+
+  channel_t *channel = nullptr;
+  tryWithMeta(result_value_ref_t, allocSafe(sizeof(channel_t)), pos, channel);
+  channel->refcount = 1;
+  tryCatchWithMeta(result_value_ref_t,
+                   queueCreate((size_t)capacity, sizeof(value_t)),
+                   deallocSafe(&channel), pos, channel->queue);
+
+  value_t *value = nullptr;
+  tryCatch(
+      result_value_ref_t,
+      valueCreate(VALUE_TYPE_CHANNEL, (value_as_t){.channel = channel}, pos),
+      {
+        queueDestroy(&channel->queue);
+        deallocSafe(&channel);
+      },
+      value);
+  return ok(result_value_ref_t, value);
+}
+
+/**
+ * Sends a copy of a value to a channel, waiting while the channel is full.
+ * Another thread runs the other tasks meanwhile, but a send that is never
+ * received keeps the program from ending.
+ * @name chan:send!
+ * @param {channel} channel - The channel to send to.
+ * @param {any} value - The value to send.
+ * @returns {nil} Returns nil once the value is queued.
+ * @example
+ *   (chan:send! numbers 42)
+ */
+const char *CHAN_SEND = "chan:send!";
+result_value_ref_t chanSend(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 2) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 2 arguments. Got %zu", CHAN_SEND, arguments->count);
+  }
+
+  value_t channel_value = listGet(value_t, arguments, 0);
+  if (channel_value.type != VALUE_TYPE_CHANNEL) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          channel_value.position, "%s requires a channel. Got %s.", CHAN_SEND,
+          formatValueType(channel_value.type));
+  }
+
+  value_t *nil = nullptr;
+  tryWithMeta(result_value_ref_t,
+              valueCreate(VALUE_TYPE_NIL, (value_as_t){}, pos), pos, nil);
+
+  value_t source = listGet(value_t, arguments, 1);
+  value_t *copy = nullptr;
+  tryCatchWithMeta(result_value_ref_t, valueDeepCopy(&source),
+                   valueDestroy(&nil), pos, copy);
+
+  queue_t *queue = channel_value.as.channel->queue;
+  chan_wait_t wait = {};
+  while (!queuePush(queue, copy)) {
+    chanWait(&wait);
+  }
+  poolUnblock(wait.pool);
+
+  // The channel owns the contents of the copy now
+  deallocSafe(&copy);
+  return ok(result_value_ref_t, nil);
+}
+
+/**
+ * Receives the oldest value of a channel, waiting while the channel is empty.
+ * Another thread runs the other tasks meanwhile, so pipelines can have more
+ * stages than threads.
+ * @name chan:recv!
+ * @param {channel} channel - The channel to receive from.
+ * @returns {any} The value received.
+ * @example
+ *   (chan:recv! numbers) ; returns 42
+ */
+const char *CHAN_RECV = "chan:recv!";
+result_value_ref_t chanRecv(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 1) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 1 argument. Got %zu", CHAN_RECV, arguments->count);
+  }
+
+  value_t channel_value = listGet(value_t, arguments, 0);
+  if (channel_value.type != VALUE_TYPE_CHANNEL) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          channel_value.position, "%s requires a channel. Got %s.", CHAN_RECV,
+          formatValueType(channel_value.type));
+  }
+
+  // Allocated upfront, so that a received value is never lost
+  value_t *value = nullptr;
+  tryWithMeta(result_value_ref_t, allocSafe(sizeof(value_t)), pos, value);
+
+  queue_t *queue = channel_value.as.channel->queue;
+  chan_wait_t wait = {};
+  while (!queuePop(queue, value)) {
+    chanWait(&wait);
+  }
+  poolUnblock(wait.pool);
+
+  value->position = pos;
+  return ok(result_value_ref_t, value);
+}
+
+/**
+ * Receives a value from the first of several channels having one, waiting
+ * while all of them are empty.
+ * @name chan:select
+ * @param {list} channels - The channels to receive from.
+ * @returns {list} The index of the channel in the list and the value
+ * received.
+ * @example
+ *   (chan:select (list:from numbers words)) ; returns (1 "hello")
+ */
+const char *CHAN_SELECT = "chan:select";
+result_value_ref_t chanSelect(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 1) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 1 argument. Got %zu", CHAN_SELECT, arguments->count);
+  }
+
+  value_t list_value = listGet(value_t, arguments, 0);
+  if (list_value.type != VALUE_TYPE_LIST) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          list_value.position, "%s requires a list of channels. Got %s.",
+          CHAN_SELECT, formatValueType(list_value.type));
+  }
+
+  if (list_value.as.list->count == 0) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, list_value.position,
+          "%s requires at least one channel.", CHAN_SELECT);
+  }
+
+  const value_array_t *channels = list_value.as.list;
+  for (size_t i = 0; i < channels->count; i++) {
+    value_t channel_value = listGet(value_t, channels, i);
+    if (channel_value.type != VALUE_TYPE_CHANNEL) {
+      throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+            channel_value.position, "%s requires a list of channels. Got %s.",
+            CHAN_SELECT, formatValueType(channel_value.type));
+    }
+  }
+
+  value_array_t *selected = nullptr;
+  tryWithMeta(result_value_ref_t, valueArrayCreate(2), pos, selected);
+
+  chan_wait_t wait = {};
+  size_t index = 0;
+  while (true) {
+    value_t channel_value = listGet(value_t, channels, index);
+    if (queuePop(channel_value.as.channel->queue, &selected->data[1]))
+      break;
+
+    index = (index + 1) % channels->count;
+    if (index == 0) {
+      chanWait(&wait);
+    }
+  }
+  poolUnblock(wait.pool);
+
+  selected->data[1].position = pos;
+  selected->data[0] = (value_t){
+      .type = VALUE_TYPE_NUMBER,
+      .as.number = (number_t)index,
+      .position = pos,
+  };
+
+  value_t *value = nullptr;
+  tryCatch(result_value_ref_t,
+           valueCreate(VALUE_TYPE_LIST, (value_as_t){.list = selected}, pos),
+           valueArrayDestroy(&selected), value);
+  return ok(result_value_ref_t, value);
+}
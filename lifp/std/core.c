@@ -224,13 +224,25 @@ result_value_ref_t equal(const value_array_t *arguments, position_t pos) {
     is_equal = true;
     break;
   case VALUE_TYPE_BUILTIN:
-    is_equal = left_value.as.builtin == right_value.as.builtin;
+    is_equal = left_value.as.builtin.kind == right_value.as.builtin.kind &&
+               left_value.as.builtin.generic == right_value.as.builtin.generic;
     break;
   case VALUE_TYPE_SPECIAL:
     is_equal = left_value.as.special == right_value.as.special;
     break;
   case VALUE_TYPE_STRING:
-    is_equal = strcmp(left_value.as.string, right_value.as.string) == 0;
+    is_equal = left_value.as.length == right_value.as.length &&
+               memcmp(left_value.as.string, right_value.as.string,
+                      left_value.as.length) == 0;
+    break;
+  case VALUE_TYPE_FUTURE:
+    is_equal = left_value.as.future == right_value.as.future;
+    break;
+  case VALUE_TYPE_CHANNEL:
+    is_equal = left_value.as.channel == right_value.as.channel;
+    break;
+  case VALUE_TYPE_BUILDER:
+    is_equal = left_value.as.builder == right_value.as.builder;
     break;
   case VALUE_TYPE_CLOSURE:
   case VALUE_TYPE_LIST:
@@ -278,13 +290,25 @@ result_value_ref_t notEqual(const value_array_t *arguments, position_t pos) {
     are_equal = true;
     break;
   case VALUE_TYPE_BUILTIN:
-    are_equal = first.as.builtin == second.as.builtin;
+    are_equal = first.as.builtin.kind == second.as.builtin.kind &&
+                first.as.builtin.generic == second.as.builtin.generic;
     break;
   case VALUE_TYPE_SPECIAL:
     are_equal = first.as.special == second.as.special;
     break;
   case VALUE_TYPE_STRING:
-    are_equal = strcmp(first.as.string, second.as.string) == 0;
+    are_equal = first.as.length == second.as.length &&
+                memcmp(first.as.string, second.as.string, first.as.length) ==
+                    0;
+    break;
+  case VALUE_TYPE_FUTURE:
+    are_equal = first.as.future == second.as.future;
+    break;
+  case VALUE_TYPE_CHANNEL:
+    are_equal = first.as.channel == second.as.channel;
+    break;
+  case VALUE_TYPE_BUILDER:
+    are_equal = first.as.builder == second.as.builder;
     break;
   case VALUE_TYPE_CLOSURE:
   case VALUE_TYPE_LIST:
@@ -1,16 +1,23 @@
 // Flow control utilities for lifp. These functions provide basic control over
-// program execution, such as pausing execution for a specified duration.
+// program execution, such as pausing execution for a specified duration or
+// running tasks concurrently.
 //
 // ```lisp
 // (flow:sleep! 1000) ; pauses execution for ~1 second
+// (def! task (flow:spawn (fn () (+ 1 2)))) ; runs on another thread
+// (flow:await task) ; returns 3
 // ```
 // ___HEADER_END___
 
+#include "../../lib/pool.h"
 #include "../../lib/result.h"
 #include "../error.h"
+#include "../evaluate.h"
 #include "../fmt.h"
 #include "../value.h"
+#include "../virtual_machine.h"
 #include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -18,7 +25,8 @@
 #include <unistd.h>
 
 /**
- * Suspends execution for a given number of milliseconds.
+ * Suspends execution for a given number of milliseconds. The thread is
+ * blocked meanwhile: tasks waiting for a delay should be spawned with it.
  * @name flow:sleep!
  * @param {number} milliseconds - The number of milliseconds to sleep.
  * @returns {nil} Returns nil after sleeping for the specified duration.
@@ -53,3 +61,123 @@ result_value_ref_t flowSleep(const value_array_t *arguments, position_t pos) {
 
   return valueCreate(VALUE_TYPE_NIL, (value_as_t){}, pos);
 }
+
+static void flowRun(void *argument) {
+  future_t *future = argument;
+  value_array_t arguments = {.count = 0, .data = nullptr};
+  future->result = invokeClosure(future->closure, &arguments);
+}
+
+/**
+ * Runs a function without arguments as a task on a pool of threads, and
+ * returns a future to await its result. With a delay, the task waits on a
+ * timer without blocking any thread. Tasks share definitions with the code
+ * spawning them, and a future that is never awaited is waited for when
+ * discarded.
+ * @name flow:spawn
+ * @param {function} fn - The function to run.
+ * @param {number} [delay] - Milliseconds to wait before running it.
+ * @returns {future} The future of the result of the function.
+ * @example
+ *   (def! task (flow:spawn (fn () (+ 1 2)))) ; runs on another thread
+ *   (def! later (flow:spawn (fn () "done") 1000)) ; runs in ~1 second
+ */
+const char *FLOW_SPAWN = "flow:spawn";
+result_value_ref_t flowSpawn(const value_array_t *arguments, position_t pos) {
+  if (arguments->count < 1 || arguments->count > 2) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 1 or 2 arguments. Got %zu", FLOW_SPAWN,
+          arguments->count);
+  }
+
+  value_t closure_value = listGet(value_t, arguments, 0);
+  if (closure_value.type != VALUE_TYPE_CLOSURE) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          closure_value.position, "%s requires a function. Got %s.",
+          FLOW_SPAWN, formatValueType(closure_value.type));
+  }
+
+  if (closure_value.as.closure.arguments->count != 0) {
+    throw(result_value_ref_t, ERROR_CODE_TYPE_UNEXPECTED_ARITY,
+          closure_value.position, "%s requires a function without arguments.",
+          FLOW_SPAWN);
+  }
+
+  uint64_t delay = 0;
+  if (arguments->count == 2) {
+    value_t delay_value = listGet(value_t, arguments, 1);
+    if (delay_value.type != VALUE_TYPE_NUMBER) {
+      throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+            delay_value.position, "%s requires a number as delay. Got %s.",
+            FLOW_SPAWN, formatValueType(delay_value.type));
+    }
+
+    long milliseconds = lround(delay_value.as.number);
+    if (milliseconds < 0) {
+      throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, delay_value.position,
+            "%s requires a non-negative delay.", FLOW_SPAWN);
+    }
+    delay = (uint64_t)milliseconds;
+  }
+
+  const vm_t *machine = closure_value.as.closure.environment->machine;
+  future_t *future = nullptr;
+  tryWithMeta(result_value_ref_t, allocSafe(sizeof(future_t)), pos, future);
+  future->refcount = 1;
+  future->pool = machine->pool;
+  future->group.parent = &closure_value.as.closure.environment->tasks;
+  tryCatch(result_value_ref_t, valueDeepCopy(&closure_value),
+           deallocSafe(&future), future->closure);
+
+  value_t *value = nullptr;
+  tryCatch(
+      result_value_ref_t,
+      valueCreate(VALUE_TYPE_FUTURE, (value_as_t){.future = future}, pos),
+      {
+        valueDestroy(&future->closure);
+        deallocSafe(&future);
+      },
+      value);
+
+  // From now on, definitions reachable by the task are made under lock
+  environmentShare(future->closure->as.closure.environment);
+  poolSchedule(future->pool, &future->group, delay, flowRun, future);
+  return ok(result_value_ref_t, value);
+}
+
+/**
+ * Waits for a task to complete, running other tasks meanwhile, and returns
+ * its result. Errors of the task are raised again by every await.
+ * @name flow:await
+ * @param {future} future - The future returned by flow:spawn.
+ * @returns {any} The value returned by the task.
+ * @example
+ *   (flow:await (flow:spawn (fn () (+ 1 2)))) ; returns 3
+ */
+const char *FLOW_AWAIT = "flow:await";
+result_value_ref_t flowAwait(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 1) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 1 argument. Got %zu", FLOW_AWAIT, arguments->count);
+  }
+
+  value_t future_value = listGet(value_t, arguments, 0);
+  if (future_value.type != VALUE_TYPE_FUTURE) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          future_value.position, "%s requires a future. Got %s.", FLOW_AWAIT,
+          formatValueType(future_value.type));
+  }
+
+  future_t *future = future_value.as.future;
+  poolWait(future->pool, &future->group);
+
+  const result_value_ref_t result = future->result;
+  if (result.code != RESULT_OK) {
+    throw(result_value_ref_t, result.code, result.meta, "%s", result.message);
+  }
+
+  value_t *copy = nullptr;
+  tryWithMeta(result_value_ref_t, valueDeepCopy(result.value), pos, copy);
+  copy->position = pos;
+  return ok(result_value_ref_t, copy);
+}
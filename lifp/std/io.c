@@ -1,4 +1,6 @@
-// Input/output utilities for lifp. These functions provide basic console IO.
+// Input/output utilities for lifp. These functions provide basic console IO,
+// and reads and writes of files and pipes which do not block any thread while
+// waiting for data.
 //
 // ```lisp
 // (io:stdout! "hello") ; prints to stdout
@@ -6,30 +8,86 @@
 // (io:printf! "Hello, {}!" ["world"]) ; prints formatted string
 // (io:readline! "Enter your name: ") ; reads a line from stdin
 // (io:clear!) ; clears the terminal
+// (io:flush!) ; writes buffered output
+// (io:read-file "notes.txt") ; returns the content of a file
+// (io:lines (fn (n line i) (+ n 1)) 0 "notes.txt") ; counts lines of a file
+// (io:write-file! "out.txt" ("a" "b")) ; writes strings to a file
+// (flow:await (io:read-async "/tmp/pipe" (fn (text) text))) ; reads a pipe
 // ```
 // ___HEADER_END___
 
+#include "../../lib/hash.h"
+#include "../../lib/pool.h"
 #include "../../lib/result.h"
+#include "../../lib/writer.h"
 #include "../error.h"
+#include "../evaluate.h"
 #include "../fmt.h"
 #include "../value.h"
+#include "../virtual_machine.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
-constexpr size_t INTERMEDIATE_BUFFER_SIZE = 1024;
+constexpr size_t LINES_BLOCK_SIZE = 65536;
+// Below the limit of vectors in a single writev on every supported system
+constexpr size_t WRITE_VECTORS = 1024;
+constexpr size_t INITIAL_READ_CAPACITY = 4096;
+
+// Standard streams are shared by all the machines of the process, and so are
+// their writers. Output is flushed by line on terminals only, while errors
+// are written right away.
+static writer_t io_stdout;
+static writer_t io_stderr;
+static pthread_once_t io_writers_once = PTHREAD_ONCE_INIT;
+
+static void ioInitWriters(void) {
+  writerInit(&io_stdout, stdout,
+             isatty(fileno(stdout)) ? WRITER_FLUSH_LINE : WRITER_FLUSH_FULL);
+  writerInit(&io_stderr, stderr, WRITER_FLUSH_WRITE);
+}
+
+static writer_t *ioWriter(FILE *stream) {
+  pthread_once(&io_writers_once, ioInitWriters);
+  return stream == stderr ? &io_stderr : &io_stdout;
+}
+
+void vmFlush(void) {
+  writerFlush(ioWriter(stdout));
+  writerFlush(ioWriter(stderr));
+}
+
+static void writerSinkWrite(void *context, const char *bytes, size_t count) {
+  writerWrite(context, bytes, count);
+}
+
+// Values are formatted straight into the writer, whatever their size
+static format_sink_t writerSink(writer_t *writer) {
+  return (format_sink_t){.write = writerSinkWrite, .context = writer};
+}
 
 static void streamPrint(FILE *stream, value_t *value) {
-  char buffer[INTERMEDIATE_BUFFER_SIZE];
+  writer_t *writer = ioWriter(stream);
 
   if (value->type != VALUE_TYPE_STRING) {
-    int offset = 0;
-    formatValue(value, INTERMEDIATE_BUFFER_SIZE, buffer, &offset);
-    fprintf(stream, "%s\n", buffer);
+    formatValueTo(value, writerSink(writer));
+    writerWrite(writer, "\n", 1);
   } else {
     // This prevents printing quotes in the formatted string
-    fprintf(stream, "%s\n", value->as.string);
+    writerWriteLine(writer, value->as.string, value->as.length);
   }
 }
 
@@ -75,6 +133,111 @@ result_value_ref_t ioStderr(const value_array_t *arguments, position_t pos) {
   return valueCreate(VALUE_TYPE_NIL, (value_as_t){}, pos);
 }
 
+// Format strings are compiled into runs of literal text, each followed by a
+// placeholder but the last one. Scripts print with few distinct formats, so
+// compiled formats are kept in a small cache indexed by hash, and replaced on
+// collisions.
+static constexpr size_t FORMAT_CACHE_SLOTS = 64;
+
+typedef struct {
+  size_t offset;
+  size_t length;
+} format_run_t;
+
+typedef struct {
+  atomic_size_t refcount; // Held by the cache and by every printing thread
+  uint64_t hash;
+  size_t length;
+  char *text;
+  size_t placeholders;
+  format_run_t runs[]; // One more than placeholders
+} format_t;
+
+static format_t *format_cache[FORMAT_CACHE_SLOTS];
+static pthread_mutex_t format_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void formatRelease(format_t **self) {
+  if (!self || !*self)
+    return;
+
+  if (atomic_fetch_sub(&(*self)->refcount, 1) > 1) {
+    *self = nullptr;
+    return;
+  }
+
+  deallocSafe(&(*self)->text);
+  deallocSafe(self);
+}
+
+// Returns the offset of the first placeholder from an offset, or the length
+static size_t formatNextPlaceholder(const char *text, size_t length,
+                                   size_t offset) {
+  for (size_t i = offset; i + 1 < length; i++) {
+    if (text[i] == '{' && text[i + 1] == '}')
+      return i;
+  }
+  return length;
+}
+
+static result_ref_t formatCompile(const char *text, size_t length,
+                                  uint64_t hash) {
+  size_t placeholders = 0;
+  for (size_t found = formatNextPlaceholder(text, length, 0); found < length;
+       found = formatNextPlaceholder(text, length, found + 2)) {
+    placeholders++;
+  }
+
+  format_t *format = nullptr;
+  try(result_ref_t,
+      allocSafe(sizeof(format_t) + sizeof(format_run_t) * (placeholders + 1)),
+      format);
+  tryCatch(result_ref_t, allocSafe(length + 1), deallocSafe(&format),
+           format->text);
+  memcpy(format->text, text, length);
+  format->hash = hash;
+  format->length = length;
+  format->placeholders = placeholders;
+
+  size_t offset = 0;
+  for (size_t i = 0; i < placeholders; i++) {
+    const size_t end = formatNextPlaceholder(text, length, offset);
+    format->runs[i] = (format_run_t){.offset = offset, .length = end - offset};
+    offset = end + 2;
+  }
+  format->runs[placeholders] =
+      (format_run_t){.offset = offset, .length = length - offset};
+
+  return ok(result_ref_t, format);
+}
+
+// Returns the compiled format, to be released after use
+static result_ref_t formatAcquire(const char *text, size_t length) {
+  const uint64_t hash = hashBytes(HASH_SEED, length, text);
+  const size_t slot = hash % FORMAT_CACHE_SLOTS;
+
+  pthread_mutex_lock(&format_cache_lock);
+  format_t *cached = format_cache[slot];
+  if (cached && cached->hash == hash && cached->length == length &&
+      memcmp(cached->text, text, length) == 0) {
+    atomic_fetch_add(&cached->refcount, 1);
+    pthread_mutex_unlock(&format_cache_lock);
+    return ok(result_ref_t, cached);
+  }
+  pthread_mutex_unlock(&format_cache_lock);
+
+  format_t *format = nullptr;
+  try(result_ref_t, formatCompile(text, length, hash), format);
+  format->refcount = 2;
+
+  pthread_mutex_lock(&format_cache_lock);
+  format_t *replaced = format_cache[slot];
+  format_cache[slot] = format;
+  pthread_mutex_unlock(&format_cache_lock);
+  formatRelease(&replaced);
+
+  return ok(result_ref_t, format);
+}
+
 /**
  * Prints a formatted string to standard output, replacing each '{}' in the
  * format string with the corresponding value from the list.
@@ -110,44 +273,37 @@ result_value_ref_t ioPrintf(const value_array_t *arguments, position_t pos) {
   }
 
   value_array_t *inputs = inputs_value.as.list;
-  char *format = format_value.as.string;
+  format_t *format = nullptr;
+  tryWithMeta(result_value_ref_t,
+              formatAcquire(format_value.as.string, format_value.as.length),
+              pos, format);
 
-  size_t placeholder_count = 0;
-  const char *placeholder = format;
-  while ((placeholder = strstr(placeholder, "{}")) != nullptr) {
-    placeholder++;
-    placeholder_count++;
-  }
-
-  if (placeholder_count > inputs->count) {
+  const size_t placeholders = format->placeholders;
+  if (placeholders > inputs->count) {
+    formatRelease(&format);
     throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, format_value.position,
           "Cannot have more placeholders than values. "
           "Got %lu placeholders and %lu values.",
-          placeholder_count, inputs->count);
-  }
-
-  size_t index = 0;
-  const char *current = format;
-  while (*current) {
-    if (*current == '{' && *(current + 1) == '}') {
-      value_t value = listGet(value_t, inputs, index);
-      if (value.type != VALUE_TYPE_STRING) {
-        char buffer[INTERMEDIATE_BUFFER_SIZE];
-        int offset = 0;
-        formatValue(&value, INTERMEDIATE_BUFFER_SIZE, buffer, &offset);
-        fputs(buffer, stdout);
-      } else {
-        // This prevents printing quotes in the formatted string
-        fputs(value.as.string, stdout);
-      }
-      index++;
-      current += 2;
-      continue;
+          placeholders, inputs->count);
+  }
+
+  writer_t *writer = ioWriter(stdout);
+  for (size_t index = 0; index < placeholders; index++) {
+    const format_run_t run = format->runs[index];
+    writerWrite(writer, format->text + run.offset, run.length);
+
+    value_t value = listGet(value_t, inputs, index);
+    if (value.type != VALUE_TYPE_STRING) {
+      formatValueTo(&value, writerSink(writer));
+    } else {
+      // This prevents printing quotes in the formatted string
+      writerWrite(writer, value.as.string, value.as.length);
     }
-    putchar(*current);
-    current++;
   }
+  const format_run_t last = format->runs[placeholders];
+  writerWrite(writer, format->text + last.offset, last.length);
 
+  formatRelease(&format);
   return valueCreate(VALUE_TYPE_NIL, (value_as_t){}, pos);
 }
 
@@ -174,25 +330,28 @@ result_value_ref_t ioReadline(const value_array_t *arguments, position_t pos) {
           formatValueType(question_value.type));
   }
 
-  printf("%s", question_value.as.string);
+  // The prompt must be visible before waiting for the answer
+  writer_t *writer = ioWriter(stdout);
+  writerWrite(writer, question_value.as.string, question_value.as.length);
+  writerFlush(writer);
 
-  char buffer[INTERMEDIATE_BUFFER_SIZE];
-  if (fgets(buffer, sizeof(buffer), stdin) == nullptr) {
+  // Lines are read whole, however long they are
+  char *line = nullptr;
+  size_t size = 0;
+  ssize_t len = getline(&line, &size, stdin);
+  if (len < 0) {
+    free(line);
     return valueCreate(VALUE_TYPE_STRING, (value_as_t){.string = strdup("")},
                        pos);
   }
 
   // Remove trailing newline if present
-  size_t len = strlen(buffer);
-  if (len > 0 && buffer[len - 1] == '\n') {
-    buffer[len - 1] = '\0';
+  if (len > 0 && line[len - 1] == '\n') {
+    line[--len] = '\0';
   }
 
   return valueCreate(VALUE_TYPE_STRING,
-                     (value_as_t){
-                         .string = strdup(buffer),
-                     },
-                     pos);
+                     (value_as_t){.string = line, .length = (size_t)len}, pos);
 }
 
 /**
@@ -208,6 +367,833 @@ result_value_ref_t ioClear(const value_array_t *arguments, position_t pos) {
     throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
           "%s requires no arguments. Got %zu", IO_CLEAR, arguments->count);
   }
-  puts("\e[1;1H\e[2J");
+  const char clear[] = "\e[1;1H\e[2J";
+  writerWriteLine(ioWriter(stdout), clear, sizeof(clear) - 1);
   return valueCreate(VALUE_TYPE_NIL, (value_as_t){}, pos);
 }
+
+/**
+ * Writes the output buffered by io:stdout!, io:printf! and the like. Output
+ * is otherwise written once the buffer is full, at the end of every line on
+ * terminals, and when the program ends.
+ * @name io:flush!
+ * @returns {nil} Returns nil.
+ * @example
+ *   (io:printf! "Loading..." ())
+ *   (io:flush!)
+ */
+const char *IO_FLUSH = "io:flush!";
+result_value_ref_t ioFlush(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 0) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires no arguments. Got %zu", IO_FLUSH, arguments->count);
+  }
+  vmFlush();
+  return valueCreate(VALUE_TYPE_NIL, (value_as_t){}, pos);
+}
+
+// State of a read or write carried across the steps of its task: every step
+// transfers as much as possible without blocking, then either watches the
+// descriptor again or calls the function waiting for the transfer.
+typedef struct {
+  const char *name;
+  future_t *future;
+  int fd;
+  char *buffer;    // Bytes read so far, or the string to write
+  size_t count;    // Bytes read or written so far
+  size_t capacity; // Size of the buffer, or of the string to write
+  int error;       // Error number of a failed read or write
+  position_t position;
+} io_transfer_t;
+
+static result_value_ref_t ioFailure(const io_transfer_t *self) {
+  throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, self->position,
+        "%s failed: %s", self->name, strerror(self->error));
+}
+
+static void ioFinish(io_transfer_t *self, value_t *argument) {
+  close(self->fd);
+
+  future_t *future = self->future;
+  if (self->error != 0) {
+    future->result = ioFailure(self);
+  } else {
+    value_array_t arguments = {.count = 1, .data = argument};
+    future->result = invokeClosure(future->closure, &arguments);
+  }
+
+  deallocSafe(&self->buffer);
+  deallocSafe(&self);
+}
+
+static void ioReadStep(void *argument) {
+  io_transfer_t *self = argument;
+
+  while (true) {
+    // One byte is kept for the terminator
+    if (self->count + 1 == self->capacity) {
+      result_ref_t allocation = allocSafe(self->capacity * 2);
+      if (allocation.code != RESULT_OK) {
+        self->error = ENOMEM;
+        break;
+      }
+      memcpy(allocation.value, self->buffer, self->count);
+      deallocSafe(&self->buffer);
+      self->buffer = allocation.value;
+      self->capacity *= 2;
+    }
+
+    const ssize_t count = read(self->fd, self->buffer + self->count,
+                               self->capacity - self->count - 1);
+    if (count > 0) {
+      self->count += (size_t)count;
+      continue;
+    }
+
+    if (count < 0 && errno == EINTR)
+      continue;
+
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      poolWatch(self->future->pool, &self->future->group, self->fd, POLLIN,
+                ioReadStep, self);
+      return;
+    }
+
+    if (count < 0)
+      self->error = errno;
+    break;
+  }
+
+  self->buffer[self->count] = 0;
+  value_t content = {
+      .type = VALUE_TYPE_STRING,
+      .as.string = self->buffer,
+      .as.length = self->count,
+      .position = self->position,
+  };
+  ioFinish(self, &content);
+}
+
+static void ioWriteStep(void *argument) {
+  io_transfer_t *self = argument;
+
+  while (self->count < self->capacity) {
+    const ssize_t count = write(self->fd, self->buffer + self->count,
+                                self->capacity - self->count);
+    if (count >= 0) {
+      self->count += (size_t)count;
+      continue;
+    }
+
+    if (errno == EINTR)
+      continue;
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      poolWatch(self->future->pool, &self->future->group, self->fd, POLLOUT,
+                ioWriteStep, self);
+      return;
+    }
+
+    self->error = errno;
+    break;
+  }
+
+  value_t written = {
+      .type = VALUE_TYPE_NUMBER,
+      .as.number = (number_t)self->count,
+      .position = self->position,
+  };
+  ioFinish(self, &written);
+}
+
+// Returns a future completed once the transfer is, and starts the transfer as
+// soon as the descriptor is ready. The transfer is freed on failure.
+static result_value_ref_t ioTransferStart(io_transfer_t *transfer,
+                                          value_t closure_value, short events,
+                                          pool_task_t step) {
+  const position_t pos = transfer->position;
+  const vm_t *machine = closure_value.as.closure.environment->machine;
+
+  future_t *future = nullptr;
+  tryCatchWithMeta(
+      result_value_ref_t, allocSafe(sizeof(future_t)),
+      {
+        close(transfer->fd);
+        deallocSafe(&transfer->buffer);
+        deallocSafe(&transfer);
+      },
+      pos, future);
+  future->refcount = 1;
+  future->pool = machine->pool;
+  future->group.parent = &closure_value.as.closure.environment->tasks;
+  tryCatch(
+      result_value_ref_t, valueDeepCopy(&closure_value),
+      {
+        deallocSafe(&future);
+        close(transfer->fd);
+        deallocSafe(&transfer->buffer);
+        deallocSafe(&transfer);
+      },
+      future->closure);
+
+  value_t *value = nullptr;
+  tryCatch(
+      result_value_ref_t,
+      valueCreate(VALUE_TYPE_FUTURE, (value_as_t){.future = future}, pos),
+      {
+        valueDestroy(&future->closure);
+        deallocSafe(&future);
+        close(transfer->fd);
+        deallocSafe(&transfer->buffer);
+        deallocSafe(&transfer);
+      },
+      value);
+
+  // The function runs on another thread, like the ones of flow:spawn
+  environmentShare(future->closure->as.closure.environment);
+  transfer->future = future;
+  poolWatch(future->pool, &future->group, transfer->fd, events, step,
+            transfer);
+  return ok(result_value_ref_t, value);
+}
+
+// Paths are passed to the system terminated, which views of longer strings
+// are not, so they are copied to a buffer first
+static result_void_position_t ioPath(const char *name, value_t path_value,
+                                     char path[static PATH_MAX]) {
+  if (path_value.as.length >= PATH_MAX) {
+    throw(result_void_position_t, ERROR_CODE_RUNTIME_ERROR,
+          path_value.position, "%s requires a path shorter than %d bytes.",
+          name, PATH_MAX);
+  }
+
+  memcpy(path, path_value.as.string, path_value.as.length);
+  path[path_value.as.length] = 0;
+  return ok(result_void_position_t);
+}
+
+static result_void_position_t ioCheckTransfer(const char *name,
+                                              value_t path_value,
+                                              value_t closure_value) {
+  if (path_value.type != VALUE_TYPE_STRING) {
+    throw(result_void_position_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          path_value.position, "%s requires a path. Got %s.", name,
+          formatValueType(path_value.type));
+  }
+
+  if (closure_value.type != VALUE_TYPE_CLOSURE) {
+    throw(result_void_position_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          closure_value.position, "%s requires a function. Got %s.", name,
+          formatValueType(closure_value.type));
+  }
+
+  if (closure_value.as.closure.arguments->count != 1) {
+    throw(result_void_position_t, ERROR_CODE_TYPE_UNEXPECTED_ARITY,
+          closure_value.position, "%s requires a function of 1 argument.",
+          name);
+  }
+
+  return ok(result_void_position_t);
+}
+
+/**
+ * Reads a file or a pipe until its end, and calls a function with its content
+ * on a pool of threads. No thread is blocked while waiting for data, so many
+ * pipes can be read at once. The pipe must have a writer when it is read.
+ * @name io:read-async
+ * @param {string} path - The path of the file or the pipe.
+ * @param {function} fn - The function called with the content.
+ * @returns {future} The future of the result of the function.
+ * @example
+ *   (def! reading (io:read-async "/tmp/pipe" (fn (text) (str:length text))))
+ *   (flow:await reading) ; returns the length of the content
+ */
+const char *IO_READ_ASYNC = "io:read-async";
+result_value_ref_t ioReadAsync(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 2) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 2 arguments. Got %zu", IO_READ_ASYNC, arguments->count);
+  }
+
+  value_t path_value = listGet(value_t, arguments, 0);
+  value_t closure_value = listGet(value_t, arguments, 1);
+  try(result_value_ref_t,
+      ioCheckTransfer(IO_READ_ASYNC, path_value, closure_value));
+  char path[PATH_MAX];
+  try(result_value_ref_t, ioPath(IO_READ_ASYNC, path_value, path));
+
+  const int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, path_value.position,
+          "%s cannot open %.*s: %s", IO_READ_ASYNC,
+          (int)path_value.as.length, path_value.as.string, strerror(errno));
+  }
+
+  io_transfer_t *transfer = nullptr;
+  tryCatchWithMeta(result_value_ref_t, allocSafe(sizeof(io_transfer_t)),
+                   close(fd), pos, transfer);
+  transfer->name = IO_READ_ASYNC;
+  transfer->fd = fd;
+  transfer->capacity = INITIAL_READ_CAPACITY;
+  transfer->position = pos;
+  tryCatchWithMeta(
+      result_value_ref_t, allocSafe(transfer->capacity),
+      {
+        close(fd);
+        deallocSafe(&transfer);
+      },
+      pos, transfer->buffer);
+
+  return ioTransferStart(transfer, closure_value, POLLIN, ioReadStep);
+}
+
+/**
+ * Writes a string to a file or a pipe, replacing the content of files, and
+ * calls a function with the number of bytes written on a pool of threads. No
+ * thread is blocked while the pipe is full. The pipe must have a reader when
+ * it is opened.
+ * @name io:write-async!
+ * @param {string} path - The path of the file or the pipe.
+ * @param {string} content - The string to write.
+ * @param {function} fn - The function called with the number of bytes.
+ * @returns {future} The future of the result of the function.
+ * @example
+ *   (flow:await (io:write-async! "/tmp/out" "hello" (fn (n) n))) ; returns 5
+ */
+const char *IO_WRITE_ASYNC = "io:write-async!";
+result_value_ref_t ioWriteAsync(const value_array_t *arguments,
+                                position_t pos) {
+  if (arguments->count != 3) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 3 arguments. Got %zu", IO_WRITE_ASYNC,
+          arguments->count);
+  }
+
+  value_t path_value = listGet(value_t, arguments, 0);
+  value_t content_value = listGet(value_t, arguments, 1);
+  value_t closure_value = listGet(value_t, arguments, 2);
+  try(result_value_ref_t,
+      ioCheckTransfer(IO_WRITE_ASYNC, path_value, closure_value));
+  char path[PATH_MAX];
+  try(result_value_ref_t, ioPath(IO_WRITE_ASYNC, path_value, path));
+
+  if (content_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          content_value.position, "%s requires a string. Got %s.",
+          IO_WRITE_ASYNC, formatValueType(content_value.type));
+  }
+
+  const int fd =
+      open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, path_value.position,
+          "%s cannot open %.*s: %s", IO_WRITE_ASYNC,
+          (int)path_value.as.length, path_value.as.string, strerror(errno));
+  }
+
+  io_transfer_t *transfer = nullptr;
+  tryCatchWithMeta(result_value_ref_t, allocSafe(sizeof(io_transfer_t)),
+                   close(fd), pos, transfer);
+  transfer->name = IO_WRITE_ASYNC;
+  transfer->fd = fd;
+  transfer->capacity = content_value.as.length;
+  transfer->position = pos;
+  tryCatchWithMeta(
+      result_value_ref_t, allocSafe(transfer->capacity + 1),
+      {
+        close(fd);
+        deallocSafe(&transfer);
+      },
+      pos, transfer->buffer);
+  memcpy(transfer->buffer, content_value.as.string, transfer->capacity);
+
+  return ioTransferStart(transfer, closure_value, POLLOUT, ioWriteStep);
+}
+
+// Reads what is left of a file into a heap string. Returns null and sets
+// errno on failure.
+static char *ioReadRest(int fd, size_t *length) {
+  size_t capacity = INITIAL_READ_CAPACITY;
+  size_t count = 0;
+  result_ref_t allocation = allocSafe(capacity);
+  if (allocation.code != RESULT_OK) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  char *buffer = allocation.value;
+
+  while (true) {
+    // One byte is kept for the terminator
+    if (count + 1 == capacity) {
+      allocation = allocSafe(capacity * 2);
+      if (allocation.code != RESULT_OK) {
+        deallocSafe(&buffer);
+        errno = ENOMEM;
+        return nullptr;
+      }
+      memcpy(allocation.value, buffer, count);
+      deallocSafe(&buffer);
+      buffer = allocation.value;
+      capacity *= 2;
+    }
+
+    const ssize_t read_count = read(fd, buffer + count, capacity - count - 1);
+    if (read_count > 0) {
+      count += (size_t)read_count;
+      continue;
+    }
+    if (read_count < 0 && errno == EINTR)
+      continue;
+    if (read_count < 0) {
+      deallocSafe(&buffer);
+      return nullptr;
+    }
+    break;
+  }
+
+  buffer[count] = 0;
+  *length = count;
+  return buffer;
+}
+
+/**
+ * Reads a whole file into a string. Regular files are mapped in memory rather
+ * than copied, and stay mapped as long as the string, or a slice of it, is
+ * alive.
+ * @name io:read-file
+ * @param {string} path - The path of the file.
+ * @returns {string} The content of the file.
+ * @example
+ *   (io:read-file "notes.txt") ; returns the content of notes.txt
+ */
+const char *IO_READ_FILE = "io:read-file";
+result_value_ref_t ioReadFile(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 1) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 1 argument. Got %zu", IO_READ_FILE, arguments->count);
+  }
+
+  value_t path_value = listGet(value_t, arguments, 0);
+  if (path_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          path_value.position, "%s requires a path. Got %s.", IO_READ_FILE,
+          formatValueType(path_value.type));
+  }
+  char path[PATH_MAX];
+  try(result_value_ref_t, ioPath(IO_READ_FILE, path_value, path));
+
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat status;
+  if (fd < 0 || fstat(fd, &status) != 0) {
+    const int error = errno;
+    if (fd >= 0)
+      close(fd);
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, path_value.position,
+          "%s cannot open %.*s: %s", IO_READ_FILE,
+          (int)path_value.as.length, path_value.as.string, strerror(error));
+  }
+
+  // The mapping is zero-filled past the end of the file up to the end of its
+  // last page, which terminates the string. Empty files, files filling their
+  // last page, and pipes are read instead.
+  const size_t size = (size_t)status.st_size;
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  if (S_ISREG(status.st_mode) && size % page != 0) {
+    char *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, path_value.position,
+            "%s cannot map %.*s: %s", IO_READ_FILE,
+            (int)path_value.as.length, path_value.as.string, strerror(errno));
+    }
+
+    const size_t mapped = (size / page + 1) * page;
+    string_storage_t *storage = nullptr;
+    tryCatchWithMeta(result_value_ref_t, allocSafe(sizeof(string_storage_t)),
+                     munmap(mapping, mapped), pos, storage);
+    storage->refcount = 1;
+    storage->length = size;
+    storage->capacity = size;
+    storage->mapped = mapped;
+    storage->data = mapping;
+
+    value_t *value = nullptr;
+    tryCatch(result_value_ref_t,
+             valueCreate(VALUE_TYPE_STRING,
+                         (value_as_t){
+                             .string = mapping,
+                             .length = size,
+                             .storage = storage,
+                         },
+                         pos),
+             stringStorageRelease(&storage), value);
+    return ok(result_value_ref_t, value);
+  }
+
+  size_t length = 0;
+  char *buffer = ioReadRest(fd, &length);
+  const int error = errno;
+  close(fd);
+  if (!buffer) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, path_value.position,
+          "%s cannot read %.*s: %s", IO_READ_FILE,
+          (int)path_value.as.length, path_value.as.string, strerror(error));
+  }
+
+  value_t *value = nullptr;
+  tryCatch(result_value_ref_t,
+           valueCreate(VALUE_TYPE_STRING,
+                       (value_as_t){.string = buffer, .length = length}, pos),
+           deallocSafe(&buffer), value);
+  return ok(result_value_ref_t, value);
+}
+
+typedef struct {
+  FILE *stream; // Set for stdin, which io:readline! can have buffered
+  int fd;
+  char *buffer;
+  size_t start;    // First byte not yielded yet
+  size_t end;      // End of the bytes read so far
+  size_t capacity; // Grows only for lines longer than the buffer
+  bool done;
+} io_lines_t;
+
+// Whether a line was found before the end of the input
+typedef Result(bool, position_t) result_line_t;
+
+// Finds the next line in the buffer, reading more when the buffer has no
+// complete line. Reads return what is available, so that lines written to a
+// pipe reach the reducer without waiting for a whole block.
+// Lines of a stream are read whole by getline, which grows the buffer
+static result_line_t ioNextStreamLine(const char *name, io_lines_t *self,
+                                      const char **line, size_t *length,
+                                      position_t pos) {
+  ssize_t count = getline(&self->buffer, &self->capacity, self->stream);
+  while (count < 0 && ferror(self->stream) && errno == EINTR) {
+    clearerr(self->stream);
+    count = getline(&self->buffer, &self->capacity, self->stream);
+  }
+
+  if (count < 0) {
+    if (ferror(self->stream)) {
+      throw(result_line_t, ERROR_CODE_RUNTIME_ERROR, pos,
+            "%s failed to read the lines: %s", name, strerror(errno));
+    }
+    return ok(result_line_t, false);
+  }
+
+  *line = self->buffer;
+  *length = (size_t)count;
+  if (*length > 0 && self->buffer[*length - 1] == '\n') {
+    (*length)--;
+  }
+  return ok(result_line_t, true);
+}
+
+static result_line_t ioNextLine(const char *name, io_lines_t *self,
+                                const char **line, size_t *length,
+                                position_t pos) {
+  if (self->stream)
+    return ioNextStreamLine(name, self, line, length, pos);
+
+  while (true) {
+    const char *from = self->buffer + self->start;
+    const char *newline = memchr(from, '\n', self->end - self->start);
+    if (newline) {
+      *line = from;
+      *length = (size_t)(newline - from);
+      self->start += *length + 1;
+      return ok(result_line_t, true);
+    }
+
+    if (self->done) {
+      if (self->start == self->end)
+        return ok(result_line_t, false);
+      // The last line has no trailing newline
+      *line = from;
+      *length = self->end - self->start;
+      self->start = self->end;
+      return ok(result_line_t, true);
+    }
+
+    memmove(self->buffer, from, self->end - self->start);
+    self->end -= self->start;
+    self->start = 0;
+
+    if (self->end == self->capacity) {
+      char *buffer = nullptr;
+      tryWithMeta(result_line_t, allocSafe(self->capacity * 2), pos, buffer);
+      memcpy(buffer, self->buffer, self->end);
+      deallocSafe(&self->buffer);
+      self->buffer = buffer;
+      self->capacity *= 2;
+    }
+
+    ssize_t count = 0;
+    do {
+      count = read(self->fd, self->buffer + self->end,
+                   self->capacity - self->end);
+    } while (count < 0 && errno == EINTR);
+
+    if (count < 0) {
+      throw(result_line_t, ERROR_CODE_RUNTIME_ERROR, pos,
+            "%s failed to read the lines: %s", name, strerror(errno));
+    }
+    self->end += (size_t)count;
+    self->done = count == 0;
+  }
+}
+
+static result_value_ref_t ioFoldLines(const char *name, io_lines_t *lines,
+                                      value_t closure_value,
+                                      value_t initial_value, position_t pos) {
+  value_t *accum = nullptr;
+  tryWithMeta(result_value_ref_t, valueDeepCopy(&initial_value), pos, accum);
+
+  // Arguments are borrowed from the loop, so the array is not destroyed
+  value_t closure_data[3];
+  value_array_t closure_args = {.count = 3, .data = closure_data};
+
+  const char *line = nullptr;
+  size_t length = 0;
+  for (size_t i = 0;; i++) {
+    bool found = false;
+    tryCatch(result_value_ref_t, ioNextLine(name, lines, &line, &length, pos),
+             valueDestroy(&accum), found);
+    if (!found)
+      break;
+
+    char *text = nullptr;
+    tryCatchWithMeta(result_value_ref_t, allocSafe(length + 1),
+                     valueDestroy(&accum), pos, text);
+    memcpy(text, line, length);
+
+    closure_data[0] = *accum;
+    closure_data[1] = (value_t){
+        .type = VALUE_TYPE_STRING,
+        .as.string = text,
+        .as.length = length,
+        .position = pos,
+    };
+    closure_data[2] = (value_t){
+        .type = VALUE_TYPE_NUMBER,
+        .as.number = (number_t)i,
+        .position = pos,
+    };
+
+    value_t *result = nullptr;
+    tryCatch(
+        result_value_ref_t, invokeClosure(&closure_value, &closure_args),
+        {
+          deallocSafe(&text);
+          valueDestroy(&accum);
+        },
+        result);
+    deallocSafe(&text);
+    valueDestroy(&accum);
+    accum = result;
+  }
+
+  return ok(result_value_ref_t, accum);
+}
+
+/**
+ * Reduces the lines of a file, or of the standard input, to a single value.
+ * Lines are read lazily, as soon as they are available, so files of any size
+ * are processed in constant memory and pipes are processed as they are
+ * written. Lines do not include the trailing newline.
+ * @name io:lines
+ * @param {function} fn - The reducer function (fn previous line index).
+ * @param {any} initial - The initial value to accumulate over.
+ * @param {string} [path] - The path of the file. Reads stdin if omitted.
+ * @returns {any} The final reduced value.
+ * @example
+ *   (io:lines (fn (n line i) (+ n 1)) 0 "notes.txt") ; returns the line count
+ */
+const char *IO_LINES = "io:lines";
+result_value_ref_t ioLines(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 2 && arguments->count != 3) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 2 or 3 arguments. Got %zu", IO_LINES,
+          arguments->count);
+  }
+
+  value_t closure_value = listGet(value_t, arguments, 0);
+  value_t initial_value = listGet(value_t, arguments, 1);
+  if (closure_value.type != VALUE_TYPE_CLOSURE) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          closure_value.position,
+          "%s requires a function as first argument. Got %s.", IO_LINES,
+          formatValueType(closure_value.type));
+  }
+
+  // Bytes of stdin can already be buffered by its stream for io:readline!,
+  // so stdin is read through the stream and only opened files directly
+  io_lines_t lines = {.stream = stdin, .fd = -1};
+  if (arguments->count == 2) {
+    result_value_ref_t result =
+        ioFoldLines(IO_LINES, &lines, closure_value, initial_value, pos);
+    free(lines.buffer);
+    return result;
+  }
+
+  value_t path_value = listGet(value_t, arguments, 2);
+  if (path_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          path_value.position, "%s requires a path as third argument. Got %s.",
+          IO_LINES, formatValueType(path_value.type));
+  }
+
+  char path[PATH_MAX];
+  try(result_value_ref_t, ioPath(IO_LINES, path_value, path));
+
+  lines = (io_lines_t){.fd = open(path, O_RDONLY | O_CLOEXEC),
+                       .capacity = LINES_BLOCK_SIZE};
+  if (lines.fd < 0) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, path_value.position,
+          "%s cannot open %.*s: %s", IO_LINES, (int)path_value.as.length,
+          path_value.as.string, strerror(errno));
+  }
+
+  tryCatchWithMeta(result_value_ref_t, allocSafe(lines.capacity),
+                   close(lines.fd), pos, lines.buffer);
+
+  result_value_ref_t result =
+      ioFoldLines(IO_LINES, &lines, closure_value, initial_value, pos);
+  deallocSafe(&lines.buffer);
+  close(lines.fd);
+  return result;
+}
+
+// Writes every vector, resuming after partial writes. Returns false and sets
+// errno on failure.
+static bool ioWriteVectors(int fd, struct iovec *vectors, size_t count) {
+  while (count > 0) {
+    const size_t batch = count < WRITE_VECTORS ? count : WRITE_VECTORS;
+    ssize_t written = writev(fd, vectors, (int)batch);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0)
+      return false;
+
+    while (count > 0 && (size_t)written >= vectors->iov_len) {
+      written -= (ssize_t)vectors->iov_len;
+      vectors++;
+      count--;
+    }
+    if (count > 0) {
+      vectors->iov_base = (char *)vectors->iov_base + written;
+      vectors->iov_len -= (size_t)written;
+    }
+  }
+  return true;
+}
+
+static result_value_ref_t ioWriteFragments(const char *name, int flags,
+                                           const value_array_t *arguments,
+                                           position_t pos) {
+  if (arguments->count != 2) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 2 arguments. Got %zu", name, arguments->count);
+  }
+
+  value_t path_value = listGet(value_t, arguments, 0);
+  value_t content_value = listGet(value_t, arguments, 1);
+  if (path_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          path_value.position, "%s requires a path. Got %s.", name,
+          formatValueType(path_value.type));
+  }
+  char path[PATH_MAX];
+  try(result_value_ref_t, ioPath(name, path_value, path));
+
+  // A single string is written as a list of one
+  value_array_t single = {.count = 1, .data = &content_value};
+  const value_array_t *fragments = &single;
+  if (content_value.type == VALUE_TYPE_LIST) {
+    fragments = content_value.as.list;
+  } else if (content_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          content_value.position,
+          "%s requires a string or a list of strings. Got %s.", name,
+          formatValueType(content_value.type));
+  }
+
+  for (size_t i = 0; i < fragments->count; i++) {
+    value_t fragment = listGet(value_t, fragments, i);
+    if (fragment.type != VALUE_TYPE_STRING) {
+      throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+            fragment.position, "%s requires a list of strings. Got %s.", name,
+            formatValueType(fragment.type));
+    }
+  }
+
+  struct iovec *vectors = nullptr;
+  if (fragments->count > 0) {
+    tryWithMeta(result_value_ref_t,
+                allocSafe(sizeof(struct iovec) * fragments->count), pos,
+                vectors);
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < fragments->count; i++) {
+    vectors[i].iov_base = fragments->data[i].as.string;
+    vectors[i].iov_len = fragments->data[i].as.length;
+    total += vectors[i].iov_len;
+  }
+
+  const int fd =
+      open(path, O_WRONLY | O_CREAT | O_CLOEXEC | flags, 0644);
+  if (fd < 0) {
+    const int error = errno;
+    deallocSafe(&vectors);
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, path_value.position,
+          "%s cannot open %.*s: %s", name,
+          (int)path_value.as.length, path_value.as.string, strerror(error));
+  }
+
+  const bool written = ioWriteVectors(fd, vectors, fragments->count);
+  const int error = errno;
+  close(fd);
+  deallocSafe(&vectors);
+  if (!written) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, path_value.position,
+          "%s cannot write %.*s: %s", name,
+          (int)path_value.as.length, path_value.as.string, strerror(error));
+  }
+
+  return valueCreate(VALUE_TYPE_NUMBER, (value_as_t){.number = (number_t)total},
+                     pos);
+}
+
+/**
+ * Writes a string, or a list of strings one after the other, to a file
+ * replacing its content. Lists are written as they are, without joining them
+ * into a single string first.
+ * @name io:write-file!
+ * @param {string} path - The path of the file.
+ * @param {string|list} content - The string or the list of strings to write.
+ * @returns {number} The number of bytes written.
+ * @example
+ *   (io:write-file! "out.txt" ("hello" ", " "world")) ; returns 12
+ */
+const char *IO_WRITE_FILE = "io:write-file!";
+result_value_ref_t ioWriteFile(const value_array_t *arguments, position_t pos) {
+  return ioWriteFragments(IO_WRITE_FILE, O_TRUNC, arguments, pos);
+}
+
+/**
+ * Writes a string, or a list of strings one after the other, at the end of a
+ * file.
+ * @name io:append-file!
+ * @param {string} path - The path of the file.
+ * @param {string|list} content - The string or the list of strings to write.
+ * @returns {number} The number of bytes written.
+ * @example
+ *   (io:append-file! "log.txt" ("started" "\n")) ; returns 8
+ */
+const char *IO_APPEND_FILE = "io:append-file!";
+result_value_ref_t ioAppendFile(const value_array_t *arguments,
+                                position_t pos) {
+  return ioWriteFragments(IO_APPEND_FILE, O_APPEND, arguments, pos);
+}
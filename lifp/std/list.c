@@ -6,6 +6,8 @@
 // (list:count (list:from 1 2 3)) ; returns 3
 // (list:nth 1 (list:from 10 20 30)) ; returns 20
 // (list:map (fn (x i) (* x 2)) (list:from 1 2 3)) ; returns (2 4 6)
+// (list:pmap (fn (x i) (* x 2)) (list:from 1 2 3)) ; same, in parallel
+// (list:preduce (fn (a b) (+ a b)) 0 (list:from 1 2 3)) ; returns 6
 // ```
 // ___HEADER_END___
 
@@ -14,6 +16,8 @@
 #include "../evaluate.h"
 #include "../fmt.h"
 #include "../value.h"
+#include "../virtual_machine.h"
+#include <stdatomic.h>
 #include <stddef.h>
 
 /**
@@ -183,6 +187,161 @@ result_value_ref_t listMap(const value_array_t *arguments, position_t pos) {
   return valueCreate(VALUE_TYPE_LIST, (value_as_t){.list = mapped_list}, pos);
 }
 
+// Parallel builtins split their input in chunks, so that every worker can
+// balance its load by stealing a few of them.
+static constexpr size_t CHUNKS_PER_THREAD = 4;
+
+// State shared by the jobs of a parallel builtin
+typedef struct {
+  value_t closure;
+  const value_array_t *input;
+  size_t chunk_size;
+  value_array_t *output;   // list:pmap, one slot per element
+  const value_t *identity; // list:preduce
+  value_t **partials;      // list:preduce, one slot per chunk
+  atomic_bool failed;
+  result_value_ref_t error; // Set by the first failing job
+} parallel_t;
+
+typedef struct {
+  parallel_t *shared;
+  size_t start;
+  size_t end;
+} parallel_chunk_t;
+
+static void parallelFail(parallel_t *self, result_value_ref_t result) {
+  bool expected = false;
+  if (atomic_compare_exchange_strong(&self->failed, &expected, true)) {
+    self->error = result;
+  }
+}
+
+static bool parallelFailed(parallel_t *self) {
+  return atomic_load_explicit(&self->failed, memory_order_relaxed);
+}
+
+static size_t parallelChunkSize(const pool_t *pool, size_t count) {
+  size_t chunks = poolConcurrency(pool) * CHUNKS_PER_THREAD;
+  size_t size = (count + chunks - 1) / chunks;
+  return size > 0 ? size : 1;
+}
+
+// Runs a task on every chunk of the input and waits for all of them
+static result_void_position_t parallelRun(pool_t *pool, parallel_t *self,
+                                          pool_task_t task, position_t pos) {
+  size_t count = self->input->count;
+  size_t chunks_count = (count + self->chunk_size - 1) / self->chunk_size;
+
+  parallel_chunk_t *chunks = nullptr;
+  tryWithMeta(result_void_position_t,
+              allocSafe(sizeof(parallel_chunk_t) * (chunks_count + 1)), pos,
+              chunks);
+
+  pool_group_t group = {};
+  for (size_t i = 0; i < chunks_count; i++) {
+    size_t start = i * self->chunk_size;
+    size_t end = start + self->chunk_size;
+    chunks[i] = (parallel_chunk_t){
+        .shared = self,
+        .start = start,
+        .end = end < count ? end : count,
+    };
+    poolSubmit(pool, &group, task, &chunks[i]);
+  }
+  poolWait(pool, &group);
+
+  deallocSafe(&chunks);
+  return ok(result_void_position_t);
+}
+
+static void listPmapChunk(void *argument) {
+  parallel_chunk_t *chunk = argument;
+  parallel_t *map = chunk->shared;
+
+  // Each element is evaluated in its own environment, derived from the one
+  // captured by the closure
+  value_t closure = map->closure;
+  value_t closure_data[2];
+  value_array_t closure_args = {.count = 2, .data = closure_data};
+
+  for (size_t i = chunk->start; i < chunk->end; i++) {
+    if (parallelFailed(map))
+      return;
+
+    value_t input = listGet(value_t, map->input, i);
+    closure_data[0] = input;
+    closure_data[1] = (value_t){
+        .type = VALUE_TYPE_NUMBER,
+        .as.number = (number_t)i,
+        .position = input.position,
+    };
+
+    result_value_ref_t result = invokeClosure(&closure, &closure_args);
+    if (result.code != RESULT_OK) {
+      parallelFail(map, result);
+      return;
+    }
+    map->output->data[i] = *result.value;
+    deallocSafe(&result.value);
+  }
+}
+
+/**
+ * Maps a function over a list like list:map, evaluating elements in parallel
+ * on worker threads. The function must not rely on side effects or on the
+ * order of evaluation.
+ * @name list:pmap
+ * @param {function} fn - The function to apply (fn element index).
+ * @param {list} list - The list to map over.
+ * @returns {list} A new list with mapped values.
+ * @example
+ *   (list:pmap (fn (x i) (* x 2)) (1 2 3)) ; returns (2 4 6)
+ */
+const char *LIST_PMAP = "list:pmap";
+result_value_ref_t listPmap(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 2) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 2 arguments. Got %zu", LIST_PMAP, arguments->count);
+  }
+
+  value_t closure_value = listGet(value_t, arguments, 0);
+  value_t list_value = listGet(value_t, arguments, 1);
+
+  if (closure_value.type != VALUE_TYPE_CLOSURE) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          closure_value.position,
+          "%s requires a function as first argument. Got %s.", LIST_PMAP,
+          formatValueType(closure_value.type));
+  }
+
+  if (list_value.type != VALUE_TYPE_LIST) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          list_value.position, "%s requires a list as second argument. Got %s.",
+          LIST_PMAP, formatValueType(list_value.type));
+  }
+
+  pool_t *pool = closure_value.as.closure.environment->machine->pool;
+  const value_array_t *input_list = list_value.as.list;
+
+  parallel_t map = {
+      .closure = closure_value,
+      .input = input_list,
+      .chunk_size = parallelChunkSize(pool, input_list->count),
+  };
+  tryWithMeta(result_value_ref_t, valueArrayCreate(input_list->count), pos,
+              map.output);
+  tryCatch(result_value_ref_t, parallelRun(pool, &map, listPmapChunk, pos),
+           valueArrayDestroy(&map.output));
+
+  if (atomic_load(&map.failed)) {
+    // Elements that were not mapped are zeroed, hence safe to destroy
+    valueArrayDestroy(&map.output);
+    return map.error;
+  }
+
+  return valueCreate(VALUE_TYPE_LIST, (value_as_t){.list = map.output}, pos);
+}
+
 /**
  * Applies a function to each element of a list for side effects.
  * The function receives each element and its index.
@@ -429,8 +588,9 @@ result_value_ref_t listReduce(const value_array_t *arguments, position_t pos) {
   value_t *accum = nullptr;
   tryWithMeta(result_value_ref_t, valueDeepCopy(&initial_value), pos, accum);
 
-  value_array_t *closure_args = nullptr;
-  tryWithMeta(result_value_ref_t, valueArrayCreate(3), pos, closure_args);
+  // Arguments are borrowed from the accumulator and the list
+  value_t closure_data[3];
+  value_array_t closure_args = {.count = 3, .data = closure_data};
 
   for (size_t i = 0; i < input_list->count; i++) {
     value_t current = listGet(value_t, input_list, i);
@@ -440,17 +600,185 @@ result_value_ref_t listReduce(const value_array_t *arguments, position_t pos) {
         .position = current.position,
     };
 
-    closure_args->data[0] = *accum;
-    closure_args->data[1] = current;
-    closure_args->data[2] = index;
+    closure_data[0] = *accum;
+    closure_data[1] = current;
+    closure_data[2] = index;
 
     value_t *result = nullptr;
-    try(result_value_ref_t, invokeClosure(&closure_value, closure_args),
-        result);
+    tryCatch(result_value_ref_t, invokeClosure(&closure_value, &closure_args),
+             valueDestroy(&accum), result);
     valueDestroy(&accum);
     accum = result;
   }
 
-  valueArrayDestroy(&closure_args);
   return ok(result_value_ref_t, accum);
 }
+
+static void listPreduceChunk(void *argument) {
+  parallel_chunk_t *chunk = argument;
+  parallel_t *reduce = chunk->shared;
+
+  value_t closure = reduce->closure;
+  value_t closure_data[2];
+  value_array_t closure_args = {.count = 2, .data = closure_data};
+
+  result_value_ref_t result = valueDeepCopy(reduce->identity);
+  if (result.code != RESULT_OK) {
+    parallelFail(reduce, result);
+    return;
+  }
+  value_t *accum = result.value;
+
+  for (size_t i = chunk->start; i < chunk->end; i++) {
+    if (parallelFailed(reduce)) {
+      valueDestroy(&accum);
+      return;
+    }
+
+    closure_data[0] = *accum;
+    closure_data[1] = listGet(value_t, reduce->input, i);
+
+    result = invokeClosure(&closure, &closure_args);
+    valueDestroy(&accum);
+    if (result.code != RESULT_OK) {
+      parallelFail(reduce, result);
+      return;
+    }
+    accum = result.value;
+  }
+
+  reduce->partials[chunk->start / reduce->chunk_size] = accum;
+}
+
+// Combines the partial results at indexes start and end into start
+static void listPreduceCombine(void *argument) {
+  parallel_chunk_t *pair = argument;
+  parallel_t *reduce = pair->shared;
+  if (parallelFailed(reduce))
+    return;
+
+  value_t closure = reduce->closure;
+  value_t closure_data[2] = {*reduce->partials[pair->start],
+                             *reduce->partials[pair->end]};
+  value_array_t closure_args = {.count = 2, .data = closure_data};
+
+  result_value_ref_t result = invokeClosure(&closure, &closure_args);
+  if (result.code != RESULT_OK) {
+    parallelFail(reduce, result);
+    return;
+  }
+
+  valueDestroy(&reduce->partials[pair->start]);
+  valueDestroy(&reduce->partials[pair->end]);
+  reduce->partials[pair->start] = result.value;
+}
+
+// Partial results are combined pairwise, halving their number at every round
+static result_void_position_t listPreduceTree(pool_t *pool, parallel_t *reduce,
+                                              size_t count, position_t pos) {
+  parallel_chunk_t *pairs = nullptr;
+  tryWithMeta(result_void_position_t,
+              allocSafe(sizeof(parallel_chunk_t) * (count / 2 + 1)), pos,
+              pairs);
+
+  for (size_t stride = 1; stride < count && !parallelFailed(reduce);
+       stride *= 2) {
+    pool_group_t group = {};
+    size_t pairs_count = 0;
+    for (size_t left = 0; left + stride < count; left += 2 * stride) {
+      pairs[pairs_count] = (parallel_chunk_t){
+          .shared = reduce,
+          .start = left,
+          .end = left + stride,
+      };
+      poolSubmit(pool, &group, listPreduceCombine, &pairs[pairs_count]);
+      pairs_count++;
+    }
+    poolWait(pool, &group);
+  }
+
+  deallocSafe(&pairs);
+  return ok(result_void_position_t);
+}
+
+/**
+ * Reduces a list in parallel on worker threads. Chunks of the list are folded
+ * starting from the identity, then partial results are combined pairwise.
+ * The combiner must be associative and the identity must leave any value
+ * unchanged, otherwise the result depends on how the list is split.
+ * @name list:preduce
+ * @param {function} fn - The associative combiner (fn left right).
+ * @param {any} identity - The identity of the combiner.
+ * @param {list} list - The list to reduce.
+ * @returns {any} The combination of all the elements.
+ * @example
+ *   (list:preduce (fn (a b) (+ a b)) 0 (1 2 3)) ; returns 6
+ */
+const char *LIST_PREDUCE = "list:preduce";
+result_value_ref_t listPreduce(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 3) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 3 arguments. Got %zu", LIST_PREDUCE, arguments->count);
+  }
+
+  value_t closure_value = listGet(value_t, arguments, 0);
+  value_t identity_value = listGet(value_t, arguments, 1);
+  value_t list_value = listGet(value_t, arguments, 2);
+
+  if (closure_value.type != VALUE_TYPE_CLOSURE) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          closure_value.position,
+          "%s requires a function as first argument. Got %s.", LIST_PREDUCE,
+          formatValueType(closure_value.type));
+  }
+
+  if (list_value.type != VALUE_TYPE_LIST) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          list_value.position, "%s requires a list as third argument. Got %s.",
+          LIST_PREDUCE, formatValueType(list_value.type));
+  }
+
+  const value_array_t *input_list = list_value.as.list;
+  if (input_list->count == 0) {
+    return valueDeepCopy(&identity_value);
+  }
+
+  pool_t *pool = closure_value.as.closure.environment->machine->pool;
+  parallel_t reduce = {
+      .closure = closure_value,
+      .input = input_list,
+      .chunk_size = parallelChunkSize(pool, input_list->count),
+      .identity = &identity_value,
+  };
+
+  size_t partials_count =
+      (input_list->count + reduce.chunk_size - 1) / reduce.chunk_size;
+  tryWithMeta(result_value_ref_t,
+              allocSafe(sizeof(value_t *) * partials_count), pos,
+              reduce.partials);
+
+  result_void_position_t reduced =
+      parallelRun(pool, &reduce, listPreduceChunk, pos);
+  if (reduced.code == RESULT_OK && !atomic_load(&reduce.failed)) {
+    reduced = listPreduceTree(pool, &reduce, partials_count, pos);
+  }
+
+  const bool failed = reduced.code != RESULT_OK || atomic_load(&reduce.failed);
+  value_t *result = failed ? nullptr : reduce.partials[0];
+  if (failed) {
+    for (size_t i = 0; i < partials_count; i++) {
+      valueDestroy(&reduce.partials[i]);
+    }
+  }
+  deallocSafe(&reduce.partials);
+
+  if (reduced.code != RESULT_OK) {
+    throw(result_value_ref_t, reduced.code, reduced.meta, "%s",
+          reduced.message);
+  }
+  if (atomic_load(&reduce.failed)) {
+    return reduce.error;
+  }
+
+  return ok(result_value_ref_t, result);
+}
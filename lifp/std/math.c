@@ -16,6 +16,7 @@
 #include "../value.h"
 #include <float.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -97,13 +98,20 @@ result_value_ref_t mathRandom(const value_array_t *arguments, position_t pos) {
           "%s requires no arguments. Got %zu", MATH_RANDOM, arguments->count);
   }
 
-  static bool initialized = false;
-  if (!initialized) {
-    srand((unsigned int)time(nullptr));
-    initialized = true;
+  // Per-thread xorshift64* state, so that machines on different threads never
+  // share a generator. Seeded lazily from the time and the thread.
+  static thread_local uint64_t state = 0;
+  if (state == 0) {
+    state = ((uint64_t)time(nullptr) << 32) ^ (uint64_t)(uintptr_t)&state;
+    state |= 1;
   }
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  uint64_t random = state * 2685821657736338717ULL;
 
-  number_t rand_value = (number_t)rand() / RAND_MAX;
+  // The top 53 bits fill the mantissa of a double in [0, 1)
+  number_t rand_value = (number_t)(random >> 11) / (number_t)(1ULL << 53);
   return valueCreate(VALUE_TYPE_NUMBER, (value_as_t){.number = rand_value},
                      pos);
 }
@@ -117,22 +125,7 @@ result_value_ref_t mathRandom(const value_array_t *arguments, position_t pos) {
  *   (math:ceil 2.3) ; returns 3
  */
 const char *MATH_CEIL = "math:ceil";
-result_value_ref_t mathCeil(const value_array_t *arguments, position_t pos) {
-  if (arguments->count != 1) {
-    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
-          "%s requires 1 argument. Got %zu", MATH_CEIL, arguments->count);
-  }
-
-  value_t number = listGet(value_t, arguments, 0);
-  if (number.type != VALUE_TYPE_NUMBER) {
-    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
-          number.position, "%s requires a number. Got %s.", MATH_CEIL,
-          formatValueType(number.type));
-  }
-
-  return valueCreate(VALUE_TYPE_NUMBER,
-                     (value_as_t){.number = ceil(number.as.number)}, pos);
-}
+number_t mathCeil(number_t argument) { return ceil(argument); }
 
 /**
  * Returns the largest integer less than or equal to the argument.
@@ -143,19 +136,4 @@ result_value_ref_t mathCeil(const value_array_t *arguments, position_t pos) {
  *   (math:floor 2.7) ; returns 2
  */
 const char *MATH_FLOOR = "math:floor";
-result_value_ref_t mathFloor(const value_array_t *arguments, position_t pos) {
-  if (arguments->count != 1) {
-    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
-          "%s requires 1 argument. Got %zu", MATH_FLOOR, arguments->count);
-  }
-
-  value_t number = listGet(value_t, arguments, 0);
-  if (number.type != VALUE_TYPE_NUMBER) {
-    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
-          number.position, "%s requires a number. Got %s.", MATH_FLOOR,
-          formatValueType(number.type));
-  }
-
-  return valueCreate(VALUE_TYPE_NUMBER,
-                     (value_as_t){.number = floor(number.as.number)}, pos);
-}
+number_t mathFloor(number_t argument) { return floor(argument); }
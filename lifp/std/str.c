@@ -3,20 +3,29 @@
 // ```lisp
 // (str:length "hello") ; returns 5
 // (str:join "," ("a" "b" "c")) ; returns "a,b,c"
+// (str:concat "a" "b" "c") ; returns "abc"
 // (str:slice "abcdef" 1 4) ; returns "bcde"
 // (str:include "hello world" "world") ; returns true
+// (str:index-of "hello world" "world") ; returns 6
+// (str:split "a,b,c" ",") ; returns ("a" "b" "c")
 // (str:trimLeft "   foo") ; returns "foo"
 // (str:trimRight "foo   ") ; returns "foo"
+// (def! out (str:builder))
+// (str:append! out "a" "b") ; appends in place
+// (str:build out) ; returns "ab"
 // ```
 // ___HEADER_END___
 
 #include "../../lib/result.h"
-#include "../../lib/string.h"
 #include "../error.h"
 #include "../fmt.h"
 #include "../value.h"
+#include "../virtual_machine.h"
 #include <ctype.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 
 /**
@@ -39,9 +48,9 @@ result_value_ref_t strLength(const value_array_t *arguments, position_t pos) {
           string_value.position, "%s requires a string. Got %s.", STR_LENGTH,
           formatValueType(string_value.type));
   }
-  return valueCreate(
-      VALUE_TYPE_NUMBER,
-      (value_as_t){.number = (number_t)strlen(string_value.as.string)}, pos);
+  return valueCreate(VALUE_TYPE_NUMBER,
+                     (value_as_t){.number = (number_t)string_value.as.length},
+                     pos);
 }
 
 /**
@@ -78,7 +87,7 @@ result_value_ref_t strJoin(const value_array_t *arguments, position_t pos) {
     return valueCreate(VALUE_TYPE_STRING, (value_as_t){.string = strdup("")},
                        pos);
   }
-  size_t separator_length = strlen(separator_value.as.string);
+  size_t separator_length = separator_value.as.length;
   size_t total_length = 0;
   for (size_t i = 0; i < input_list->count; i++) {
     value_t current = listGet(value_t, input_list, i);
@@ -87,25 +96,115 @@ result_value_ref_t strJoin(const value_array_t *arguments, position_t pos) {
             current.position, "%s requires a list of strings. Got %s.",
             STR_JOIN, formatValueType(current.type));
     }
-    total_length += strlen(current.as.string);
+    total_length += current.as.length;
   }
   total_length += separator_length * (input_list->count - 1);
   char *buffer = nullptr;
   tryWithMeta(result_value_ref_t, allocSafe(total_length + 1), pos, buffer);
 
-  for (size_t i = 0; i < input_list->count - 1; i++) {
+  size_t offset = 0;
+  for (size_t i = 0; i < input_list->count; i++) {
+    if (i > 0) {
+      memcpy(buffer + offset, separator_value.as.string, separator_length);
+      offset += separator_length;
+    }
     value_t current = listGet(value_t, input_list, i);
-    strcat(buffer, current.as.string);
-    strcat(buffer, separator_value.as.string);
+    memcpy(buffer + offset, current.as.string, current.as.length);
+    offset += current.as.length;
+  }
+  return valueCreate(VALUE_TYPE_STRING,
+                     (value_as_t){.string = buffer, .length = total_length},
+                     pos);
+}
+
+// Concatenations copying a string reserve room for as many bytes again, so
+// that the following ones append in place
+static constexpr size_t CONCAT_GROWTH = 2;
+
+// Claims the bytes following a string for an append, which is possible when
+// the string ends where its storage was written up to, and the storage has
+// room left. Only one string can claim them: the others have to be copied.
+static bool strClaimTail(value_t value, size_t length) {
+  string_storage_t *storage = value.as.storage;
+  if (!storage)
+    return false;
+
+  size_t end = (size_t)(value.as.string - storage->data) + value.as.length;
+  if (length > storage->capacity - end)
+    return false;
+
+  return atomic_compare_exchange_strong(&storage->length, &end, end + length);
+}
+
+/**
+ * Concatenates strings. Strings grown by repeated concatenations append in
+ * place when possible, in amortized time proportional to the appended bytes.
+ * @name str:concat
+ * @param {string} strings - One or more strings to concatenate.
+ * @returns {string} The concatenation of the strings.
+ * @example
+ *   (str:concat "hello" ", " "world") ; returns "hello, world"
+ */
+const char *STR_CONCAT = "str:concat";
+result_value_ref_t strConcat(const value_array_t *arguments, position_t pos) {
+  if (arguments->count < 1) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires at least 1 argument. Got %zu", STR_CONCAT,
+          arguments->count);
+  }
+
+  size_t length = 0;
+  for (size_t i = 0; i < arguments->count; i++) {
+    value_t current = listGet(value_t, arguments, i);
+    if (current.type != VALUE_TYPE_STRING) {
+      throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+            current.position, "%s requires strings. Got %s.", STR_CONCAT,
+            formatValueType(current.type));
+    }
+    if (i > 0) {
+      length += current.as.length;
+    }
+  }
+
+  value_t first = listGet(value_t, arguments, 0);
+  string_storage_t *storage = first.as.storage;
+  char *buffer = first.as.string;
+  if (strClaimTail(first, length)) {
+    atomic_fetch_add(&storage->refcount, 1);
+  } else {
+    const size_t total_length = first.as.length + length;
+    tryWithMeta(result_value_ref_t,
+                stringStorageCreate(first.as.string, first.as.length,
+                                    total_length * CONCAT_GROWTH),
+                pos, storage);
+    storage->length = total_length;
+    buffer = storage->data;
+  }
+
+  size_t offset = first.as.length;
+  for (size_t i = 1; i < arguments->count; i++) {
+    value_t current = listGet(value_t, arguments, i);
+    memcpy(buffer + offset, current.as.string, current.as.length);
+    offset += current.as.length;
   }
-  value_t last = listGet(value_t, input_list, input_list->count - 1);
-  strcat(buffer, last.as.string);
-  return valueCreate(VALUE_TYPE_STRING, (value_as_t){.string = buffer}, pos);
+
+  value_t *value = nullptr;
+  tryCatch(result_value_ref_t,
+           valueCreate(VALUE_TYPE_STRING,
+                       (value_as_t){
+                           .string = buffer,
+                           .length = offset,
+                           .storage = storage,
+                       },
+                       pos),
+           stringStorageRelease(&storage), value);
+  return ok(result_value_ref_t, value);
 }
 
 /**
  * Returns a substring from start to end (end not inclusive).
- * Negative indices count from the end of the string.
+ * Negative indices count from the end of the string. Slices of long strings
+ * share their bytes instead of copying them.
  * @name str:slice
  * @param {string} str - The string to slice.
  * @param {number} start - The start index.
@@ -135,7 +234,7 @@ result_value_ref_t strSlice(const value_array_t *arguments, position_t pos) {
           "%s requires a number as second argument. Got %s.", STR_SLICE,
           formatValueType(start_value.type));
   }
-  size_t str_len = strlen(string_value.as.string);
+  size_t str_len = string_value.as.length;
   number_t start_num = start_value.as.number;
   size_t start = (start_num < 0) ? (size_t)((int)str_len + (int)start_num)
                                  : (size_t)start_num;
@@ -166,11 +265,161 @@ result_value_ref_t strSlice(const value_array_t *arguments, position_t pos) {
   }
 
   size_t slice_len = (end > start) ? (end - start) : 0;
-  char *buffer = nullptr;
-  tryWithMeta(result_value_ref_t, allocSafe(slice_len + 1), pos, buffer);
-  stringCopy(buffer, string_value.as.string + start, slice_len + 1);
+  return valueCreateView(&string_value, start, slice_len, pos);
+}
+
+// Substring searches compare a block of candidate positions at once: the
+// bytes at each position and at the needle length past it are compared with
+// the first and the last byte of the needle, and only positions matching both
+// compare the rest. Vector extensions of the compiler become SSE2 or NEON
+// instructions, or plain word operations on other targets.
+static constexpr size_t STR_VECTOR_SIZE = 16;
+typedef unsigned char str_vector_t
+    __attribute__((vector_size(STR_VECTOR_SIZE)));
+
+// Candidates failing the comparison of the whole needle let through more than
+// one per block, plus this slack, switch the search to the Two-Way algorithm
+static constexpr size_t STR_FIND_MISSES = 64;
+
+static size_t strMax(size_t left, size_t right) {
+  return left > right ? left : right;
+}
+
+// Position before the maximal suffix of a needle, for a byte order or for its
+// opposite, and the period of that suffix
+static size_t strMaximalSuffix(const unsigned char *needle, size_t length,
+                               bool reversed, size_t *period) {
+  size_t suffix = SIZE_MAX; // One before the start of the needle
+  size_t candidate = 0;
+  size_t offset = 1;
+  *period = 1;
+  while (candidate + offset < length) {
+    const unsigned char left = needle[suffix + offset];
+    const unsigned char right = needle[candidate + offset];
+    if (left == right) {
+      if (offset == *period) {
+        candidate += *period;
+        offset = 1;
+      } else {
+        offset++;
+      }
+    } else if ((left > right) != reversed) {
+      candidate += offset;
+      offset = 1;
+      *period = candidate - suffix;
+    } else {
+      suffix = candidate++;
+      offset = *period = 1;
+    }
+  }
+  return suffix;
+}
+
+// Two-Way string matching (Crochemore and Perrin), linear in the length of
+// the haystack with constant space whatever the input
+static const char *strTwoWay(const char *haystack, size_t length,
+                             const char *needle, size_t needle_length) {
+  const unsigned char *text = (const unsigned char *)haystack;
+  const unsigned char *pattern = (const unsigned char *)needle;
+
+  size_t period = 0;
+  size_t reversed_period = 0;
+  size_t split = strMaximalSuffix(pattern, needle_length, false, &period);
+  const size_t reversed_split =
+      strMaximalSuffix(pattern, needle_length, true, &reversed_period);
+  if (reversed_split + 1 > split + 1) {
+    split = reversed_split;
+    period = reversed_period;
+  }
 
-  return valueCreate(VALUE_TYPE_STRING, (value_as_t){.string = buffer}, pos);
+  // Periodic needles remember the prefix matched before a shift by a period
+  size_t memory_after_shift = needle_length - period;
+  if (memcmp(pattern, pattern + period, split + 1) != 0) {
+    memory_after_shift = 0;
+    period = strMax(split + 1, needle_length - split - 1) + 1;
+  }
+
+  size_t memory = 0;
+  size_t position = 0;
+  while (length - position >= needle_length) {
+    const unsigned char *window = text + position;
+    size_t index = strMax(split + 1, memory);
+    while (index < needle_length && pattern[index] == window[index]) {
+      index++;
+    }
+    if (index < needle_length) {
+      position += index - split;
+      memory = 0;
+      continue;
+    }
+
+    index = split + 1;
+    while (index > memory && pattern[index - 1] == window[index - 1]) {
+      index--;
+    }
+    if (index <= memory)
+      return haystack + position;
+
+    position += period;
+    memory = memory_after_shift;
+  }
+  return nullptr;
+}
+
+// Strings are not terminated when they are views, so searches are bounded
+static const char *strFind(const char *haystack, size_t length,
+                           const char *needle, size_t needle_length) {
+  if (needle_length == 0)
+    return haystack;
+  if (needle_length > length)
+    return nullptr;
+  if (needle_length == 1)
+    return memchr(haystack, needle[0], length);
+
+  str_vector_t first;
+  str_vector_t last;
+  memset(&first, needle[0], sizeof(first));
+  memset(&last, needle[needle_length - 1], sizeof(last));
+
+  const size_t positions = length - needle_length + 1;
+  size_t misses = 0;
+  size_t position = 0;
+  for (; position + STR_VECTOR_SIZE <= positions;
+       position += STR_VECTOR_SIZE) {
+    str_vector_t starts;
+    str_vector_t ends;
+    memcpy(&starts, haystack + position, sizeof(starts));
+    memcpy(&ends, haystack + position + needle_length - 1, sizeof(ends));
+
+    const str_vector_t matches =
+        (str_vector_t)((starts == first) & (ends == last));
+    uint64_t words[STR_VECTOR_SIZE / sizeof(uint64_t)];
+    memcpy(words, &matches, sizeof(words));
+    if ((words[0] | words[1]) == 0)
+      continue;
+
+    for (size_t i = 0; i < STR_VECTOR_SIZE; i++) {
+      if (!matches[i])
+        continue;
+      const char *candidate = haystack + position + i;
+      if (memcmp(candidate + 1, needle + 1, needle_length - 2) == 0)
+        return candidate;
+      misses++;
+    }
+
+    if (misses > position / STR_VECTOR_SIZE + STR_FIND_MISSES) {
+      const size_t rest = position + STR_VECTOR_SIZE;
+      return strTwoWay(haystack + rest, length - rest, needle, needle_length);
+    }
+  }
+
+  // Positions left are fewer than a block
+  for (; position < positions; position++) {
+    if (haystack[position] == needle[0] &&
+        memcmp(haystack + position + 1, needle + 1, needle_length - 1) == 0)
+      return haystack + position;
+  }
+  return nullptr;
 }
 
 /**
@@ -202,10 +451,129 @@ result_value_ref_t strInclude(const value_array_t *arguments, position_t pos) {
           "%s requires a string as second argument. Got %s.", STR_INCLUDE,
           formatValueType(search_value.type));
   }
-  bool found = strstr(string_value.as.string, search_value.as.string) != NULL;
+  bool found = strFind(string_value.as.string, string_value.as.length,
+                       search_value.as.string, search_value.as.length) != NULL;
   return valueCreate(VALUE_TYPE_BOOLEAN, (value_as_t){.boolean = found}, pos);
 }
 
+/**
+ * Returns the index of the first occurrence of a substring.
+ * @name str:index-of
+ * @param {string} str - The string to search in.
+ * @param {string} search - The substring to search for.
+ * @returns {number} The index of the substring, or nil if it is not found.
+ * @example
+ *   (str:index-of "hello world" "world") ; returns 6
+ */
+const char *STR_INDEX_OF = "str:index-of";
+result_value_ref_t strIndexOf(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 2) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 2 arguments. Got %zu", STR_INDEX_OF, arguments->count);
+  }
+  value_t string_value = listGet(value_t, arguments, 0);
+  if (string_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          string_value.position,
+          "%s requires a string as first argument. Got %s.", STR_INDEX_OF,
+          formatValueType(string_value.type));
+  }
+  value_t search_value = listGet(value_t, arguments, 1);
+  if (search_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          search_value.position,
+          "%s requires a string as second argument. Got %s.", STR_INDEX_OF,
+          formatValueType(search_value.type));
+  }
+  const char *found =
+      strFind(string_value.as.string, string_value.as.length,
+              search_value.as.string, search_value.as.length);
+  if (!found) {
+    return valueCreate(VALUE_TYPE_NIL, (value_as_t){}, pos);
+  }
+  return valueCreate(
+      VALUE_TYPE_NUMBER,
+      (value_as_t){.number = (number_t)(found - string_value.as.string)}, pos);
+}
+
+/**
+ * Splits a string at every occurrence of a separator. Parts of long strings
+ * share their bytes instead of copying them.
+ * @name str:split
+ * @param {string} str - The string to split.
+ * @param {string} separator - The non-empty separator.
+ * @returns {list} The parts of the string between separators.
+ * @example
+ *   (str:split "a,b,,c" ",") ; returns ("a" "b" "" "c")
+ */
+const char *STR_SPLIT = "str:split";
+result_value_ref_t strSplit(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 2) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 2 arguments. Got %zu", STR_SPLIT, arguments->count);
+  }
+  value_t string_value = listGet(value_t, arguments, 0);
+  if (string_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          string_value.position,
+          "%s requires a string as first argument. Got %s.", STR_SPLIT,
+          formatValueType(string_value.type));
+  }
+  value_t separator_value = listGet(value_t, arguments, 1);
+  if (separator_value.type != VALUE_TYPE_STRING) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          separator_value.position,
+          "%s requires a string as second argument. Got %s.", STR_SPLIT,
+          formatValueType(separator_value.type));
+  }
+  const size_t separator_length = separator_value.as.length;
+  if (separator_length == 0) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR,
+          separator_value.position, "%s requires a non-empty separator.",
+          STR_SPLIT);
+  }
+
+  const char *string = string_value.as.string;
+  const size_t length = string_value.as.length;
+
+  // Parts are counted first, so that the list is allocated once
+  size_t count = 1;
+  const char *found =
+      strFind(string, length, separator_value.as.string, separator_length);
+  while (found) {
+    count++;
+    const size_t next = (size_t)(found - string) + separator_length;
+    found = strFind(string + next, length - next, separator_value.as.string,
+                    separator_length);
+  }
+
+  value_array_t *parts = nullptr;
+  tryWithMeta(result_value_ref_t, valueArrayCreate(count), pos, parts);
+
+  size_t start = 0;
+  for (size_t i = 0; i < count; i++) {
+    const char *end =
+        i + 1 < count ? strFind(string + start, length - start,
+                                separator_value.as.string, separator_length)
+                      : string + length;
+    const size_t part_length = (size_t)(end - string) - start;
+
+    value_t *part = nullptr;
+    tryCatch(result_value_ref_t,
+             valueCreateView(&string_value, start, part_length, pos),
+             valueArrayDestroy(&parts), part);
+    parts->data[i] = *part;
+    deallocSafe(&part);
+    start += part_length + separator_length;
+  }
+
+  value_t *value = nullptr;
+  tryCatch(result_value_ref_t,
+           valueCreate(VALUE_TYPE_LIST, (value_as_t){.list = parts}, pos),
+           valueArrayDestroy(&parts), value);
+  return ok(result_value_ref_t, value);
+}
+
 /**
  * Removes whitespace from the start of a string.
  * @name str:trimLeft
@@ -226,15 +594,13 @@ result_value_ref_t strTrimLeft(const value_array_t *arguments, position_t pos) {
           string_value.position, "%s requires a string. Got %s.", STR_TRIM_LEFT,
           formatValueType(string_value.type));
   }
-  char *start = string_value.as.string;
-  while (isspace(*start)) {
+  size_t start = 0;
+  while (start < string_value.as.length &&
+         isspace((unsigned char)string_value.as.string[start])) {
     start++;
   }
-  size_t len = strlen(start);
-  char *buffer = nullptr;
-  tryWithMeta(result_value_ref_t, allocSafe(len + 1), pos, buffer);
-  stringCopy(buffer, start, len + 1);
-  return valueCreate(VALUE_TYPE_STRING, (value_as_t){.string = buffer}, pos);
+  return valueCreateView(&string_value, start,
+                         string_value.as.length - start, pos);
 }
 
 /**
@@ -258,18 +624,148 @@ result_value_ref_t strTrimRight(const value_array_t *arguments,
           string_value.position, "%s requires a string. Got %s.",
           STR_TRIM_RIGHT, formatValueType(string_value.type));
   }
-  size_t len = strlen(string_value.as.string);
-  if (len == 0) {
-    char *buffer = (char *)calloc(1, 1);
-    return valueCreate(VALUE_TYPE_STRING, (value_as_t){.string = buffer}, pos);
-  }
-  char *end = string_value.as.string + len - 1;
-  while (len > 0 && isspace(*end)) {
+  size_t len = string_value.as.length;
+  while (len > 0 && isspace((unsigned char)string_value.as.string[len - 1])) {
     len--;
-    end--;
   }
+  return valueCreateView(&string_value, 0, len, pos);
+}
+
+static constexpr size_t BUILDER_INITIAL_CAPACITY = 64;
+
+// Grows the builder geometrically, so that appends take linear time overall
+static result_void_t builderReserve(builder_t *self, size_t length) {
+  if (self->length + length < self->capacity)
+    return ok(result_void_t);
+
+  size_t capacity = self->capacity;
+  while (self->length + length >= capacity) {
+    capacity *= 2;
+  }
+
+  char *data = nullptr;
+  try(result_void_t, allocSafe(capacity), data);
+  memcpy(data, self->data, self->length + 1);
+  deallocSafe(&self->data);
+  self->data = data;
+  self->capacity = capacity;
+  return ok(result_void_t);
+}
+
+static result_void_position_t builderCheck(const char *name, value_t value) {
+  if (value.type != VALUE_TYPE_BUILDER) {
+    throw(result_void_position_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+          value.position, "%s requires a builder as first argument. Got %s.",
+          name, formatValueType(value.type));
+  }
+  return ok(result_void_position_t);
+}
+
+/**
+ * Creates an empty string builder. Strings appended to a builder are copied
+ * once, so building a string piece by piece takes linear time.
+ * @name str:builder
+ * @returns {builder} A new, empty builder.
+ * @example
+ *   (def! out (str:builder))
+ */
+const char *STR_BUILDER = "str:builder";
+result_value_ref_t strBuilder(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 0) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 0 arguments. Got %zu", STR_BUILDER, arguments->count);
+  }
+
+  builder_t *builder = nullptr;
+  tryWithMeta(result_value_ref_t, allocSafe(sizeof(builder_t)), pos, builder);
+  builder->refcount = 1;
+  builder->capacity = BUILDER_INITIAL_CAPACITY;
+  tryCatchWithMeta(result_value_ref_t, allocSafe(builder->capacity),
+                   deallocSafe(&builder), pos, builder->data);
+  pthread_mutex_init(&builder->lock, nullptr);
+
+  value_t *value = nullptr;
+  tryCatch(
+      result_value_ref_t,
+      valueCreate(VALUE_TYPE_BUILDER, (value_as_t){.builder = builder}, pos),
+      builderRelease(&builder), value);
+  return ok(result_value_ref_t, value);
+}
+
+/**
+ * Appends strings at the end of a builder.
+ * @name str:append!
+ * @param {builder} builder - The builder to append to.
+ * @param {string} strings - One or more strings to append.
+ * @returns {nil} Returns nil.
+ * @example
+ *   (str:append! out "hello" ", " "world")
+ */
+const char *STR_APPEND = "str:append!";
+result_value_ref_t strAppend(const value_array_t *arguments, position_t pos) {
+  if (arguments->count < 2) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires at least 2 arguments. Got %zu", STR_APPEND,
+          arguments->count);
+  }
+
+  value_t builder_value = listGet(value_t, arguments, 0);
+  try(result_value_ref_t, builderCheck(STR_APPEND, builder_value));
+
+  size_t length = 0;
+  for (size_t i = 1; i < arguments->count; i++) {
+    value_t current = listGet(value_t, arguments, i);
+    if (current.type != VALUE_TYPE_STRING) {
+      throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+            current.position, "%s requires strings. Got %s.", STR_APPEND,
+            formatValueType(current.type));
+    }
+    length += current.as.length;
+  }
+
+  builder_t *builder = builder_value.as.builder;
+  pthread_mutex_lock(&builder->lock);
+  tryCatchWithMeta(result_value_ref_t, builderReserve(builder, length),
+                   pthread_mutex_unlock(&builder->lock), pos);
+  for (size_t i = 1; i < arguments->count; i++) {
+    value_t current = listGet(value_t, arguments, i);
+    memcpy(builder->data + builder->length, current.as.string,
+           current.as.length);
+    builder->length += current.as.length;
+  }
+  builder->data[builder->length] = 0;
+  pthread_mutex_unlock(&builder->lock);
+
+  return valueCreate(VALUE_TYPE_NIL, (value_as_t){}, pos);
+}
+
+/**
+ * Returns the string built so far. The builder can still be appended to.
+ * @name str:build
+ * @param {builder} builder - The builder.
+ * @returns {string} The concatenation of the strings appended.
+ * @example
+ *   (str:build out) ; returns "hello, world"
+ */
+const char *STR_BUILD = "str:build";
+result_value_ref_t strBuild(const value_array_t *arguments, position_t pos) {
+  if (arguments->count != 1) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "%s requires 1 argument. Got %zu", STR_BUILD, arguments->count);
+  }
+
+  value_t builder_value = listGet(value_t, arguments, 0);
+  try(result_value_ref_t, builderCheck(STR_BUILD, builder_value));
+
+  builder_t *builder = builder_value.as.builder;
+  pthread_mutex_lock(&builder->lock);
+  const size_t length = builder->length;
   char *buffer = nullptr;
-  tryWithMeta(result_value_ref_t, allocSafe(len + 1), pos, buffer);
-  stringCopy(buffer, string_value.as.string, len + 1);
-  return valueCreate(VALUE_TYPE_STRING, (value_as_t){.string = buffer}, pos);
+  tryCatchWithMeta(result_value_ref_t, allocSafe(length + 1),
+                   pthread_mutex_unlock(&builder->lock), pos, buffer);
+  memcpy(buffer, builder->data, length + 1);
+  pthread_mutex_unlock(&builder->lock);
+
+  return valueCreate(VALUE_TYPE_STRING,
+                     (value_as_t){.string = buffer, .length = length}, pos);
 }
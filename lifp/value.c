@@ -1,13 +1,22 @@
 #include "value.h"
+#include "../lib/hash.h"
 #include "../lib/string.h"
 #include "node.h"
 #include "position.h"
 #include "types.h"
 #include "virtual_machine.h"
 #include <assert.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+
+// Copies of strings at least this long share a storage instead of copying
+static constexpr size_t STRING_SHARED_LENGTH = 64;
+// Views shorter than this fraction of their storage are copied when they are
+// copied, so that a short view does not keep a long storage alive
+static constexpr size_t STRING_VIEW_RATIO = 4;
 
 result_value_ref_t valueCreate(value_type_t type, value_as_t as,
                                position_t pos) {
@@ -71,9 +80,42 @@ result_value_ref_t valueDeepCopy(const value_t *self) {
     break;
   }
   case VALUE_TYPE_STRING: {
-    destination->as.string = strdup(self->as.string);
+    string_storage_t *storage = self->as.storage;
+    const size_t length = self->as.length;
+    if (storage && length >= storage->length / STRING_VIEW_RATIO) {
+      atomic_fetch_add(&storage->refcount, 1);
+      destination->as = self->as;
+      break;
+    }
+
+    if (!storage && length >= STRING_SHARED_LENGTH) {
+      tryWithMeta(result_value_ref_t,
+                  stringStorageCreate(self->as.string, length, length),
+                  self->position, storage);
+      destination->as.string = storage->data;
+      destination->as.length = length;
+      destination->as.storage = storage;
+      break;
+    }
+
+    tryWithMeta(result_value_ref_t, allocSafe(length + 1), self->position,
+                destination->as.string);
+    memcpy(destination->as.string, self->as.string, length);
+    destination->as.length = length;
     break;
   }
+  case VALUE_TYPE_FUTURE:
+    destination->as.future = self->as.future;
+    atomic_fetch_add(&self->as.future->refcount, 1);
+    break;
+  case VALUE_TYPE_CHANNEL:
+    destination->as.channel = self->as.channel;
+    atomic_fetch_add(&self->as.channel->refcount, 1);
+    break;
+  case VALUE_TYPE_BUILDER:
+    destination->as.builder = self->as.builder;
+    atomic_fetch_add(&self->as.builder->refcount, 1);
+    break;
   default:
     unreachable();
   }
@@ -108,7 +150,7 @@ result_ref_t valueArrayCreate(size_t count) {
   return ok(result_ref_t, array);
 }
 
-static void valueDestroyInner(value_t *self) {
+void valueDestroyInner(value_t *self) {
   if (!self)
     return;
 
@@ -123,7 +165,21 @@ static void valueDestroyInner(value_t *self) {
     break;
   }
   case VALUE_TYPE_STRING:
-    deallocSafe(&self->as.string);
+    if (self->as.storage) {
+      stringStorageRelease(&self->as.storage);
+      self->as.string = nullptr;
+    } else {
+      deallocSafe(&self->as.string);
+    }
+    break;
+  case VALUE_TYPE_FUTURE:
+    futureRelease(&self->as.future);
+    break;
+  case VALUE_TYPE_CHANNEL:
+    channelRelease(&self->as.channel);
+    break;
+  case VALUE_TYPE_BUILDER:
+    builderRelease(&self->as.builder);
     break;
   case VALUE_TYPE_SPECIAL:
   case VALUE_TYPE_BOOLEAN:
@@ -142,31 +198,133 @@ void valueDestroy(value_t **self) {
   deallocSafe(self);
 }
 
-void valueArrayDestroy(value_array_t **self) {
+void futureRelease(future_t **self) {
   if (!self || !*self)
     return;
-  value_array_t *array = (*self);
-  for (size_t i = 0; i < array->count; i++) {
-    valueDestroyInner(&array->data[i]);
+
+  future_t *future = *self;
+  if (atomic_fetch_sub(&future->refcount, 1) > 1) {
+    *self = nullptr;
+    return;
+  }
+
+  poolWait(future->pool, &future->group);
+  valueDestroy(&future->closure);
+  if (future->result.code == RESULT_OK) {
+    valueDestroy(&future->result.value);
   }
-  deallocSafe(&array->data);
   deallocSafe(self);
 }
 
-static uint64_t hash(size_t len, const char key[static len]) {
-  uint64_t hash = 14695981039346656037U;
-  const uint64_t prime = 1099511628211U;
+void channelRelease(channel_t **self) {
+  if (!self || !*self)
+    return;
 
-  for (size_t i = 0; i < len; i++) {
-    hash ^= (uint64_t)(unsigned char)key[i];
-    hash *= prime;
+  channel_t *channel = *self;
+  if (atomic_fetch_sub(&channel->refcount, 1) > 1) {
+    *self = nullptr;
+    return;
+  }
+
+  value_t queued;
+  while (queuePop(channel->queue, &queued)) {
+    valueDestroyInner(&queued);
   }
+  queueDestroy(&channel->queue);
+  deallocSafe(self);
+}
 
-  return hash;
+result_ref_t stringStorageCreate(const char *bytes, size_t length,
+                                 size_t capacity) {
+  assert(length <= capacity);
+  string_storage_t *storage = nullptr;
+  try(result_ref_t, allocSafe(sizeof(string_storage_t) + capacity + 1),
+      storage);
+  storage->refcount = 1;
+  storage->length = length;
+  storage->capacity = capacity;
+  storage->data = (char *)(storage + 1);
+  memcpy(storage->data, bytes, length);
+  return ok(result_ref_t, storage);
+}
+
+void stringStorageRelease(string_storage_t **self) {
+  if (!self || !*self)
+    return;
+
+  string_storage_t *storage = *self;
+  if (atomic_fetch_sub(&storage->refcount, 1) > 1) {
+    *self = nullptr;
+    return;
+  }
+
+  if (storage->mapped > 0) {
+    munmap(storage->data, storage->mapped);
+  }
+  deallocSafe(self);
+}
+
+result_value_ref_t valueCreateView(const value_t *self, size_t start,
+                                   size_t length, position_t pos) {
+  assert(self->type == VALUE_TYPE_STRING);
+  assert(start + length <= self->as.length);
+
+  string_storage_t *storage = self->as.storage;
+  if (storage) {
+    atomic_fetch_add(&storage->refcount, 1);
+    value_t *value = nullptr;
+    tryCatch(result_value_ref_t,
+             valueCreate(VALUE_TYPE_STRING,
+                         (value_as_t){
+                             .string = self->as.string + start,
+                             .length = length,
+                             .storage = storage,
+                         },
+                         pos),
+             stringStorageRelease(&storage), value);
+    return ok(result_value_ref_t, value);
+  }
+
+  // Owned strings cannot be shared, so their parts are copied
+  char *buffer = nullptr;
+  tryWithMeta(result_value_ref_t, allocSafe(length + 1), pos, buffer);
+  memcpy(buffer, self->as.string + start, length);
+  value_t *value = nullptr;
+  tryCatch(result_value_ref_t,
+           valueCreate(VALUE_TYPE_STRING,
+                       (value_as_t){.string = buffer, .length = length}, pos),
+           deallocSafe(&buffer), value);
+  return ok(result_value_ref_t, value);
+}
+
+void builderRelease(builder_t **self) {
+  if (!self || !*self)
+    return;
+
+  builder_t *builder = *self;
+  if (atomic_fetch_sub(&builder->refcount, 1) > 1) {
+    *self = nullptr;
+    return;
+  }
+
+  pthread_mutex_destroy(&builder->lock);
+  deallocSafe(&builder->data);
+  deallocSafe(self);
+}
+
+void valueArrayDestroy(value_array_t **self) {
+  if (!self || !*self)
+    return;
+  value_array_t *array = (*self);
+  for (size_t i = 0; i < array->count; i++) {
+    valueDestroyInner(&array->data[i]);
+  }
+  deallocSafe(&array->data);
+  deallocSafe(self);
 }
 
 static size_t makeKey(const value_map_t *self, const char *key) {
-  uint64_t hashed_key = hash(strlen(key), key);
+  uint64_t hashed_key = hashBytes(HASH_SEED, strlen(key), key);
   return hashed_key % self->capacity;
 }
 
@@ -267,7 +425,7 @@ void *valueMapGet(const value_map_t *self, const char *key) {
   return nullptr;
 }
 
-void valueMapDestroyInner(value_map_t *self) {
+void valueMapClear(value_map_t *self) {
   if (!self)
     return;
 
@@ -275,8 +433,16 @@ void valueMapDestroyInner(value_map_t *self) {
     if (self->used[i]) {
       deallocSafe(&self->keys[i]);
       valueDestroyInner(&self->data[i]);
+      self->used[i] = false;
     }
   }
+}
+
+void valueMapDestroyInner(value_map_t *self) {
+  if (!self)
+    return;
+
+  valueMapClear(self);
   deallocSafe(&self->keys);
   deallocSafe(&self->data);
   deallocSafe(&self->used);
@@ -4,11 +4,27 @@
 #include "node.h"
 #include "position.h"
 #include "types.h"
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 
 typedef struct value_t value_t;
 typedef struct environment_t environment_t;
+typedef struct future_t future_t;
+typedef struct channel_t channel_t;
+typedef struct builder_t builder_t;
+
+// Bytes shared by several string values: copies of a long string, views
+// sliced from it, and strings concatenated to it. Bytes are never changed once
+// written, so sharing needs no lock: concatenations claim the spare capacity
+// past the written bytes, which no string can see yet.
+typedef struct {
+  atomic_size_t refcount;
+  atomic_size_t length; // Bytes written so far, followed by zeros
+  size_t capacity;      // Bytes that can be written
+  size_t mapped;        // Size of the file mapping holding the bytes, if any
+  char *data;    // Points to the mapping, or to the bytes following the struct
+} string_storage_t;
 typedef struct {
   bool should_continue;
   environment_t *environment;
@@ -24,6 +40,8 @@ typedef struct {
 } value_array_t;
 
 typedef result_value_ref_t (*builtin_t)(const value_array_t *, position_t);
+typedef number_t (*builtin_unary_t)(number_t);
+typedef number_t (*builtin_binary_t)(number_t, number_t);
 typedef result_value_ref_t (*special_form_t)(const node_array_t *,
                                              environment_t *, trampoline_t *);
 
@@ -36,6 +54,9 @@ typedef enum {
   VALUE_TYPE_LIST,
   VALUE_TYPE_SPECIAL,
   VALUE_TYPE_STRING,
+  VALUE_TYPE_FUTURE,
+  VALUE_TYPE_CHANNEL,
+  VALUE_TYPE_BUILDER,
 } value_type_t;
 
 typedef struct {
@@ -49,15 +70,43 @@ typedef struct {
   environment_t *environment;
 } closure_t;
 
+typedef enum {
+  BUILTIN_KIND_GENERIC,
+  BUILTIN_KIND_UNARY,
+  BUILTIN_KIND_BINARY,
+} builtin_kind_t;
+
+// Builtins working on numbers only can have a typed signature: the evaluator
+// calls them with unboxed arguments, without allocating an argument list.
+typedef struct {
+  builtin_kind_t kind;
+  const char *name; // As registered, for error messages
+  union {
+    builtin_t generic;
+    builtin_unary_t unary;
+    builtin_binary_t binary;
+  };
+} native_t;
+
 typedef union {
   bool boolean;
   number_t number;
   closure_t closure;
-  builtin_t builtin;
+  native_t builtin;
   nullptr_t nil;
   value_array_t *list;
   special_form_t special;
-  string_t string;
+  // Strings own their bytes, or point into a storage shared with other
+  // strings. Owned strings are terminated, while views ending before their
+  // storage are not: bytes are read up to the length, which can include NULs.
+  struct {
+    string_t string;
+    size_t length;
+    string_storage_t *storage;
+  };
+  future_t *future;
+  channel_t *channel;
+  builder_t *builder;
 } value_as_t;
 
 typedef struct value_t {
@@ -83,6 +132,16 @@ typedef Result(value_map_t *) result_value_map_ref_t;
 result_value_ref_t valueCreate(value_type_t, value_as_t, position_t);
 result_value_ref_t valueDeepCopy(const value_t *);
 void valueDestroy(value_t **);
+void valueDestroyInner(value_t *);
+
+void futureRelease(future_t **);
+void channelRelease(channel_t **);
+void builderRelease(builder_t **);
+
+result_ref_t stringStorageCreate(const char *, size_t, size_t);
+void stringStorageRelease(string_storage_t **);
+result_value_ref_t valueCreateView(const value_t *, size_t, size_t,
+                                   position_t);
 
 result_ref_t valueArrayCreate(size_t);
 void valueArrayDestroy(value_array_t **);
@@ -93,5 +152,6 @@ void argumentsDestroy(arguments_t **);
 result_value_map_ref_t valueMapCreate(size_t);
 void valueMapDestroy(value_map_t **);
 void valueMapDestroyInner(value_map_t *);
+void valueMapClear(value_map_t *);
 result_void_t valueMapSet(value_map_t *, const char *, const value_t *);
 void *valueMapGet(const value_map_t *, const char *);
@@ -3,8 +3,15 @@
 #include "virtual_machine.h"
 #include "specials.h"
 #include "value.h"
+#include <pthread.h>
+
+typedef struct vm_tasks_t {
+  pool_group_t group;    // Parent of the groups of all the tasks
+  pthread_rwlock_t lock; // Guards shared environments
+} vm_tasks_t;
 
 // NOLINTBEGIN - intentionally including .c files
+#include "std/chan.c"
 #include "std/core.c"
 #include "std/flow.c"
 #include "std/io.c"
@@ -17,9 +24,10 @@
 #include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 
-value_map_t *builtins;
-value_map_t *specials;
+static constexpr char THREADS_VARIABLE[] = "LIFP_THREADS";
 
 result_vm_ref_t vmCreate(void) {
   vm_t *machine = nullptr;
@@ -28,12 +36,35 @@ result_vm_ref_t vmCreate(void) {
   machine->global = nullptr;
 
   try(result_vm_ref_t, environmentCreate(nullptr), machine->global);
-
-  try(result_vm_ref_t, valueMapCreate(64), builtins);
+  machine->global->machine = machine;
+
+  // LIFP_THREADS overrides the number of online processors. The thread
+  // waiting for parallel work runs jobs too, hence one less worker. One
+  // worker is kept anyway: the main thread blocked on a channel runs no tasks,
+  // while tasks blocked on channels get spare workers from the pool.
+  const char *threads = getenv(THREADS_VARIABLE);
+  long processors = threads ? strtol(threads, nullptr, 10)
+                            : sysconf(_SC_NPROCESSORS_ONLN);
+  size_t workers = processors > 2 ? (size_t)processors - 1 : 1;
+  try(result_vm_ref_t, poolCreate(workers), machine->pool);
+
+  try(result_vm_ref_t, allocSafe(sizeof(vm_tasks_t)), machine->tasks);
+  pthread_rwlock_init(&machine->tasks->lock, nullptr);
+  machine->global->tasks.parent = &machine->tasks->group;
+
+  try(result_vm_ref_t, valueMapCreate(64), machine->builtins);
 #define setBuiltin(Label, Builtin)                                             \
   builtin.type = VALUE_TYPE_BUILTIN;                                           \
-  builtin.as.builtin = (Builtin);                                              \
-  try(result_vm_ref_t, valueMapSet(builtins, (Label), &builtin));
+  builtin.as.builtin = (native_t){.kind = BUILTIN_KIND_GENERIC,                \
+                                  .name = (Label),                             \
+                                  .generic = (Builtin)};                       \
+  try(result_vm_ref_t, valueMapSet(machine->builtins, (Label), &builtin));
+
+#define setUnary(Label, Builtin)                                               \
+  builtin.type = VALUE_TYPE_BUILTIN;                                           \
+  builtin.as.builtin = (native_t){                                             \
+      .kind = BUILTIN_KIND_UNARY, .name = (Label), .unary = (Builtin)};        \
+  try(result_vm_ref_t, valueMapSet(machine->builtins, (Label), &builtin));
 
   value_t builtin;
   setBuiltin(SUM, sum);
@@ -50,37 +81,59 @@ result_vm_ref_t vmCreate(void) {
   setBuiltin(LOGICAL_AND, logicalAnd);
   setBuiltin(LOGICAL_OR, logicalOr);
   setBuiltin(FLOW_SLEEP, flowSleep);
+  setBuiltin(FLOW_SPAWN, flowSpawn);
+  setBuiltin(FLOW_AWAIT, flowAwait);
+  setBuiltin(CHAN_MAKE, chanMake);
+  setBuiltin(CHAN_SEND, chanSend);
+  setBuiltin(CHAN_RECV, chanRecv);
+  setBuiltin(CHAN_SELECT, chanSelect);
   setBuiltin(IO_STDOUT, ioStdout);
   setBuiltin(IO_STDERR, ioStderr);
   setBuiltin(IO_PRINTF, ioPrintf);
   setBuiltin(IO_READLINE, ioReadline);
   setBuiltin(IO_CLEAR, ioClear);
+  setBuiltin(IO_FLUSH, ioFlush);
+  setBuiltin(IO_READ_ASYNC, ioReadAsync);
+  setBuiltin(IO_WRITE_ASYNC, ioWriteAsync);
+  setBuiltin(IO_READ_FILE, ioReadFile);
+  setBuiltin(IO_LINES, ioLines);
+  setBuiltin(IO_WRITE_FILE, ioWriteFile);
+  setBuiltin(IO_APPEND_FILE, ioAppendFile);
   setBuiltin(LIST_COUNT, listCount);
   setBuiltin(LIST_FROM, listFrom);
   setBuiltin(LIST_NTH, listNth);
   setBuiltin(LIST_MAP, listMap);
+  setBuiltin(LIST_PMAP, listPmap);
   setBuiltin(LIST_EACH, listEach);
   setBuiltin(LIST_FILTER, listFilter);
   setBuiltin(LIST_TIMES, listTimes);
   setBuiltin(LIST_REDUCE, listReduce);
+  setBuiltin(LIST_PREDUCE, listPreduce);
   setBuiltin(MATH_MAX, mathMax);
   setBuiltin(MATH_MIN, mathMin);
-  setBuiltin(MATH_CEIL, mathCeil);
-  setBuiltin(MATH_FLOOR, mathFloor);
+  setUnary(MATH_CEIL, mathCeil);
+  setUnary(MATH_FLOOR, mathFloor);
   setBuiltin(MATH_RANDOM, mathRandom);
   setBuiltin(STR_LENGTH, strLength);
   setBuiltin(STR_JOIN, strJoin);
+  setBuiltin(STR_CONCAT, strConcat);
   setBuiltin(STR_SLICE, strSlice);
   setBuiltin(STR_INCLUDE, strInclude);
+  setBuiltin(STR_INDEX_OF, strIndexOf);
+  setBuiltin(STR_SPLIT, strSplit);
   setBuiltin(STR_TRIM_LEFT, strTrimLeft);
   setBuiltin(STR_TRIM_RIGHT, strTrimRight);
+  setBuiltin(STR_BUILDER, strBuilder);
+  setBuiltin(STR_APPEND, strAppend);
+  setBuiltin(STR_BUILD, strBuild);
+#undef setUnary
 #undef setBuiltin
 
-  try(result_vm_ref_t, valueMapCreate(4), specials);
+  try(result_vm_ref_t, valueMapCreate(4), machine->specials);
 #define setSpecial(Label, Special)                                             \
   special.type = VALUE_TYPE_SPECIAL;                                           \
   special.as.special = (Special);                                              \
-  try(result_vm_ref_t, valueMapSet(specials, (Label), &special));
+  try(result_vm_ref_t, valueMapSet(machine->specials, (Label), &special));
 
   value_t special;
   setSpecial(DEFINE, define);
@@ -103,8 +156,11 @@ result_environment_ref_t environmentCreate(environment_t *parent) {
 
   environment->parent = parent;
   environment->refcount = 1;
+  environment->machine = nullptr;
   if (parent) {
     parent->refcount++;
+    environment->machine = parent->machine;
+    environment->tasks.parent = &parent->tasks;
   }
 
   return ok(result_environment_ref_t, environment);
@@ -119,9 +175,7 @@ void environmentDestroy(environment_t **self) {
   if (env->parent == nullptr)
     return;
 
-  env->refcount--;
-
-  if (env->refcount <= 0) {
+  if (atomic_fetch_sub(&env->refcount, 1) <= 1) {
     value_map_t *values = &env->values;
     environment_t *parent = env->parent;
     valueMapDestroyInner(values);
@@ -145,55 +199,153 @@ void environmentForceDestroy(environment_t **self) {
   environmentDestroy(&parent);
 }
 
+// Ends the scope of an environment. Its bindings are destroyed once the tasks
+// reading them complete, while closures and futures escaping the scope keep
+// the environment itself until they are destroyed.
+void environmentLeave(environment_t **self) {
+  if (!self || !(*self))
+    return;
+
+  environment_t *env = (*self);
+  if (atomic_load(&env->shared)) {
+    poolWait(env->machine->pool, &env->tasks);
+  }
+
+  valueMapClear(&env->values);
+  environmentDestroy(self);
+}
+
+// Locks the machine if the environment is reachable by running tasks
+static bool environmentLock(const environment_t *self, bool exclusive) {
+  if (!self->machine || !atomic_load(&self->shared))
+    return false;
+
+  vm_tasks_t *tasks = self->machine->tasks;
+  if (atomic_load(&tasks->group.pending) == 0)
+    return false;
+
+  if (exclusive) {
+    pthread_rwlock_wrlock(&tasks->lock);
+  } else {
+    pthread_rwlock_rdlock(&tasks->lock);
+  }
+  return true;
+}
+
 result_void_t environmentRegisterSymbol(environment_t *self, const char *key,
                                         const value_t *value) {
   if (!value)
     return ok(result_void_t);
 
-  if (environmentResolveSymbol(self, key)) {
+  // Holding the write lock, parents are read as well. Otherwise the
+  // environment is private to this thread and only parents need a lock.
+  const bool locked = environmentLock(self, true);
+  bool parent_locked = false;
+  const bool exists =
+      locked ? environmentResolveSymbol(self, key) != nullptr
+             : environmentAcquireSymbol(self, key, &parent_locked) != nullptr;
+  environmentReleaseSymbol(self, parent_locked);
+
+  if (exists) {
+    environmentReleaseSymbol(self, locked);
     throw(result_void_t, ERROR_CODE_REFERENCE_SYMBOL_ALREADY_DEFINED, nullptr,
           "Identifier '%s' has already been declared", key);
   }
 
   value_t *copy = nullptr;
-  tryWithMeta(result_void_t, valueDeepCopy(value), nullptr, copy);
-  try(result_void_t, valueMapSet(&self->values, key, copy));
+  tryCatchWithMeta(result_void_t, valueDeepCopy(value),
+                   environmentReleaseSymbol(self, locked), nullptr, copy);
+  result_void_t set = valueMapSet(&self->values, key, copy);
+  environmentReleaseSymbol(self, locked);
   deallocSafe(&copy);
-  return ok(result_void_t);
+  return set;
+}
+
+const value_t *environmentAcquireSymbol(const environment_t *self,
+                                        const char *symbol, bool *locked) {
+  assert(self);
+  assert(self->machine);
+
+  *locked = false;
+  const value_t *special = valueMapGet(self->machine->specials, symbol);
+  if (special) {
+    return special;
+  }
+
+  const value_t *builtin = valueMapGet(self->machine->builtins, symbol);
+  if (builtin) {
+    return builtin;
+  }
+
+  // Environments not shared yet are private, and so are their values
+  for (const environment_t *env = self; env; env = env->parent) {
+    if (!*locked) {
+      *locked = environmentLock(env, false);
+    }
+
+    const value_t *result = valueMapGet(&env->values, symbol);
+    if (result) {
+      return result;
+    }
+  }
+
+  return nullptr;
+}
+
+void environmentReleaseSymbol(const environment_t *self, bool locked) {
+  if (locked) {
+    pthread_rwlock_unlock(&self->machine->tasks->lock);
+  }
+}
+
+void environmentShare(environment_t *self) {
+  for (environment_t *env = self; env && !atomic_load(&env->shared);
+       env = env->parent) {
+    atomic_store(&env->shared, true);
+  }
 }
 
 const value_t *environmentResolveSymbol(const environment_t *self,
                                         const char *symbol) {
   assert(self);
+  assert(self->machine);
 
-  const value_t *special = valueMapGet(specials, symbol);
+  const value_t *special = valueMapGet(self->machine->specials, symbol);
   if (special) {
     return special;
   }
 
-  const value_t *builtin = valueMapGet(builtins, symbol);
+  const value_t *builtin = valueMapGet(self->machine->builtins, symbol);
   if (builtin) {
     return builtin;
   }
 
-  const value_t *result = valueMapGet(&self->values, symbol);
-  if (!result && self->parent) {
-    return environmentResolveSymbol(self->parent, symbol);
+  for (const environment_t *env = self; env; env = env->parent) {
+    const value_t *result = valueMapGet(&env->values, symbol);
+    if (result) {
+      return result;
+    }
   }
 
-  return result;
+  return nullptr;
 }
 
+void vmWait(vm_t *self) { poolWait(self->pool, &self->tasks->group); }
+
 void vmDestroy(vm_t **self) {
   if (!self || !*self)
     return;
 
-  environment_t *global = (*self)->global;
-  environmentForceDestroy(&global);
+  vm_t *machine = *self;
+  // Tasks might still be reading globals not bound to their futures
+  vmWait(machine);
+  environmentForceDestroy(&machine->global);
+  poolDestroy(&machine->pool);
+  pthread_rwlock_destroy(&machine->tasks->lock);
+  deallocSafe(&machine->tasks);
 
-  valueMapDestroyInner(builtins);
-  valueMapDestroyInner(specials);
-  deallocSafe(&builtins);
-  deallocSafe(&specials);
+  valueMapDestroy(&machine->builtins);
+  valueMapDestroy(&machine->specials);
   deallocSafe(self);
+  vmFlush();
 }
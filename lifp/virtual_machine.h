@@ -1,16 +1,66 @@
 #pragma once
 
+#include "../lib/pool.h"
+#include "../lib/queue.h"
 #include "value.h"
+#include <stdatomic.h>
 #include <stddef.h>
 
+typedef struct vm_t vm_t;
+
 typedef struct environment_t {
   struct environment_t *parent;
   value_map_t values;
-  size_t refcount;
+  // Atomic, since closures sharing the environment can run on other threads
+  atomic_size_t refcount;
+  // Machine owning the environment, shared by all environments of a tree
+  const vm_t *machine;
+  // Set once a task spawned on another thread can reach the environment
+  atomic_bool shared;
+  // Tasks that can reach the environment, nested in the ones of its parent
+  pool_group_t tasks;
 } environment_t;
 
-typedef struct {
+// Spawned tasks share environments with the thread that spawned them. While
+// any task runs, shared environments are read and written under lock.
+typedef struct vm_tasks_t vm_tasks_t;
+
+// Result of a task spawned on the pool. All the copies of a future value
+// share it, and the last one to be destroyed waits for the task to complete.
+typedef struct future_t {
+  atomic_size_t refcount;
+  pool_t *pool;
+  pool_group_t group; // Pending until the task completes
+  value_t *closure;   // Function run by the task
+  result_value_ref_t result;
+} future_t;
+
+// Bounded queue of values, shared by all the copies of a channel value.
+// Queued values are owned by the channel until they are received.
+typedef struct channel_t {
+  atomic_size_t refcount;
+  queue_t *queue; // Of value_t
+} channel_t;
+
+// Growable string, shared by all the copies of a builder value. Tasks running
+// in parallel can append to the same builder.
+typedef struct builder_t {
+  atomic_size_t refcount;
+  pthread_mutex_t lock;
+  size_t length;
+  size_t capacity;
+  char *data; // Always terminated
+} builder_t;
+
+// All the state of an interpreter lives in its machine: independent machines
+// can run in parallel on different threads.
+typedef struct vm_t {
   environment_t *global;
+  value_map_t *builtins;
+  value_map_t *specials;
+  // Workers of parallel builtins, started on first use
+  pool_t *pool;
+  vm_tasks_t *tasks;
 } vm_t;
 
 typedef Result(vm_t *) result_vm_ref_t;
@@ -19,10 +69,20 @@ typedef Result(environment_t *) result_environment_ref_t;
 result_environment_ref_t environmentCreate(environment_t *);
 void environmentDestroy(environment_t **);
 void environmentForceDestroy(environment_t **);
+void environmentLeave(environment_t **);
 
 const value_t *environmentResolveSymbol(const environment_t *, const char *);
+const value_t *environmentAcquireSymbol(const environment_t *, const char *,
+                                        bool *locked);
+void environmentReleaseSymbol(const environment_t *, bool locked);
+void environmentShare(environment_t *);
 result_void_t environmentRegisterSymbol(environment_t *, const char *,
                                         const value_t *);
 
 result_vm_ref_t vmCreate(void);
 void vmDestroy(vm_t **);
+// Waits for all the tasks spawned on the machine, running queued ones
+void vmWait(vm_t *);
+// Output of io builtins is buffered for all machines. Flush it before writing
+// to the standard streams in other ways, and before forking.
+void vmFlush(void);
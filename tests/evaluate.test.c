@@ -189,6 +189,7 @@ void allocations() {
                                          .position = {1, 1}};
   inner_list_values->data[1] = (value_t){.type = VALUE_TYPE_STRING,
                                          .as.string = inner_string,
+                                         .as.length = 1,
                                          .position = {1, 1}};
 
   value_t inner_list_value = {.type = VALUE_TYPE_LIST,
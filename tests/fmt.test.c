@@ -62,6 +62,7 @@ void values() {
   value_t string_value = {
       .type = VALUE_TYPE_STRING,
       .as.string = string,
+      .as.length = 4,
       .position = pos,
   };
   formatValue(&string_value, size, buffer, &offset);
@@ -175,9 +176,52 @@ void errors() {
                   (size_t)offset, "puts caret in the right place (multiline)");
 }
 
+typedef struct {
+  size_t count;
+  size_t writes;
+  char tail[8];
+} collected_t;
+
+static void collect(void *context, const char *bytes, size_t count) {
+  collected_t *collected = context;
+  collected->writes++;
+  collected->count += count;
+  const size_t kept = count < 7 ? count : 7;
+  memcpy(collected->tail, bytes + count - kept, kept);
+  collected->tail[kept] = 0;
+}
+
+void streamed() {
+  const size_t count = 10000;
+  value_array_t *list = nullptr;
+  tryAssert(valueArrayCreate(count), list);
+  for (size_t i = 0; i < count; i++) {
+    list->data[i] = (value_t){.type = VALUE_TYPE_NUMBER, .as.number = 1};
+  }
+  const value_t list_value = {.type = VALUE_TYPE_LIST, .as.list = list};
+
+  collected_t collected = {};
+  formatValueTo(&list_value,
+                (format_sink_t){.write = collect, .context = &collected});
+  expectEqlSize(collected.count, count * 2 + 1,
+                "formats values larger than any buffer");
+  expectTrue(collected.writes > 1 && collected.writes < count / 10,
+             "writes in chunks");
+  expectEqlString(collected.tail, " 1 1 1)", 7, "writes the whole value");
+
+  char buffer[8];
+  int offset = 0;
+  formatValue(&list_value, sizeof(buffer), buffer, &offset);
+  expectEqlString(buffer, "(1 1 1 ", 8, "truncates values to buffers");
+  expectEqlInt(offset, (int)(count * 2 + 1), "counts truncated text");
+
+  valueArrayDestroy(&list);
+}
+
 int main() {
   tryAssert(arenaCreate((size_t)(1024 * 1024)), test_arena);
   suite(values);
   suite(errors);
+  suite(streamed);
   return report();
 }
@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lifp/image.h"
+#include "../lifp/parse.h"
+#include "../lifp/tokenize.h"
+
+#include "test.h"
+#include "utils.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static arena_t *test_arena;
+static const char IMAGE_PATH[] = "tests/image.test.lifpc";
+
+static node_t *parseSource(const char *source) {
+  token_list_t *tokens = nullptr;
+  tryAssert(tokenize(test_arena, source), tokens);
+  size_t offset = 0;
+  size_t depth = 0;
+  node_t *node = nullptr;
+  tryAssert(parse(test_arena, tokens, &offset, &depth), node);
+  return node;
+}
+
+void roundTrip(void) {
+  const char source[] = "(def! a (list:from 1.5 \"two\" true nil ()))\n"
+                        "a";
+
+  image_writer_t *writer = nullptr;
+  tryAssert(imageWriterCreate(), writer);
+  tryAssert(imageWriterAppend(writer, parseSource("(def! a (list:from 1.5 "
+                                                  "\"two\" true nil ()))")));
+  tryAssert(imageWriterAppend(writer, parseSource("a")));
+  tryAssert(imageWriterSave(writer, IMAGE_PATH, strlen(source), source));
+  imageWriterDestroy(&writer);
+  expectNull(writer, "destroys writer");
+
+  image_t *image = nullptr;
+  tryAssert(imageOpen(IMAGE_PATH), image);
+  expectEqlSize(image->header->forms_count, 2, "stores all forms");
+  expectEqlString(image->source, source, strlen(source) + 1,
+                  "stores the source");
+
+  arenaReset(test_arena);
+  node_t *definition = nullptr;
+  tryAssert(imageLoadForm(image, test_arena, 0), definition);
+  expectEqlUint(definition->type, NODE_TYPE_LIST, "loads lists");
+  expectEqlSize(definition->value.list.count, 3, "with all children");
+
+  node_t symbol = definition->value.list.data[1];
+  expectEqlString(symbol.value.symbol, "a", 2, "loads symbols");
+
+  node_t call = definition->value.list.data[2];
+  expectEqlSize(call.value.list.count, 6, "loads nested lists");
+  expectEqlDouble(call.value.list.data[1].value.number, 1.5, "loads numbers");
+  expectEqlString(call.value.list.data[2].value.string, "two", 4,
+                  "loads strings");
+  expectTrue(call.value.list.data[3].value.boolean, "loads booleans");
+  expectEqlUint(call.value.list.data[4].type, NODE_TYPE_NIL, "loads nil");
+  expectEqlSize(call.value.list.data[5].value.list.count, 0,
+                "loads empty lists");
+  expectEqlSize(call.position.column, 9, "keeps positions");
+
+  node_t *reference = nullptr;
+  tryAssert(imageLoadForm(image, test_arena, 1), reference);
+  expectEqlUint(reference->type, NODE_TYPE_SYMBOL, "loads atom forms");
+
+  imageClose(&image);
+  expectNull(image, "closes image");
+  unlink(IMAGE_PATH);
+}
+
+void invalid(void) {
+  FILE *file = fopen(IMAGE_PATH, "wb");
+  fputs("(io:stdout! 1)", file);
+  fclose(file);
+
+  result_ref_t result;
+  tryFail(imageOpen(IMAGE_PATH), result);
+  expectEqlInt(result.code, IMAGE_ERROR_INVALID, "rejects source files");
+
+  image_header_t header = {.version = IMAGE_FORMAT_VERSION,
+                           .forms_count = 1,
+                           .nodes_count = 4};
+  memcpy(header.magic, IMAGE_MAGIC, IMAGE_MAGIC_SIZE);
+  file = fopen(IMAGE_PATH, "wb");
+  fwrite(&header, sizeof(image_header_t), 1, file);
+  fclose(file);
+
+  tryFail(imageOpen(IMAGE_PATH), result);
+  expectEqlInt(result.code, IMAGE_ERROR_INVALID, "rejects truncated images");
+
+  tryFail(imageOpen("tests/does-not-exist.lifpc"), result);
+  expectEqlInt(result.code, IMAGE_ERROR_IO, "reports missing images");
+  unlink(IMAGE_PATH);
+}
+
+int main(void) {
+  tryAssert(arenaCreate((size_t)(1024 * 1024)), test_arena);
+
+  suite(roundTrip);
+  suite(invalid);
+
+  arenaDestroy(&test_arena);
+  return report();
+}
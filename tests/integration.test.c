@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include "test.h"
 #include "utils.h"
 
@@ -7,6 +8,10 @@
 #include "../lifp/tokenize.h"
 #include <assert.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 static arena_t *ast_arena;
 
@@ -204,6 +209,436 @@ void expandingEnvironment() {
   valueDestroy(&result);
 }
 
+void parallelMap() {
+  value_t *result =
+      execute("(def! offset 10)\n"
+              "(def! scale (fn (x) (* x 2)))\n"
+              "(list:pmap (fn (x i) (+ (scale x) offset)) "
+              "(list:times (fn (i) i) 1000))");
+  expectEqlUint(result->type, VALUE_TYPE_LIST, "returns a list");
+  expectEqlSize(result->as.list->count, 1000, "maps all elements");
+
+  bool in_order = true;
+  for (size_t i = 0; i < result->as.list->count; i++) {
+    in_order = in_order &&
+               result->as.list->data[i].as.number == (number_t)(i * 2 + 10);
+  }
+  expectTrue(in_order, "keeps elements in order");
+  valueDestroy(&result);
+
+  result = execute("(list:pmap (fn (x i) (list:from x \"x\")) (list:from 1 2))");
+  expectEqlSize(result->as.list->data[1].as.list->count, 2,
+                "returns allocated values");
+  valueDestroy(&result);
+
+  result = execute("(list:pmap (fn (x i) x) ())");
+  expectEqlSize(result->as.list->count, 0, "maps empty lists");
+  valueDestroy(&result);
+}
+
+void parallelReduce() {
+  value_t *result =
+      execute("(list:preduce (fn (a b) (+ a b)) 0 "
+              "(list:times (fn (i) i) 1000))");
+  expectEqlUint(result->type, VALUE_TYPE_NUMBER, "returns a number");
+  expectEqlDouble(result->as.number, 499500, "combines all elements");
+  valueDestroy(&result);
+
+  result = execute("(list:preduce (fn (a b) (math:max a b)) 0 "
+                   "(list:times (fn (i) (% (* i 7) 101)) 500))");
+  expectEqlDouble(result->as.number, 100, "supports other combiners");
+  valueDestroy(&result);
+
+  result = execute("(list:preduce (fn (a b) (+ a b)) 42 ())");
+  expectEqlDouble(result->as.number, 42, "returns the identity of empty lists");
+  valueDestroy(&result);
+
+  result = execute("(list:preduce (fn (a b) (+ a b)) 0 (list:from 5))");
+  expectEqlDouble(result->as.number, 5, "reduces single elements");
+  valueDestroy(&result);
+}
+
+void tasks() {
+  value_t *result =
+      execute("(def! a (flow:spawn (fn () (list:reduce (fn (p c i) (+ p c)) 0 "
+              "(list:times (fn (i) i) 100)))))\n"
+              "(def! b (flow:spawn (fn () 7) 20))\n"
+              "(+ (flow:await a) (flow:await b))");
+  expectEqlUint(result->type, VALUE_TYPE_NUMBER, "returns a number");
+  expectEqlDouble(result->as.number, 4957, "awaits the results of tasks");
+  valueDestroy(&result);
+
+  result = execute("(def! t (flow:spawn (fn () 2)))\n"
+                   "(+ (flow:await t) (flow:await t))");
+  expectEqlDouble(result->as.number, 4, "awaits futures more than once");
+  valueDestroy(&result);
+
+  result = execute("(def! x 10)\n"
+                   "(def! t (flow:spawn (fn () (* x 2)) 10))\n"
+                   "(def! y 1)\n"
+                   "(+ y (flow:await t))");
+  expectEqlDouble(result->as.number, 21, "shares definitions with tasks");
+  valueDestroy(&result);
+
+  result = execute(
+      "(flow:await (flow:spawn (fn () (flow:await (flow:spawn (fn () 5))))))");
+  expectEqlDouble(result->as.number, 5, "awaits tasks within tasks");
+  valueDestroy(&result);
+
+  result = execute("(let ((x 41)) (flow:await (flow:spawn (fn () (+ x 1)))))");
+  expectEqlDouble(result->as.number, 42, "awaits tasks reading let bindings");
+  valueDestroy(&result);
+
+  result = execute("(def! t (let ((x 41)) (flow:spawn (fn () (+ x 1)) 50)))\n"
+                   "(flow:await t)");
+  expectEqlDouble(result->as.number, 42,
+                  "keeps tasks from outliving let bindings");
+  valueDestroy(&result);
+
+  result = execute(
+      "(def! l (let ((x 41)) (list:from (flow:spawn (fn () (+ x 1)) 50))))\n"
+      "(flow:await (list:nth 0 l))");
+  expectEqlDouble(result->as.number, 42,
+                  "keeps tasks in lists from outliving let bindings");
+  valueDestroy(&result);
+
+  result = execute(
+      "(def! c (chan:make 1))\n"
+      "(let ((x 41)) (chan:send! c (flow:spawn (fn () (+ x 1)) 50)))\n"
+      "(flow:await (chan:recv! c))");
+  expectEqlDouble(result->as.number, 42,
+                  "keeps tasks sent on channels from outliving let bindings");
+  valueDestroy(&result);
+}
+
+void channels() {
+  value_t *result = execute("(def! c (chan:make 4))\n"
+                            "(def! p (flow:spawn (fn () (list:each "
+                            "(fn (i) (chan:send! c i)) "
+                            "(list:times (fn (i) i) 50)))))\n"
+                            "(list:reduce (fn (sum i) (+ sum (chan:recv! c))) "
+                            "0 (list:times (fn (i) i) 50))");
+  expectEqlUint(result->type, VALUE_TYPE_NUMBER, "returns a number");
+  expectEqlDouble(result->as.number, 1225,
+                  "passes values through a channel smaller than the stream");
+  valueDestroy(&result);
+
+  result = execute("(def! c (chan:make 2))\n"
+                   "(chan:send! c (list:from 1 2))\n"
+                   "(chan:send! c \"b\")\n"
+                   "(list:from (chan:recv! c) (chan:recv! c))");
+  expectEqlDouble(result->as.list->data[0].as.list->data[1].as.number, 2,
+                  "passes lists");
+  expectEqlString(result->as.list->data[1].as.string, "b", 2,
+                  "keeps values in order");
+  valueDestroy(&result);
+
+  result = execute("(def! a (chan:make 1))\n"
+                   "(def! b (chan:make 1))\n"
+                   "(def! t (flow:spawn (fn () (chan:send! b 7)) 10))\n"
+                   "(chan:select (list:from a b))");
+  expectEqlDouble(result->as.list->data[0].as.number, 1,
+                  "selects the channel with a value");
+  expectEqlDouble(result->as.list->data[1].as.number, 7,
+                  "returns the selected value");
+  valueDestroy(&result);
+
+  result = execute("(def! c (chan:make 2))\n"
+                   "(chan:send! c (list:from 1 2))\n"
+                   "(= c c)");
+  expectTrue(result->as.boolean, "compares channels by identity");
+  valueDestroy(&result);
+
+  // Three stages blocked on channels, with a single worker
+  setenv("LIFP_THREADS", "1", 1);
+  result = execute(
+      "(def! a (chan:make 2))\n"
+      "(def! b (chan:make 2))\n"
+      "(def! c (chan:make 2))\n"
+      "(def! n (list:times (fn (i) i) 50))\n"
+      "(def! p (flow:spawn (fn () (list:each (fn (i) (chan:send! a i)) n))))\n"
+      "(def! s (flow:spawn (fn () (list:each "
+      "(fn (i) (chan:send! b (* 2 (chan:recv! a)))) n))))\n"
+      "(def! t (flow:spawn (fn () (list:each "
+      "(fn (i) (chan:send! c (+ 1 (chan:recv! b)))) n))))\n"
+      "(list:reduce (fn (sum i) (+ sum (chan:recv! c))) 0 n)");
+  unsetenv("LIFP_THREADS");
+  expectEqlDouble(result->as.number, 2500,
+                  "runs pipelines with more stages than threads");
+  valueDestroy(&result);
+}
+
+void stringBuilders() {
+  value_t *result = execute("(def! out (str:builder))\n"
+                            "(list:each (fn (i) (str:append! out \"ab\" \"c\")) "
+                            "(list:times (fn (i) i) 100))\n"
+                            "(str:length (str:build out))");
+  expectEqlDouble(result->as.number, 300, "appends strings in place");
+  valueDestroy(&result);
+
+  result = execute("(def! out (str:builder))\n"
+                   "(str:append! out \"x\")\n"
+                   "(def! first (str:build out))\n"
+                   "(str:append! out \"y\")\n"
+                   "(list:from first (str:build out))");
+  expectEqlString(result->as.list->data[0].as.string, "x", 2,
+                  "builds snapshots of the content");
+  expectEqlString(result->as.list->data[1].as.string, "xy", 3,
+                  "keeps builders usable after building");
+  valueDestroy(&result);
+}
+
+void stringConcatenations() {
+  value_t *result = execute("(list:reduce (fn (text i) (str:concat text \"ab\")) "
+                            "\"\" (list:times (fn (i) i) 100))");
+  expectEqlSize(result->as.length, 200, "concatenates repeatedly");
+  expectTrue(memcmp(result->as.string, "abababab", 8) == 0,
+             "appends the strings in order");
+  expectTrue(result->as.storage->capacity <= 4 * 200,
+             "grows the storage geometrically");
+  valueDestroy(&result);
+
+  result = execute("(def! base (str:concat \"ab\" \"c\"))\n"
+                   "(list:from (str:concat base \"x\") "
+                   "(str:concat base \"y\") base)");
+  expectTrue(memcmp(result->as.list->data[0].as.string, "abcx", 4) == 0,
+             "appends in place to the end of a string");
+  expectTrue(memcmp(result->as.list->data[1].as.string, "abcy", 4) == 0,
+             "copies strings whose end was appended to");
+  expectEqlSize(result->as.list->data[2].as.length, 3,
+                "leaves the concatenated strings untouched");
+  valueDestroy(&result);
+}
+
+#define VIEWED_TEXT                                                            \
+  "(def! text \"  lorem ipsum dolor sit amet, consectetur adipiscing elit, "  \
+  "sed do eiusmod  \")\n"
+
+void stringViews() {
+  value_t *result = execute(VIEWED_TEXT "(str:slice text 2 7)");
+  expectNotNull(result->as.storage, "shares the storage of long strings");
+  expectEqlSize(result->as.length, 5, "has the length of the slice");
+  expectTrue(memcmp(result->as.string, "lorem", 5) == 0,
+             "points to the slice");
+  valueDestroy(&result);
+
+  result = execute(VIEWED_TEXT
+                   "(list:from (= (str:slice text 2 7) \"lorem\") "
+                   "(str:include? (str:slice text 2 7) \"lorem ipsum\") "
+                   "(str:length (str:trimRight (str:trimLeft text))))");
+  expectTrue(result->as.list->data[0].as.boolean, "compares views");
+  expectFalse(result->as.list->data[1].as.boolean,
+              "searches within the view only");
+  expectEqlDouble(result->as.list->data[2].as.number, 71, "trims views");
+  valueDestroy(&result);
+
+  result = execute(VIEWED_TEXT "(def! word (str:slice text 2 7))\nword");
+  expectNull(result->as.storage, "copies short views when they are kept");
+  expectEqlString(result->as.string, "lorem", 6, "copies the slice");
+  valueDestroy(&result);
+}
+
+void stringSearches() {
+  value_t *result = execute(VIEWED_TEXT
+                            "(list:from (str:index-of text \"elit\") "
+                            "(str:index-of text \"tile\") "
+                            "(str:index-of text \"\"))");
+  expectEqlDouble(result->as.list->data[0].as.number, 53,
+                  "finds substrings past the first block");
+  expectEqlUint(result->as.list->data[1].type, VALUE_TYPE_NIL,
+                "returns nil for missing substrings");
+  expectEqlDouble(result->as.list->data[2].as.number, 0,
+                  "finds empty substrings at the start");
+  valueDestroy(&result);
+
+  // Every position matches the first and last byte of the needle
+  char source[512] = "(str:index-of \"";
+  const size_t prefix = strlen(source);
+  memset(source + prefix, 'a', 300);
+  strcpy(source + prefix + 300, "aba\" \"aba\")");
+  result = execute(source);
+  expectEqlDouble(result->as.number, 300, "finds substrings in the worst case");
+  valueDestroy(&result);
+
+  result = execute(VIEWED_TEXT "(str:split text \", \")");
+  expectEqlSize(result->as.list->count, 3, "splits at every separator");
+  expectNotNull(result->as.list->data[0].as.storage,
+                "shares the storage of long strings");
+  expectEqlSize(result->as.list->data[2].as.length, 16,
+                "keeps the part after the last separator");
+  valueDestroy(&result);
+
+  result = execute("(str:split \",a,,\" \",\")");
+  expectEqlSize(result->as.list->count, 4, "keeps empty parts");
+  expectEqlString(result->as.list->data[1].as.string, "a", 2,
+                  "splits short strings");
+  valueDestroy(&result);
+}
+
+void asyncFiles() {
+  char path[] = "/tmp/lifp-async-XXXXXX";
+  int file = mkstemp(path);
+  close(file);
+
+  char source[512];
+  snprintf(source, sizeof(source),
+           "(def! w (io:write-async! \"%s\" \"hello\" (fn (n) n)))\n"
+           "(def! n (flow:await w))\n"
+           "(def! r (io:read-async \"%s\" (fn (text) (list:from n text))))\n"
+           "(flow:await r)",
+           path, path);
+  value_t *result = execute(source);
+  expectEqlDouble(result->as.list->data[0].as.number, 5,
+                  "returns the number of bytes written");
+  expectEqlString(result->as.list->data[1].as.string, "hello", 6,
+                  "reads back the content written");
+  valueDestroy(&result);
+  unlink(path);
+
+  int channel[2];
+  pipe(channel);
+  write(channel[1], "piped", 5);
+  close(channel[1]);
+  snprintf(source, sizeof(source),
+           "(flow:await (io:read-async \"/dev/fd/%d\" (fn (text) text)))",
+           channel[0]);
+  result = execute(source);
+  expectEqlString(result->as.string, "piped", 6, "reads pipes until closed");
+  valueDestroy(&result);
+  close(channel[0]);
+}
+
+void mappedFiles() {
+  char path[] = "/tmp/lifp-mapped-XXXXXX";
+  int file = mkstemp(path);
+  write(file, "mapped", 6);
+
+  char source[512];
+  snprintf(source, sizeof(source), "(io:read-file \"%s\")", path);
+  value_t *result = execute(source);
+  expectEqlString(result->as.string, "mapped", 7, "reads the whole file");
+  expectTrue(result->as.storage && result->as.storage->mapped > 0,
+             "maps the file");
+  valueDestroy(&result);
+
+  snprintf(source, sizeof(source),
+           "(let ((text (io:read-file \"%s\"))) (str:join text (list:from "
+           "text text)))",
+           path);
+  result = execute(source);
+  expectEqlString(result->as.string, "mappedmappedmapped", 19,
+                  "reads strings mapped from files");
+  valueDestroy(&result);
+
+  // Lengths are stored, so NUL bytes are part of the string
+  write(file, "\0bytes", 6);
+  snprintf(source, sizeof(source), "(str:length (io:read-file \"%s\"))",
+           path);
+  result = execute(source);
+  expectEqlDouble(result->as.number, 12, "keeps NUL bytes in strings");
+  valueDestroy(&result);
+
+  // A file filling its last page has no room for the terminator
+  char page[4096];
+  memset(page, 'x', sizeof(page));
+  ftruncate(file, 0);
+  pwrite(file, page, sizeof(page), 0);
+  close(file);
+  snprintf(source, sizeof(source), "(str:length (io:read-file \"%s\"))",
+           path);
+  result = execute(source);
+  expectEqlDouble(result->as.number, 4096, "reads files filling a page");
+  valueDestroy(&result);
+  unlink(path);
+}
+
+void fileLines() {
+  char path[] = "/tmp/lifp-lines-XXXXXX";
+  int file = mkstemp(path);
+  // Longer than a block, so that lines are split across reads
+  static char content[200000];
+  size_t length = 0;
+  for (size_t i = 0; length + 32 < sizeof(content); i++) {
+    length += (size_t)snprintf(content + length, sizeof(content) - length,
+                               "line %zu\n", i);
+  }
+  write(file, content, length);
+  write(file, "last", 4);
+  close(file);
+
+  char source[512];
+  snprintf(source, sizeof(source),
+           "(io:lines (fn (n line i) (+ n (str:length line))) 0 \"%s\")",
+           path);
+  value_t *result = execute(source);
+  size_t newlines = 0;
+  for (size_t i = 0; i < length; i++) {
+    newlines += content[i] == '\n';
+  }
+  expectEqlDouble(result->as.number, (double)(length - newlines + 4),
+                  "yields every line without its newline");
+  valueDestroy(&result);
+
+  snprintf(source, sizeof(source),
+           "(io:lines (fn (last line i) line) \"\" \"%s\")", path);
+  result = execute(source);
+  expectEqlString(result->as.string, "last", 5,
+                  "yields the last line without a newline");
+  valueDestroy(&result);
+  unlink(path);
+}
+
+void stdinLines() {
+  int fds[2];
+  pipe(fds);
+  write(fds[1], "first\nsecond\nthird\n", 19);
+  close(fds[1]);
+  const int saved = dup(STDIN_FILENO);
+  dup2(fds[0], STDIN_FILENO);
+  close(fds[0]);
+
+  // io:readline! buffers the whole pipe in stdin, and io:lines picks it up
+  value_t *result = execute(
+      "(def! first (io:readline! \"\"))\n"
+      "(io:lines (fn (n line i) (+ n (str:length line))) (str:length first))");
+  expectEqlDouble(result->as.number, 16,
+                  "reads the lines io:readline! left in stdin");
+  valueDestroy(&result);
+
+  clearerr(stdin);
+  dup2(saved, STDIN_FILENO);
+  close(saved);
+}
+
+void writtenFiles() {
+  char path[] = "/tmp/lifp-written-XXXXXX";
+  close(mkstemp(path));
+
+  char source[512];
+  snprintf(source, sizeof(source),
+           "(io:write-file! \"%s\" (list:times (fn (i) \"ab\") 3000))",
+           path);
+  value_t *result = execute(source);
+  expectEqlDouble(result->as.number, 6000, "writes lists of strings");
+  valueDestroy(&result);
+
+  snprintf(source, sizeof(source),
+           "(io:append-file! \"%s\" \"end\")\n"
+           "(str:length (io:read-file \"%s\"))",
+           path, path);
+  result = execute(source);
+  expectEqlDouble(result->as.number, 6003, "appends to files");
+  valueDestroy(&result);
+
+  snprintf(source, sizeof(source),
+           "(io:write-file! \"%s\" \"new\")\n(io:read-file \"%s\")",
+           path, path);
+  result = execute(source);
+  expectEqlString(result->as.string, "new", 4, "replaces the content");
+  valueDestroy(&result);
+  unlink(path);
+}
+
 int main() {
   tryAssert(arenaCreate((size_t)(64 * 1024)), ast_arena);
 
@@ -228,6 +663,19 @@ int main() {
   suite(emptyList);
   suite(currying);
   suite(expandingEnvironment);
+  suite(parallelMap);
+  suite(parallelReduce);
+  suite(tasks);
+  suite(channels);
+  suite(stringBuilders);
+  suite(stringViews);
+  suite(stringConcatenations);
+  suite(stringSearches);
+  suite(asyncFiles);
+  suite(mappedFiles);
+  suite(fileLines);
+  suite(stdinLines);
+  suite(writtenFiles);
 
   arenaDestroy(&ast_arena);
 
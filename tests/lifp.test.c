@@ -0,0 +1,239 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lifp/lifp.h"
+#include "../lifp/error.h"
+#include "../lifp/image.h"
+#include "../lifp/parse.h"
+
+#include "test.h"
+#include "utils.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static arena_t *test_arena;
+static const char IMAGE_PATH[] = "tests/lifp.test.lifpc";
+
+static result_value_ref_t hostTwice(const value_array_t *arguments,
+                                    position_t pos) {
+  if (arguments->count != 1 || arguments->data[0].type != VALUE_TYPE_NUMBER) {
+    throw(result_value_ref_t, ERROR_CODE_RUNTIME_ERROR, pos,
+          "host:twice requires a number");
+  }
+  return lifpNumber(arguments->data[0].as.number * 2);
+}
+
+static number_t hostHalf(number_t number) { return number / 2; }
+static number_t hostAverage(number_t left, number_t right) {
+  return (left + right) / 2;
+}
+
+void evaluation(void) {
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+
+  case("statements");
+  const char source[] = "(def! a 20)\n(def! b 22)\n(+ a b)";
+  value_t *value = nullptr;
+  tryAssert(lifpEvaluate(machine, test_arena, strlen(source), source), value);
+  expectEqlUint(value->type, VALUE_TYPE_NUMBER, "returns the last value");
+  expectEqlDouble(value->as.number, 42, "in the global environment");
+  valueDestroy(&value);
+
+  tryAssert(lifpEvaluate(machine, test_arena, 0, ""), value);
+  expectEqlUint(value->type, VALUE_TYPE_NIL, "returns nil for empty sources");
+  valueDestroy(&value);
+
+  case("errors");
+  result_value_ref_t result;
+  tryFail(lifpEvaluate(machine, test_arena, 7, "(+ 1 c)"), result);
+  expectEqlInt(result.code, ERROR_CODE_REFERENCE_SYMBOL_NOT_FOUND,
+               "reports evaluation errors");
+  expectEqlSize(result.meta.column, 6, "with their position");
+
+  tryFail(lifpEvaluate(machine, test_arena, 6, "(+ 1 2"), result);
+  expectEqlInt(result.code, ERROR_CODE_SYNTAX_UNBALANCED_PARENTHESES,
+               "reports syntax errors");
+
+  vmDestroy(&machine);
+}
+
+void hostValues(void) {
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+
+  case("builtins");
+  tryAssert(lifpRegister(machine, "host:twice", hostTwice));
+  const char call[] = "(host:twice 21)";
+  value_t *value = nullptr;
+  tryAssert(lifpEvaluate(machine, test_arena, strlen(call), call), value);
+  expectEqlDouble(value->as.number, 42, "calls native builtins");
+  valueDestroy(&value);
+
+  case("definitions");
+  value_t *name = nullptr;
+  tryAssert(lifpString("lifp"), name);
+  tryAssert(lifpDefine(machine, "name", name));
+  const char length[] = "(str:length name)";
+  tryAssert(lifpEvaluate(machine, test_arena, strlen(length), length), value);
+  expectEqlDouble(value->as.number, 4, "passes host values in");
+  valueDestroy(&value);
+
+  result_void_t defined;
+  tryFail(lifpDefine(machine, "name", name), defined);
+  expectEqlInt(defined.code, ERROR_CODE_REFERENCE_SYMBOL_ALREADY_DEFINED,
+               "does not redefine symbols");
+  valueDestroy(&name);
+
+  case("calls");
+  const char function[] = "(def! add (fn (a b) (+ a b)))";
+  tryAssert(lifpEvaluate(machine, test_arena, strlen(function), function),
+            value);
+  valueDestroy(&value);
+
+  value_t *arguments = nullptr;
+  tryAssert(lifpList(2), arguments);
+  expectEqlUint(arguments->as.list->data[1].type, VALUE_TYPE_NIL,
+                "creates lists of nil");
+  arguments->as.list->data[0].type = VALUE_TYPE_NUMBER;
+  arguments->as.list->data[0].as.number = 40;
+  arguments->as.list->data[1].type = VALUE_TYPE_NUMBER;
+  arguments->as.list->data[1].as.number = 2;
+
+  tryAssert(lifpCall(lifpLookup(machine, "add"), arguments->as.list), value);
+  expectEqlDouble(value->as.number, 42, "calls closures from the host");
+  valueDestroy(&value);
+
+  tryAssert(lifpCall(lifpLookup(machine, "+"), arguments->as.list), value);
+  expectEqlDouble(value->as.number, 42, "calls builtins from the host");
+  valueDestroy(&value);
+
+  result_value_ref_t result;
+  tryFail(lifpCall(lifpLookup(machine, "name"), arguments->as.list), result);
+  expectEqlInt(result.code, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+               "rejects calling other values");
+  valueDestroy(&arguments);
+
+  vmDestroy(&machine);
+}
+
+static value_t *evaluateString(vm_t *machine, const char *source) {
+  value_t *value = nullptr;
+  tryAssert(lifpEvaluate(machine, test_arena, strlen(source), source), value);
+  return value;
+}
+
+void typedBuiltins(void) {
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+  tryAssert(lifpRegisterUnary(machine, "host:half", hostHalf));
+  tryAssert(lifpRegisterBinary(machine, "host:average", hostAverage));
+
+  case("calls");
+  value_t *value = evaluateString(machine, "(host:half 84)");
+  expectEqlDouble(value->as.number, 42, "calls unary builtins");
+  valueDestroy(&value);
+
+  value = evaluateString(machine, "(host:average 40 44)");
+  expectEqlDouble(value->as.number, 42, "calls binary builtins");
+  valueDestroy(&value);
+
+  value = evaluateString(machine, "(def! x 80)\n"
+                                  "(host:average (host:half x) (+ x 4))");
+  expectEqlDouble(value->as.number, 62, "unboxes symbols and expressions");
+  valueDestroy(&value);
+
+  value = evaluateString(machine, "(math:floor 42.5)");
+  expectEqlDouble(value->as.number, 42, "is used by the standard library");
+  valueDestroy(&value);
+
+  value = evaluateString(machine, "(= host:half host:half)");
+  expectTrue(value->as.boolean, "compares typed builtins");
+  valueDestroy(&value);
+
+  case("errors");
+  result_value_ref_t result;
+  const char arity[] = "(host:half 1 2)";
+  tryFail(lifpEvaluate(machine, test_arena, strlen(arity), arity), result);
+  expectEqlInt(result.code, ERROR_CODE_TYPE_UNEXPECTED_ARITY,
+               "checks the arity");
+  expectIncludeString(result.message, "host:half requires 1 argument. Got 2",
+                      "names the builtin on arity errors");
+
+  const char binary[] = "(host:average 1)";
+  tryFail(lifpEvaluate(machine, test_arena, strlen(binary), binary), result);
+  expectIncludeString(result.message,
+                      "host:average requires 2 arguments. Got 1",
+                      "names the arity of binary builtins");
+
+  const char type[] = "(host:half \"a\")";
+  tryFail(lifpEvaluate(machine, test_arena, strlen(type), type), result);
+  expectEqlInt(result.code, ERROR_CODE_RUNTIME_ERROR_UNEXPECTED_TYPE,
+               "checks argument types");
+  expectIncludeString(result.message, "host:half requires a number. Got",
+                      "names the builtin on type errors");
+
+  case("host calls");
+  value_t arguments_data[2] = {
+      {.type = VALUE_TYPE_NUMBER, .as.number = 40},
+      {.type = VALUE_TYPE_NUMBER, .as.number = 44},
+  };
+  value_array_t arguments = {.count = 2, .data = arguments_data};
+  tryAssert(lifpCall(lifpLookup(machine, "host:average"), &arguments), value);
+  expectEqlDouble(value->as.number, 42, "calls typed builtins from the host");
+  valueDestroy(&value);
+
+  tryFail(lifpCall(lifpLookup(machine, "host:half"), &arguments), result);
+  expectEqlInt(result.code, ERROR_CODE_TYPE_UNEXPECTED_ARITY,
+               "checks the arity of host calls");
+  expectIncludeString(result.message, "host:half requires 1 argument. Got 2",
+                      "names the builtin on host calls");
+
+  vmDestroy(&machine);
+}
+
+void images(void) {
+  const char source[] = "(def! a 40)\n(+ a 2)";
+  char statement[sizeof(source)];
+
+  image_writer_t *writer = nullptr;
+  tryAssert(imageWriterCreate(), writer);
+  ssize_t offset = 0;
+  while (offset < (ssize_t)strlen(source)) {
+    node_t *node = nullptr;
+    tryAssert(parseStatement(test_arena, (ssize_t)strlen(source), statement,
+                             source, &offset),
+              node);
+    if (node) {
+      tryAssert(imageWriterAppend(writer, node));
+    }
+  }
+  tryAssert(imageWriterSave(writer, IMAGE_PATH, strlen(source), source));
+  imageWriterDestroy(&writer);
+
+  image_t *image = nullptr;
+  tryAssert(imageOpen(IMAGE_PATH), image);
+
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+  value_t *value = nullptr;
+  tryAssert(lifpEvaluateImage(machine, test_arena, image), value);
+  expectEqlDouble(value->as.number, 42, "evaluates compiled images");
+  valueDestroy(&value);
+
+  vmDestroy(&machine);
+  imageClose(&image);
+  unlink(IMAGE_PATH);
+}
+
+int main(void) {
+  tryAssert(arenaCreate((size_t)(1024 * 1024)), test_arena);
+
+  suite(evaluation);
+  suite(hostValues);
+  suite(typedBuiltins);
+  suite(images);
+
+  arenaDestroy(&test_arena);
+  return report();
+}
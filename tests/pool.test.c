@@ -0,0 +1,295 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/pool.h"
+#include "test.h"
+#include "utils.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static constexpr size_t JOBS_COUNT = 1000;
+
+static void square(void *argument) {
+  size_t *number = argument;
+  *number = *number * *number;
+}
+
+void jobs(void) {
+  pool_t *pool = nullptr;
+  tryAssert(poolCreate(4), pool);
+  expectEqlSize(poolConcurrency(pool), 5, "counts the waiting thread");
+
+  size_t numbers[JOBS_COUNT];
+  pool_group_t group = {};
+  for (size_t i = 0; i < JOBS_COUNT; i++) {
+    numbers[i] = i;
+    poolSubmit(pool, &group, square, &numbers[i]);
+  }
+  poolWait(pool, &group);
+
+  bool all_squared = true;
+  for (size_t i = 0; i < JOBS_COUNT; i++) {
+    all_squared = all_squared && numbers[i] == i * i;
+  }
+  expectTrue(all_squared, "runs all the jobs of a group");
+  expectEqlSize(atomic_load(&group.pending), 0, "completes the group");
+
+  poolDestroy(&pool);
+  expectNull(pool, "destroys the pool");
+}
+
+typedef struct {
+  pool_t *pool;
+  atomic_size_t *counter;
+} nested_t;
+
+static void increment(void *argument) {
+  atomic_size_t *counter = argument;
+  atomic_fetch_add(counter, 1);
+}
+
+static void spawnIncrements(void *argument) {
+  nested_t *nested = argument;
+  pool_group_t group = {};
+  for (size_t i = 0; i < 10; i++) {
+    poolSubmit(nested->pool, &group, increment, nested->counter);
+  }
+  poolWait(nested->pool, &group);
+}
+
+void nestedGroups(void) {
+  pool_t *pool = nullptr;
+  tryAssert(poolCreate(2), pool);
+
+  atomic_size_t counter = 0;
+  nested_t nested = {.pool = pool, .counter = &counter};
+  pool_group_t group = {};
+  for (size_t i = 0; i < 100; i++) {
+    poolSubmit(pool, &group, spawnIncrements, &nested);
+  }
+  poolWait(pool, &group);
+
+  expectEqlSize(atomic_load(&counter), 1000, "waits groups within jobs");
+  poolDestroy(&pool);
+}
+
+void parentGroups(void) {
+  pool_t *pool = nullptr;
+  tryAssert(poolCreate(2), pool);
+
+  size_t numbers[4];
+  pool_group_t parent = {};
+  pool_group_t children[4] = {};
+  for (size_t i = 0; i < 4; i++) {
+    numbers[i] = i + 2;
+    children[i].parent = &parent;
+    poolSubmit(pool, &children[i], square, &numbers[i]);
+  }
+  poolWait(pool, &parent);
+
+  bool all_completed = true;
+  for (size_t i = 0; i < 4; i++) {
+    all_completed = all_completed && atomic_load(&children[i].pending) == 0 &&
+                    numbers[i] == (i + 2) * (i + 2);
+  }
+  expectTrue(all_completed, "waits for the jobs of child groups");
+  poolDestroy(&pool);
+}
+
+void withoutWorkers(void) {
+  pool_t *pool = nullptr;
+  tryAssert(poolCreate(0), pool);
+
+  size_t number = 12;
+  pool_group_t group = {};
+  poolSubmit(pool, &group, square, &number);
+  expectEqlSize(number, 144, "runs jobs on the calling thread");
+  poolWait(pool, &group);
+
+  poolDestroy(&pool);
+}
+
+static constexpr size_t RENDEZVOUS_COUNT = 4;
+
+// Returns once all the jobs arrived, which needs them to run at once
+static void rendezvous(void *argument) {
+  atomic_size_t *arrived = argument;
+  atomic_fetch_add(arrived, 1);
+
+  pool_t *pool = poolBlock();
+  const struct timespec pause = {.tv_sec = 0, .tv_nsec = 1000000L};
+  while (atomic_load(arrived) < RENDEZVOUS_COUNT) {
+    nanosleep(&pause, nullptr);
+  }
+  poolUnblock(pool);
+}
+
+void blocked(void) {
+  pool_t *pool = nullptr;
+  tryAssert(poolCreate(1), pool);
+  expectNull(poolBlock(), "ignores threads running no jobs");
+
+  atomic_size_t arrived = 0;
+  pool_group_t group = {};
+  for (size_t i = 0; i < RENDEZVOUS_COUNT; i++) {
+    poolSubmit(pool, &group, rendezvous, &arrived);
+  }
+  poolWait(pool, &group);
+
+  expectEqlSize(atomic_load(&arrived), RENDEZVOUS_COUNT,
+                "runs more blocked jobs than threads");
+  poolDestroy(&pool);
+  expectNull(pool, "stops the spare workers");
+}
+
+typedef struct {
+  atomic_size_t *next;
+  size_t order;
+} ordered_t;
+
+static void record(void *argument) {
+  ordered_t *ordered = argument;
+  ordered->order = atomic_fetch_add(ordered->next, 1);
+}
+
+static uint64_t milliseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+void scheduled(void) {
+  for (size_t workers = 0; workers <= 2; workers += 2) {
+    pool_t *pool = nullptr;
+    tryAssert(poolCreate(workers), pool);
+
+    atomic_size_t next = 0;
+    ordered_t late = {.next = &next};
+    ordered_t early = {.next = &next};
+    ordered_t immediate = {.next = &next};
+
+    const uint64_t start = milliseconds();
+    pool_group_t group = {};
+    poolSchedule(pool, &group, 60, record, &late);
+    poolSchedule(pool, &group, 20, record, &early);
+    poolSchedule(pool, &group, 0, record, &immediate);
+    poolWait(pool, &group);
+
+    expectEqlSize(immediate.order, 0, "runs jobs without delay first");
+    expectEqlSize(early.order, 1, "runs jobs in order of deadline");
+    expectEqlSize(late.order, 2, "runs the latest job last");
+    expectTrue(milliseconds() - start >= 60, "waits for the delay");
+
+    poolDestroy(&pool);
+  }
+}
+
+typedef struct {
+  pool_t *pool;
+  pool_group_t *group;
+  int fd;
+  size_t received;
+  bool closed;
+} stream_t;
+
+static void drain(void *argument) {
+  stream_t *stream = argument;
+  char buffer[16];
+  while (true) {
+    ssize_t count = read(stream->fd, buffer, sizeof(buffer));
+    if (count > 0) {
+      stream->received += (size_t)count;
+      continue;
+    }
+    if (count < 0)
+      poolWatch(stream->pool, stream->group, stream->fd, POLLIN, drain, stream);
+    else
+      stream->closed = true;
+    return;
+  }
+}
+
+void watched(void) {
+  for (size_t workers = 0; workers <= 2; workers += 2) {
+    pool_t *pool = nullptr;
+    tryAssert(poolCreate(workers), pool);
+
+    pool_group_t group = {};
+    int first[2];
+    int second[2];
+    pipe(first);
+    pipe(second);
+    stream_t streams[2] = {
+        {.pool = pool, .group = &group, .fd = first[0]},
+        {.pool = pool, .group = &group, .fd = second[0]},
+    };
+    for (size_t i = 0; i < 2; i++) {
+      fcntl(streams[i].fd, F_SETFL, O_NONBLOCK);
+      poolWatch(pool, &group, streams[i].fd, POLLIN, drain, &streams[i]);
+    }
+
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = 10000000L};
+    write(second[1], "abc", 3);
+    nanosleep(&pause, nullptr);
+    write(first[1], "de", 2);
+    nanosleep(&pause, nullptr);
+    write(second[1], "fgh", 3);
+    close(first[1]);
+    close(second[1]);
+    poolWait(pool, &group);
+
+    expectEqlSize(streams[0].received, 2, "reads the first descriptor");
+    expectEqlSize(streams[1].received, 6, "reads in several steps");
+    expectTrue(streams[0].closed && streams[1].closed,
+               "waits until descriptors are closed");
+
+    close(first[0]);
+    close(second[0]);
+    poolDestroy(&pool);
+  }
+}
+
+void forked(void) {
+  pool_t *pool = nullptr;
+  tryAssert(poolCreate(2), pool);
+
+  size_t number = 3;
+  pool_group_t group = {};
+  poolSubmit(pool, &group, square, &number);
+  poolWait(pool, &group);
+
+  pid_t child = fork();
+  if (child == 0) {
+    size_t numbers[JOBS_COUNT];
+    pool_group_t child_group = {};
+    for (size_t i = 0; i < JOBS_COUNT; i++) {
+      numbers[i] = i;
+      poolSubmit(pool, &child_group, square, &numbers[i]);
+    }
+    poolWait(pool, &child_group);
+    poolDestroy(&pool);
+    _exit(numbers[JOBS_COUNT - 1] == (JOBS_COUNT - 1) * (JOBS_COUNT - 1) ? 0
+                                                                         : 1);
+  }
+
+  int status = -1;
+  waitpid(child, &status, 0);
+  expectTrue(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+             "restarts workers in forked processes");
+  poolDestroy(&pool);
+}
+
+int main(void) {
+  suite(jobs);
+  suite(nestedGroups);
+  suite(parentGroups);
+  suite(withoutWorkers);
+  suite(blocked);
+  suite(scheduled);
+  suite(watched);
+  suite(forked);
+  return report();
+}
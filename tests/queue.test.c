@@ -0,0 +1,98 @@
+#include "../lib/queue.h"
+#include "test.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+void bounded(void) {
+  queue_t *queue = nullptr;
+  tryAssert(queueCreate(3, sizeof(size_t)), queue);
+
+  size_t number = 0;
+  expectFalse(queuePop(queue, &number), "is empty when created");
+
+  bool all_pushed = true;
+  for (size_t i = 1; i <= 3; i++) {
+    all_pushed = all_pushed && queuePush(queue, &i);
+  }
+  expectTrue(all_pushed, "holds up to its capacity");
+
+  number = 4;
+  expectFalse(queuePush(queue, &number), "rejects elements when full");
+
+  queuePop(queue, &number);
+  expectEqlSize(number, 1, "pops the oldest element");
+
+  number = 4;
+  expectTrue(queuePush(queue, &number), "reuses popped slots");
+
+  bool in_order = true;
+  for (size_t i = 2; i <= 4; i++) {
+    in_order = in_order && queuePop(queue, &number) && number == i;
+  }
+  expectTrue(in_order, "keeps elements in order across rounds");
+
+  queueDestroy(&queue);
+  expectNull(queue, "destroys the queue");
+}
+
+static constexpr size_t PRODUCERS = 4;
+static constexpr size_t ELEMENTS = 10000;
+
+typedef struct {
+  queue_t *queue;
+  size_t first;
+  atomic_size_t *sum;
+} worker_t;
+
+static void *produce(void *argument) {
+  const worker_t *worker = argument;
+  for (size_t i = worker->first; i < worker->first + ELEMENTS; i++) {
+    while (!queuePush(worker->queue, &i)) {
+    }
+  }
+  return nullptr;
+}
+
+static void *consume(void *argument) {
+  const worker_t *worker = argument;
+  for (size_t i = 0; i < ELEMENTS; i++) {
+    size_t number = 0;
+    while (!queuePop(worker->queue, &number)) {
+    }
+    atomic_fetch_add(worker->sum, number);
+  }
+  return nullptr;
+}
+
+void concurrent(void) {
+  queue_t *queue = nullptr;
+  tryAssert(queueCreate(16, sizeof(size_t)), queue);
+
+  atomic_size_t sum = 0;
+  pthread_t threads[PRODUCERS * 2];
+  worker_t workers[PRODUCERS];
+  for (size_t i = 0; i < PRODUCERS; i++) {
+    workers[i] = (worker_t){.queue = queue, .first = i * ELEMENTS, .sum = &sum};
+    pthread_create(&threads[i], nullptr, produce, &workers[i]);
+    pthread_create(&threads[PRODUCERS + i], nullptr, consume, &workers[i]);
+  }
+  for (size_t i = 0; i < PRODUCERS * 2; i++) {
+    pthread_join(threads[i], nullptr);
+  }
+
+  const size_t count = PRODUCERS * ELEMENTS;
+  expectEqlSize(atomic_load(&sum), count * (count - 1) / 2,
+                "passes every element once between threads");
+
+  size_t number = 0;
+  expectFalse(queuePop(queue, &number), "is drained by the consumers");
+  queueDestroy(&queue);
+}
+
+int main(void) {
+  suite(bounded);
+  suite(concurrent);
+  return report();
+}
@@ -0,0 +1,178 @@
+#define _POSIX_C_SOURCE 200809L
+#include "test.h"
+#include "utils.h"
+
+#include "../lib/arena.h"
+#include "../lifp/evaluate.h"
+#include "../lifp/parse.h"
+#include "../lifp/snapshot.h"
+#include "../lifp/tokenize.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static arena_t *ast_arena;
+static const char SNAPSHOT_PATH[] = "tests/snapshot.test.lifps";
+
+static value_t *execute(vm_t *machine, const char *input) {
+  arenaReset(ast_arena);
+  token_list_t *tokens = nullptr;
+  tryAssert(tokenize(ast_arena, input), tokens);
+
+  size_t offset = 0;
+  size_t depth = 0;
+  node_t *node = nullptr;
+  tryAssert(parse(ast_arena, tokens, &offset, &depth), node);
+
+  value_t *result = nullptr;
+  tryAssert(evaluate(node, machine->global), result);
+  return result;
+}
+
+static vm_t *restore(void) {
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+  tryAssert(snapshotRestore(machine, SNAPSHOT_PATH));
+  return machine;
+}
+
+void values(void) {
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+  const char *definitions[] = {
+      "(def! n 42)",
+      "(def! s \"hello\")",
+      "(def! b true)",
+      "(def! empty nil)",
+      "(def! l (list:from 1 (list:from 2 3) \"four\"))",
+      "(def! plus +)",
+  };
+  for (size_t i = 0; i < arraySize(definitions); i++) {
+    value_t *result = execute(machine, definitions[i]);
+    valueDestroy(&result);
+  }
+  tryAssert(snapshotSave(machine, SNAPSHOT_PATH));
+  vmDestroy(&machine);
+
+  machine = restore();
+  value_t *result = execute(machine, "n");
+  expectEqlDouble(result->as.number, 42, "restores numbers");
+  valueDestroy(&result);
+
+  result = execute(machine, "s");
+  expectEqlString(result->as.string, "hello", 6, "restores strings");
+  valueDestroy(&result);
+
+  result = execute(machine, "b");
+  expectTrue(result->as.boolean, "restores booleans");
+  valueDestroy(&result);
+
+  result = execute(machine, "empty");
+  expectEqlUint(result->type, VALUE_TYPE_NIL, "restores nil");
+  valueDestroy(&result);
+
+  result = execute(machine, "(list:nth 1 (list:nth 1 l))");
+  expectEqlDouble(result->as.number, 3, "restores nested lists");
+  valueDestroy(&result);
+
+  result = execute(machine, "(plus 1 2)");
+  expectEqlDouble(result->as.number, 3, "restores builtins by name");
+  valueDestroy(&result);
+
+  vmDestroy(&machine);
+  remove(SNAPSHOT_PATH);
+}
+
+void closures(void) {
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+  const char *definitions[] = {
+      "(def! sum (fn (a b) (+ a b)))",
+      "(def! adder (fn (a) (fn (b) (+ a b))))",
+      "(def! add2 (adder 2))",
+      "(def! add3 (adder 3))",
+      "(def! nested (fn (a) (fn (b) (fn (c) (+ a b c)))))",
+      "(def! counter ((nested 4) 6))",
+      "(def! fact (fn (n) (cond ((= n 0) 1) (* n (fact (- n 1))))))",
+  };
+  for (size_t i = 0; i < arraySize(definitions); i++) {
+    value_t *result = execute(machine, definitions[i]);
+    valueDestroy(&result);
+  }
+  tryAssert(snapshotSave(machine, SNAPSHOT_PATH));
+  vmDestroy(&machine);
+
+  machine = restore();
+  value_t *result = execute(machine, "(sum 1 2)");
+  expectEqlDouble(result->as.number, 3, "restores functions");
+  valueDestroy(&result);
+
+  result = execute(machine, "(add2 1)");
+  expectEqlDouble(result->as.number, 3, "restores captured environments");
+  valueDestroy(&result);
+
+  result = execute(machine, "(add3 1)");
+  expectEqlDouble(result->as.number, 4, "keeps environments apart");
+  valueDestroy(&result);
+
+  result = execute(machine, "(counter 1)");
+  expectEqlDouble(result->as.number, 11, "restores environment chains");
+  valueDestroy(&result);
+
+  result = execute(machine, "(fact 5)");
+  expectEqlDouble(result->as.number, 120, "restores recursive functions");
+  valueDestroy(&result);
+
+  result = execute(machine, "((adder 5) 5)");
+  expectEqlDouble(result->as.number, 10, "restored closures can be called");
+  valueDestroy(&result);
+
+  vmDestroy(&machine);
+  remove(SNAPSHOT_PATH);
+}
+
+void invalid(void) {
+  FILE *file = fopen(SNAPSHOT_PATH, "wb");
+  fputs("(def! a 1)", file);
+  fclose(file);
+
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+
+  result_void_t result;
+  tryFail(snapshotRestore(machine, SNAPSHOT_PATH), result);
+  expectEqlInt(result.code, SNAPSHOT_ERROR_INVALID, "rejects other files");
+
+  tryFail(snapshotRestore(machine, "tests/does-not-exist.lifps"), result);
+  expectEqlInt(result.code, SNAPSHOT_ERROR_IO, "reports missing snapshots");
+
+  // Cut within the last string, after the first one was read
+  value_t *value = execute(machine, "(def! l (list:from \"abc\" \"def\"))");
+  valueDestroy(&value);
+  tryAssert(snapshotSave(machine, SNAPSHOT_PATH));
+  file = fopen(SNAPSHOT_PATH, "rb");
+  fseek(file, 0, SEEK_END);
+  const long size = ftell(file);
+  fclose(file);
+  truncate(SNAPSHOT_PATH, size - 2);
+  vmDestroy(&machine);
+
+  tryAssert(vmCreate(), machine);
+  tryFail(snapshotRestore(machine, SNAPSHOT_PATH), result);
+  expectEqlInt(result.code, SNAPSHOT_ERROR_INVALID,
+               "rejects truncated snapshots");
+
+  vmDestroy(&machine);
+  remove(SNAPSHOT_PATH);
+}
+
+int main(void) {
+  tryAssert(arenaCreate((size_t)(64 * 1024)), ast_arena);
+
+  suite(values);
+  suite(closures);
+  suite(invalid);
+
+  arenaDestroy(&ast_arena);
+  return report();
+}
@@ -3,6 +3,8 @@
 
 #include "../lifp/error.h"
 #include "../lifp/virtual_machine.h"
+#include <pthread.h>
+#include <stdio.h>
 
 static arena_t *test_arena;
 
@@ -71,12 +73,73 @@ void resolutions(void) {
   vmDestroy(&machine);
 }
 
+void isolation(void) {
+  vm_t *first = nullptr;
+  vm_t *second = nullptr;
+  tryAssert(vmCreate(), first);
+  tryAssert(vmCreate(), second);
+
+  value_t value = {VALUE_TYPE_NUMBER, .as.number = 12.0};
+  tryAssert(environmentRegisterSymbol(first->global, "twelve", &value));
+  expectNull(environmentResolveSymbol(second->global, "twelve"),
+             "does not share definitions");
+
+  environment_t *child;
+  tryAssert(environmentCreate(second->global), child);
+  expectTrue(child->machine == second, "children belong to the machine");
+
+  vmDestroy(&first);
+  expectNotNull(environmentResolveSymbol(child, "+"),
+                "outlives other machines");
+
+  environmentForceDestroy(&child);
+  vmDestroy(&second);
+}
+
+static void *defineMany(void *context) {
+  bool *resolved = context;
+  vm_t *machine = nullptr;
+  tryAssert(vmCreate(), machine);
+
+  char key[16];
+  for (int i = 0; i < 256; i++) {
+    value_t value = {VALUE_TYPE_NUMBER, .as.number = i};
+    snprintf(key, sizeof(key), "n%d", i);
+    tryAssert(environmentRegisterSymbol(machine->global, key, &value));
+  }
+
+  *resolved = true;
+  for (int i = 0; i < 256; i++) {
+    snprintf(key, sizeof(key), "n%d", i);
+    const value_t *value = environmentResolveSymbol(machine->global, key);
+    *resolved = *resolved && value && value->as.number == i &&
+                environmentResolveSymbol(machine->global, "+");
+  }
+
+  vmDestroy(&machine);
+  return nullptr;
+}
+
+void parallelMachines(void) {
+  pthread_t threads[4];
+  bool resolved[4] = {};
+  for (size_t i = 0; i < 4; i++) {
+    pthread_create(&threads[i], nullptr, defineMany, &resolved[i]);
+  }
+  for (size_t i = 0; i < 4; i++) {
+    pthread_join(threads[i], nullptr);
+    expectTrue(resolved[i], "runs machines on parallel threads");
+  }
+}
+
 int main(void) {
   tryAssert(arenaCreate((size_t)(1024 * 1024)), test_arena);
 
   suite(createDestroy);
   suite(environmentCreateDestroy);
   suite(resolutions);
+  suite(isolation);
+  suite(parallelMachines);
 
   arenaDestroy(&test_arena);
   return report();
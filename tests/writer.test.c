@@ -0,0 +1,68 @@
+#define _POSIX_C_SOURCE 200809L
+#include "../lib/writer.h"
+#include "test.h"
+#include "utils.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+static size_t written(FILE *stream) {
+  struct stat status;
+  fstat(fileno(stream), &status);
+  return (size_t)status.st_size;
+}
+
+void fullyBuffered(void) {
+  FILE *stream = tmpfile();
+  writer_t writer;
+  writerInit(&writer, stream, WRITER_FLUSH_FULL);
+
+  writerWrite(&writer, "hello\n", 6);
+  expectEqlSize(written(stream), 0, "buffers new lines");
+
+  writerFlush(&writer);
+  expectEqlSize(written(stream), 6, "writes on flush");
+
+  char chunk[WRITER_CAPACITY / 4] = {};
+  for (size_t i = 0; i < 4; i++) {
+    writerWrite(&writer, chunk, sizeof(chunk));
+  }
+  expectEqlSize(written(stream), 6, "buffers up to its capacity");
+  writerWrite(&writer, "!", 1);
+  expectEqlSize(written(stream), 6 + WRITER_CAPACITY,
+                "writes when the buffer is full");
+
+  char large[WRITER_CAPACITY * 2] = {};
+  writerWrite(&writer, large, sizeof(large));
+  writerDeinit(&writer);
+  expectEqlSize(written(stream), 7 + WRITER_CAPACITY * 3,
+                "writes everything when deinitialized");
+  fclose(stream);
+}
+
+void lineBuffered(void) {
+  FILE *stream = tmpfile();
+  writer_t writer;
+  writerInit(&writer, stream, WRITER_FLUSH_LINE);
+
+  writerWrite(&writer, "hello", 5);
+  expectEqlSize(written(stream), 0, "buffers partial lines");
+  writerWriteLine(&writer, " world", 6);
+  expectEqlSize(written(stream), 12, "writes complete lines");
+
+  writerDeinit(&writer);
+  fclose(stream);
+
+  stream = tmpfile();
+  writerInit(&writer, stream, WRITER_FLUSH_WRITE);
+  writerWrite(&writer, "hello", 5);
+  expectEqlSize(written(stream), 5, "writes every write when unbuffered");
+  writerDeinit(&writer);
+  fclose(stream);
+}
+
+int main(void) {
+  suite(fullyBuffered);
+  suite(lineBuffered);
+  return report();
+}